@@ -104,6 +104,28 @@ int messages_create_message(messages_message_type_e type, messages_message_h *ms
  */
 int messages_destroy_message(messages_message_h msg);
 
+/**
+ * @brief Creates a copy of the message.
+ * @details The copy shares the text, the attachments and the underlying message data with @a msg
+ *          until one of the handles is modified, so copying a message is cheap regardless of its size.
+ *
+ * @remark @a clone must be released with messages_destroy_message() by you.
+ * @remark The message passed to messages_incoming_cb() or messages_search_cb() can be kept beyond the callback by copying it with this function.
+ *
+ * @param[in] msg The message handle to copy
+ * @param[out] clone A message handle to be newly created if successful
+ *
+ * @return 0 on success, otherwise a negative error value.
+ * @retval #MESSAGES_ERROR_NONE Successful
+ * @retval #MESSAGES_ERROR_INVALID_PARAMETER Invalid parameter
+ * @retval #MESSAGES_ERROR_OUT_OF_MEMORY Out of memory
+ * @retval #MESSAGES_ERROR_OPERATION_FAILED Messaging operation failed
+ *
+ * @see	messages_create_message()
+ * @see	messages_destroy_message()
+ */
+int messages_clone_message(messages_message_h msg, messages_message_h *clone);
+
 /**
  * @brief Gets the message id of the message.
  *
@@ -234,7 +256,8 @@ int messages_remove_all_addresses(messages_message_h msg);
  *
  * @param[in] msg The message handle
  * @param[in] text The text of the message \n
- * 		   The maximum length of @a text is 1530.
+ * 		   The maximum length of @a text is 1530 bytes. \n
+ * 		   For SMS, @a text should also fit in 10 segments (see messages_sms_analyze_text()).
  *
  * @return 0 on success, otherwise a negative error value.
  * @retval #MESSAGES_ERROR_NONE Successful
@@ -264,6 +287,26 @@ int messages_set_text(messages_message_h msg, const char *text);
 int messages_get_text(messages_message_h msg, char **text);
 
 
+/**
+ * @brief Analyzes the text to be sent as an SMS.
+ * @details Finds whether @a text can be encoded in the GSM 7-bit default alphabet or needs UCS-2,
+ *          and how many segments a concatenated SMS with the text consists of.\n
+ *          The analysis needs a single pass over @a text, so it is suitable for every keystroke.
+ *
+ * @param[in] text The UTF-8 text of the message
+ * @param[out] encoding The encoding needed for @a text
+ * @param[out] length The number of septets for #MESSAGES_SMS_ENCODING_GSM7BIT or UCS-2 code units for #MESSAGES_SMS_ENCODING_UCS2
+ * @param[out] segment_count The number of SMS segments
+ *
+ * @return 0 on success, otherwise a negative error value.
+ * @retval #MESSAGES_ERROR_NONE Successful
+ * @retval #MESSAGES_ERROR_INVALID_PARAMETER Invalid parameter
+ *
+ * @see	messages_set_text()
+ */
+int messages_sms_analyze_text(const char *text, messages_sms_encoding_e *encoding, int *length, int *segment_count);
+
+
 /**
  * @brief Gets the time of the message.
  *
@@ -293,11 +336,417 @@ int messages_get_time(messages_message_h msg, time_t *time);
  * @retval #MESSAGES_ERROR_INVALID_PARAMETER Invalid parameter
  * @retval #MESSAGES_ERROR_SENDING_FAILED Sending a message failed
  * @retval #MESSAGES_ERROR_OPERATION_FAILED Messaging operation failed
+ * @retval #MESSAGES_ERROR_DUPLICATE_MESSAGE The same message was sent within the duplicate window
+ * @retval #MESSAGES_ERROR_MESSAGE_TOO_LARGE The MMS message is larger than the size limit
  *
  * @see messages_sent_cb()
+ * @see messages_set_duplicate_window()
  */
 int messages_send_message(messages_service_h service, messages_message_h msg, bool save_to_sentbox, messages_sent_cb callback, void *user_data);
 
+/**
+ * @brief Sends the message to all recipients and gives the request ID to cancel the sending with.
+ * @details This function is the same as messages_send_message(), except that it gives the request ID.
+ *
+ * @param[in] service The message service handle
+ * @param[in] msg The message handle
+ * @param[in] save_to_sentbox Set to true to save the message in the sentbox, else false
+ * @param[in] callback The callback function
+ * @param[in] user_data The user data to be passed to the callback function
+ * @param[out] request_id The request ID, which is kept across the retries of the message
+ *
+ * @return 0 on success, otherwise a negative error value.
+ * @retval #MESSAGES_ERROR_NONE Successful
+ * @retval #MESSAGES_ERROR_INVALID_PARAMETER Invalid parameter
+ * @retval #MESSAGES_ERROR_SENDING_FAILED Sending a message failed
+ * @retval #MESSAGES_ERROR_OPERATION_FAILED Messaging operation failed
+ * @retval #MESSAGES_ERROR_DUPLICATE_MESSAGE The same message was sent within the duplicate window
+ * @retval #MESSAGES_ERROR_MESSAGE_TOO_LARGE The MMS message is larger than the size limit
+ *
+ * @see messages_send_message()
+ * @see messages_cancel_sending()
+ */
+int messages_send_message_with_id(messages_service_h service, messages_message_h msg, bool save_to_sentbox,
+							messages_sent_cb callback, void *user_data, int *request_id);
+
+/**
+ * @brief Sends the message to all recipients at the given time.
+ * @details The message is copied, so @a msg can be changed or destroyed after this function returns.
+ *          When the time comes, the message is sent as by messages_send_message() and @a callback is invoked
+ *          with the result. A message whose time has passed is sent at once.
+ *
+ * @remarks The delay is computed when this function is called, so later changes of the system time do not move it.\n
+ *          Scheduled messages are kept until messages_close_service(), or across restarts with messages_set_outbox_journal().\n
+ *          The message is sent from a timer of the default main context, so the application must run the default
+ *          main loop, for example with g_main_loop_run(). Without it, the message is never sent.
+ *
+ * @param[in] service The message service handle
+ * @param[in] msg The message handle
+ * @param[in] when The time to send the message at
+ * @param[in] save_to_sentbox Set to true to save the message in the sentbox, else false
+ * @param[in] callback The callback function
+ * @param[in] user_data The user data to be passed to the callback function
+ * @param[out] request_id The request ID to cancel the sending with, can be @c NULL
+ *
+ * @return 0 on success, otherwise a negative error value.
+ * @retval #MESSAGES_ERROR_NONE Successful
+ * @retval #MESSAGES_ERROR_INVALID_PARAMETER Invalid parameter
+ * @retval #MESSAGES_ERROR_OUT_OF_MEMORY Out of memory
+ * @retval #MESSAGES_ERROR_MESSAGE_TOO_LARGE The MMS message is larger than the size limit
+ *
+ * @see messages_send_message()
+ * @see messages_cancel_sending()
+ */
+int messages_send_message_at(messages_service_h service, messages_message_h msg, time_t when, bool save_to_sentbox,
+							messages_sent_cb callback, void *user_data, int *request_id);
+
+/**
+ * @brief Cancels sending a message.
+ * @details A message waiting for a retry is dropped, and a message submitted to the messaging service
+ *          is withdrawn if it is not sent yet. messages_sent_cb() is invoked with #MESSAGES_SENDING_CANCELED.
+ *
+ * @param[in] service The message service handle
+ * @param[in] request_id The request ID given by messages_send_message_with_id() or messages_send_message_at()
+ *
+ * @return 0 on success, otherwise a negative error value.
+ * @retval #MESSAGES_ERROR_NONE Successful
+ * @retval #MESSAGES_ERROR_INVALID_PARAMETER Invalid parameter, or the sending is not pending
+ * @retval #MESSAGES_ERROR_OPERATION_FAILED The message can not be withdrawn from the messaging service
+ *
+ * @see messages_send_message_with_id()
+ * @see messages_cancel_all_sendings()
+ */
+int messages_cancel_sending(messages_service_h service, int request_id);
+
+/**
+ * @brief Cancels sending all the messages pending on the service.
+ * @details Each canceled sending invokes its messages_sent_cb() with #MESSAGES_SENDING_CANCELED.
+ *
+ * @remarks The messages already sent by the messaging service are not canceled.
+ *
+ * @param[in] service The message service handle
+ *
+ * @return 0 on success, otherwise a negative error value.
+ * @retval #MESSAGES_ERROR_NONE Successful
+ * @retval #MESSAGES_ERROR_INVALID_PARAMETER Invalid parameter
+ * @retval #MESSAGES_ERROR_OPERATION_FAILED Some of the messages can not be withdrawn from the messaging service
+ *
+ * @see messages_cancel_sending()
+ */
+int messages_cancel_all_sendings(messages_service_h service);
+
+/**
+ * @brief Sends a text of any length as a series of SMS messages to all recipients.
+ * @details @a text is split at segment boundaries into parts that each fit in a concatenated SMS,
+ *          using the GSM 7-bit or UCS-2 segment sizes as appropriate. The parts are sent one after another
+ *          without waiting for the status of the previous ones.
+ *
+ * @remarks The recipients and the other attributes of @a msg are used for every part. The text of @a msg is not changed.
+ * @remarks @a callback is invoked once, after the status of every sent part is reported.
+ *          It receives #MESSAGES_SENDING_SUCCEEDED only if all the parts are sent.
+ * @remarks If sending a part fails after others were sent, the remaining parts are not sent and @a callback receives #MESSAGES_SENDING_FAILED.
+ * @remarks The duplicate window is checked once for the whole @a text, so parts that repeat each other are all sent.
+ *
+ * @param[in] service The message service handle
+ * @param[in] msg The SMS message handle
+ * @param[in] text The text to send
+ * @param[in] save_to_sentbox Set to true to save the message in the sentbox, else false
+ * @param[in] callback The callback function
+ * @param[in] user_data The user data to be passed to the callback function
+ *
+ * @return 0 on success, otherwise a negative error value.
+ * @retval #MESSAGES_ERROR_NONE Successful
+ * @retval #MESSAGES_ERROR_INVALID_PARAMETER Invalid parameter
+ * @retval #MESSAGES_ERROR_OUT_OF_MEMORY Out of memory
+ * @retval #MESSAGES_ERROR_SENDING_FAILED Sending a message failed
+ * @retval #MESSAGES_ERROR_OPERATION_FAILED Messaging operation failed
+ * @retval #MESSAGES_ERROR_DUPLICATE_MESSAGE The same text was sent within the duplicate window
+ *
+ * @see messages_send_message()
+ * @see messages_sms_analyze_text()
+ * @see messages_sent_cb()
+ */
+int messages_sms_send_long_text(messages_service_h service, messages_message_h msg, const char *text,
+							bool save_to_sentbox, messages_sent_cb callback, void *user_data);
+
+/**
+ * @brief Sets how long to wait for the sending status of a message.
+ * @details If the status of a message sent by messages_send_message() is not reported within @a timeout seconds,
+ *          messages_sent_cb() is invoked with #MESSAGES_SENDING_TIMED_OUT and a status reported later is ignored.\n
+ *          By default there is no timeout, and messages_sent_cb() waits for the status reported by the messaging service.
+ *
+ * @remarks The timeout applies to the messages sent after this function is called.\n
+ *          The timeout is checked from a timer of the default main context. Unless the application runs the default
+ *          main loop, messages_sent_cb() is never invoked with #MESSAGES_SENDING_TIMED_OUT.
+ *
+ * @param[in] service The message service handle
+ * @param[in] timeout The timeout in seconds, or 0 to wait without limit
+ *
+ * @return 0 on success, otherwise a negative error value.
+ * @retval #MESSAGES_ERROR_NONE Successful
+ * @retval #MESSAGES_ERROR_INVALID_PARAMETER Invalid parameter
+ *
+ * @see messages_send_message()
+ * @see messages_sent_cb()
+ */
+int messages_set_sending_timeout(messages_service_h service, int timeout);
+
+/**
+ * @brief Sets the directory where the text of MMS messages is written for sending.
+ * @details Each MMS message gets its own text file. It is removed once the message is destroyed
+ *          and the sending status of every request sending it was reported, timed out or canceled.
+ *          A directory on a memory file system such as tmpfs avoids disk writes.
+ *
+ * @remarks The default directory is /tmp.\n
+ *          The messaging service must be able to read the directory.\n
+ *          The directory can be changed at any time, it applies to the messages sent afterwards.\n
+ *          The text files of the requests still pending when the service is closed are left in place.
+ *
+ * @param[in] service The message service handle
+ * @param[in] path The directory path, or @c NULL for the default directory
+ *
+ * @return 0 on success, otherwise a negative error value.
+ * @retval #MESSAGES_ERROR_NONE Successful
+ * @retval #MESSAGES_ERROR_INVALID_PARAMETER Invalid parameter, or @a path is not a directory
+ * @retval #MESSAGES_ERROR_OUT_OF_MEMORY Out of memory
+ *
+ * @see messages_send_message()
+ */
+int messages_mms_set_spool_directory(messages_service_h service, const char *path);
+
+/**
+ * @brief Sets the largest MMS message the service accepts for sending.
+ * @details While a limit is set, sending an MMS message whose estimated size is larger
+ *          fails at once with #MESSAGES_ERROR_MESSAGE_TOO_LARGE, before the message is built or queued.
+ *
+ * @remarks Use the limit of the carrier's MMS size class, for example 307200 for 300 KB.
+ *
+ * @param[in] service The message service handle
+ * @param[in] limit The limit in bytes, or 0 for no limit
+ *
+ * @return 0 on success, otherwise a negative error value.
+ * @retval #MESSAGES_ERROR_NONE Successful
+ * @retval #MESSAGES_ERROR_INVALID_PARAMETER Invalid parameter
+ *
+ * @see messages_mms_estimate_size()
+ */
+int messages_mms_set_size_limit(messages_service_h service, int limit);
+
+/**
+ * @brief Estimates the encoded size of an MMS message.
+ * @details The size counts the headers, the SMIL part, the text and the attachments as they are on disk.
+ *          When it is larger than the limit set with messages_mms_set_size_limit(), @a oversized lists
+ *          the indexes of the attachments from the first one which does not fit to the last one.
+ *
+ * @remarks @a oversized must be released with @c free() by you, it is @c NULL when no attachment is listed.\n
+ *          If the size is over the limit but @a oversized_count is 0, the text and headers alone are too large,
+ *          and removing attachments does not help.\n
+ *          An attachment which can not be read is counted as empty.
+ *
+ * @param[in] service The message service handle
+ * @param[in] msg The MMS message handle
+ * @param[out] size The estimated size in bytes
+ * @param[out] oversized The indexes of the attachments which do not fit under the limit
+ * @param[out] oversized_count The number of entries in @a oversized
+ *
+ * @return 0 on success, otherwise a negative error value.
+ * @retval #MESSAGES_ERROR_NONE Successful
+ * @retval #MESSAGES_ERROR_INVALID_PARAMETER Invalid parameter
+ * @retval #MESSAGES_ERROR_OUT_OF_MEMORY Out of memory
+ *
+ * @see messages_mms_set_size_limit()
+ * @see messages_mms_get_attachment()
+ */
+int messages_mms_estimate_size(messages_service_h service, messages_message_h msg, int *size,
+							int **oversized, int *oversized_count);
+
+/**
+ * @brief Enables or disables the attachment store of the service.
+ * @details While the store is enabled, each attachment file is hashed once per inode, modification time and size,
+ *          and staged in the spool directory under its content hash. Every MMS message attaching the same content
+ *          then hands the messaging service the same staged file. Staging copies the file once, so later changes
+ *          of the attached file do not affect the messages already sent or being sent.
+ *
+ * @remarks The staged files keep the names of the attached files. They are removed when the store is disabled
+ *          or the service is closed, once the sending status of every request sending them was reported,
+ *          timed out or canceled. The files of the requests still pending when the service is closed are left in place.\n
+ *          The store is created in the spool directory set when it is enabled.
+ *
+ * @param[in] service The message service handle
+ * @param[in] enable Set to true to enable the store, else false
+ *
+ * @return 0 on success, otherwise a negative error value.
+ * @retval #MESSAGES_ERROR_NONE Successful
+ * @retval #MESSAGES_ERROR_INVALID_PARAMETER Invalid parameter
+ * @retval #MESSAGES_ERROR_OPERATION_FAILED The store directory could not be created
+ *
+ * @see messages_mms_set_spool_directory()
+ * @see messages_mms_add_attachment()
+ */
+int messages_mms_set_attachment_store_enabled(messages_service_h service, bool enable);
+
+/**
+ * @brief Gets the statistics of the time taken to send messages.
+ * @details The time is measured from the submission of a message by messages_send_message()
+ *          to the report of its sending status. The statistics are kept per message type and sending result
+ *          since the service is opened or messages_reset_sending_latency() is called.
+ *
+ * @remarks The percentiles are accurate to about 6%.
+ *
+ * @param[in] service The message service handle
+ * @param[in] type The message type (#MESSAGES_TYPE_SMS or #MESSAGES_TYPE_MMS)
+ * @param[in] result The sending result (#MESSAGES_SENDING_SUCCEEDED or #MESSAGES_SENDING_FAILED)
+ * @param[out] count The number of messages with the sending status reported
+ * @param[out] p50 The median sending time, in milliseconds
+ * @param[out] p99 The 99th percentile of the sending time, in milliseconds
+ * @param[out] p999 The 99.9th percentile of the sending time, in milliseconds
+ *
+ * @return 0 on success, otherwise a negative error value.
+ * @retval #MESSAGES_ERROR_NONE Successful
+ * @retval #MESSAGES_ERROR_INVALID_PARAMETER Invalid parameter
+ *
+ * @see messages_reset_sending_latency()
+ * @see messages_send_message()
+ */
+int messages_get_sending_latency(messages_service_h service, messages_message_type_e type, messages_sending_result_e result,
+							int *count, int *p50, int *p99, int *p999);
+
+/**
+ * @brief Clears the statistics of the time taken to send messages.
+ *
+ * @param[in] service The message service handle
+ *
+ * @return 0 on success, otherwise a negative error value.
+ * @retval #MESSAGES_ERROR_NONE Successful
+ * @retval #MESSAGES_ERROR_INVALID_PARAMETER Invalid parameter
+ *
+ * @see messages_get_sending_latency()
+ */
+int messages_reset_sending_latency(messages_service_h service);
+
+/**
+ * @brief Enables or disables requesting delivery reports for sent messages.
+ * @details When enabled, the messages sent by messages_send_message() request a delivery report from the network
+ *          and the reports are counted per recipient, see messages_get_delivery_statistics().
+ *
+ * @remarks The setting applies to the messages sent after this function is called.\n
+ *          Delivery reports do not invoke messages_sent_cb().
+ *
+ * @param[in] service The message service handle
+ * @param[in] enable @c true to request delivery reports, otherwise @c false
+ *
+ * @return 0 on success, otherwise a negative error value.
+ * @retval #MESSAGES_ERROR_NONE Successful
+ * @retval #MESSAGES_ERROR_INVALID_PARAMETER Invalid parameter
+ * @retval #MESSAGES_ERROR_OUT_OF_MEMORY Out of memory
+ *
+ * @see messages_get_delivery_statistics()
+ */
+int messages_set_delivery_report_enabled(messages_service_h service, bool enable);
+
+/**
+ * @brief Gets the delivery statistics of the messages sent with delivery reports enabled.
+ * @details The latency is measured from the submission of a message to the report of its delivery.
+ *
+ * @remarks A message with several recipients is counted once per recipient for each recipient,
+ *          and once in the overall statistics.\n
+ *          Separators such as spaces, dashes and brackets in @a address are ignored.\n
+ *          About a thousand recipients are tracked; the statistics of the recipient sent to least recently
+ *          are dropped to make room for a new one.
+ *
+ * @param[in] service The message service handle
+ * @param[in] address The recipient address, or @c NULL for the statistics of all recipients
+ * @param[out] sent The number of messages sent
+ * @param[out] delivered The number of messages reported as delivered
+ * @param[out] failed The number of messages reported as not delivered
+ * @param[out] avg_latency The average delivery latency, in milliseconds
+ * @param[out] max_latency The maximum delivery latency, in milliseconds
+ *
+ * @return 0 on success, otherwise a negative error value.
+ * @retval #MESSAGES_ERROR_NONE Successful
+ * @retval #MESSAGES_ERROR_INVALID_PARAMETER Invalid parameter
+ *
+ * @see messages_set_delivery_report_enabled()
+ */
+int messages_get_delivery_statistics(messages_service_h service, const char *address,
+							int *sent, int *delivered, int *failed, int *avg_latency, int *max_latency);
+
+/**
+ * @brief Sets the window in which sending the same message again is rejected.
+ * @details While the window is set, messages_send_message() fails with #MESSAGES_ERROR_DUPLICATE_MESSAGE
+ *          for a message with the same recipients and content as one submitted less than @a window seconds ago.
+ *          The order of the recipients does not matter.
+ *
+ * @remarks Only recently sent messages are remembered, so a duplicate may be sent
+ *          when many different messages are sent within the window.\n
+ *          A message which failed to be submitted is forgotten and can be sent again.
+ *
+ * @param[in] service The message service handle
+ * @param[in] window The window in seconds, or 0 to disable duplicate suppression
+ *
+ * @return 0 on success, otherwise a negative error value.
+ * @retval #MESSAGES_ERROR_NONE Successful
+ * @retval #MESSAGES_ERROR_INVALID_PARAMETER Invalid parameter
+ *
+ * @see messages_send_message()
+ */
+int messages_set_duplicate_window(messages_service_h service, int window);
+
+/**
+ * @brief Sets how many times a message is sent again after sending it failed.
+ * @details When messages_send_message() fails with a transport error or the network reports a sending failure,
+ *          the message is sent again after @a delay seconds, doubling the delay for each retry up to 600 seconds.
+ *          Half of each delay is randomized.
+ *          messages_sent_cb() is invoked once, with the result of the last attempt.
+ *
+ * @remarks The setting applies to the messages sent after this function is called.\n
+ *          By default, messages are not sent again.\n
+ *          Retries wait on a timer of the default main context, so they are only sent while the application runs
+ *          the default main loop.
+ *
+ * @param[in] service The message service handle
+ * @param[in] max_retries The maximum number of retries, or 0 to disable retries
+ * @param[in] delay The delay before the first retry, from 1 to 600 seconds
+ *
+ * @return 0 on success, otherwise a negative error value.
+ * @retval #MESSAGES_ERROR_NONE Successful
+ * @retval #MESSAGES_ERROR_INVALID_PARAMETER Invalid parameter
+ *
+ * @see messages_send_message()
+ * @see messages_set_outbox_journal()
+ */
+int messages_set_sending_retry(messages_service_h service, int max_retries, int delay);
+
+/**
+ * @brief Sets the file which keeps the messages being sent across restarts of the application.
+ * @details Messages sent by messages_send_message() are recorded in the journal at @a path until they are sent
+ *          or given up. When the journal is set, the messages left in it by a previous run are sent again.
+ *
+ * @remarks Call this function right after messages_open_service() so that the unfinished messages are sent without delay.\n
+ *          The callbacks of the unfinished messages are not invoked, as they belonged to the previous run.\n
+ *          The journal is written to storage every 100 milliseconds, so the messages sent in the last 100 milliseconds
+ *          before a crash may be lost. A message whose sending status was not reported before the application exited
+ *          is sent again.\n
+ *          Records are written by a timer of the default main context, so the application must run the default main loop.
+ *          Without it, the records are only written when 64 KB of them are pending or the journal is closed,
+ *          and the unfinished messages restored from the journal are never sent.\n
+ *          The journal only keeps the unfinished messages: once it grows past 1 MB, it is rewritten without the finished ones,
+ *          through a temporary file named after @a path with a ".tmp" suffix.
+ *
+ * @param[in] service The message service handle
+ * @param[in] path The path of the journal file, or @c NULL to stop journaling
+ *
+ * @return 0 on success, otherwise a negative error value.
+ * @retval #MESSAGES_ERROR_NONE Successful
+ * @retval #MESSAGES_ERROR_INVALID_PARAMETER Invalid parameter
+ * @retval #MESSAGES_ERROR_OUT_OF_MEMORY Out of memory
+ * @retval #MESSAGES_ERROR_OPERATION_FAILED The journal can not be read or written
+ *
+ * @see messages_open_service()
+ * @see messages_set_sending_retry()
+ */
+int messages_set_outbox_journal(messages_service_h service, const char *path);
+
 /**
  * @brief Gets the message count in the specific message box
  *
@@ -449,11 +898,276 @@ int messages_set_message_incoming_cb(messages_service_h service, messages_incomi
  */
 int messages_unset_message_incoming_cb(messages_service_h service);
 
+/**
+ * @brief Adds a callback to the subscribers of incoming messages.
+ *
+ * @details Unlike messages_set_message_incoming_cb(), any number of callbacks can be subscribed.
+ *          Each incoming message is decoded once and passed to every subscriber in the order they were added.
+ *          Delivery does not take a lock, so subscribers can be added and removed at any time, even from a callback.
+ *
+ * @remarks The message handle is only valid inside the callback.
+ *
+ * @param[in] service The message service handle
+ * @param[in] callback The callback function
+ * @param[in] user_data The user data to be passed to the callback function
+ * @param[out] subscription_id The identifier to pass to messages_remove_message_incoming_cb()
+ *
+ * @return 0 on success, otherwise a negative error value.
+ * @retval #MESSAGES_ERROR_NONE Successful
+ * @retval #MESSAGES_ERROR_INVALID_PARAMETER Invalid parameter
+ * @retval #MESSAGES_ERROR_OUT_OF_MEMORY Out of memory
+ * @retval #MESSAGES_ERROR_OPERATION_FAILED Messaging operation failed
+ *
+ * @post It will invoke messages_incoming_cb().
+ *
+ * @see messages_remove_message_incoming_cb()
+ * @see messages_incoming_cb()
+ */
+int messages_add_message_incoming_cb(messages_service_h service, messages_incoming_cb callback, void *user_data, int *subscription_id);
+
+/**
+ * @brief Removes a callback from the subscribers of incoming messages.
+ *
+ * @remarks A delivery that is already running on another thread may still invoke the callback once.
+ *
+ * @param[in] service The message service handle
+ * @param[in] subscription_id The identifier returned by messages_add_message_incoming_cb()
+ *
+ * @return 0 on success, otherwise a negative error value.
+ * @retval #MESSAGES_ERROR_NONE Successful
+ * @retval #MESSAGES_ERROR_INVALID_PARAMETER Invalid parameter or unknown @a subscription_id
+ * @retval #MESSAGES_ERROR_OUT_OF_MEMORY Out of memory
+ *
+ * @see messages_add_message_incoming_cb()
+ */
+int messages_remove_message_incoming_cb(messages_service_h service, int subscription_id);
+
+/**
+ * @brief Registers a callback to be invoked with batches of incoming messages.
+ * @details Incoming messages are gathered and handed to @a callback together when @a max_count messages
+ *          are gathered or @a max_delay milliseconds after the first one, whichever comes first.
+ *          The callback set with messages_set_message_incoming_cb() is still invoked for each message.
+ *
+ * @remarks Calling this function again replaces the callback; messages gathered so far go to the previous one.\n
+ *          When the batch is sent on time, @a callback is invoked on the thread running the default main loop.\n
+ *          Messages still gathered when the service is closed are delivered before messages_close_service() returns.
+ *
+ * @param[in] service The message service handle
+ * @param[in] max_count The largest number of messages in a batch, from 1 to 1024
+ * @param[in] max_delay The longest time a message waits for its batch in milliseconds, from 1 to 60000
+ * @param[in] callback The callback function
+ * @param[in] user_data The user data to be passed to the callback function
+ *
+ * @return 0 on success, otherwise a negative error value.
+ * @retval #MESSAGES_ERROR_NONE Successful
+ * @retval #MESSAGES_ERROR_INVALID_PARAMETER Invalid parameter
+ *
+ * @post It will invoke messages_incoming_batch_cb().
+ *
+ * @see messages_unset_message_incoming_batch_cb()
+ * @see messages_incoming_batch_cb()
+ */
+int messages_set_message_incoming_batch_cb(messages_service_h service, int max_count, int max_delay,
+										messages_incoming_batch_cb callback, void *user_data);
+
+/**
+ * @brief Unregisters the batch callback for incoming messages.
+ *
+ * @remarks Messages gathered for a batch are discarded.
+ *
+ * @param[in] service The message service handle
+ *
+ * @return 0 on success, otherwise a negative error value.
+ * @retval #MESSAGES_ERROR_NONE Successful
+ * @retval #MESSAGES_ERROR_INVALID_PARAMETER Invalid parameter
+ *
+ * @see messages_set_message_incoming_batch_cb()
+ */
+int messages_unset_message_incoming_batch_cb(messages_service_h service);
+
+/**
+ * @brief Adds a sender to the allowed or denied senders of incoming messages.
+ * @details While allowed senders are set, only messages from them are delivered.
+ *          Messages from denied senders are never delivered.
+ *          Addresses are compared without spaces, dashes, dots and parentheses.
+ *
+ * @remarks Incoming messages are filtered before any message handle is created,
+ *          so rejected messages reach neither messages_incoming_cb() nor messages_incoming_batch_cb().
+ *
+ * @param[in] service The message service handle
+ * @param[in] address The sender address
+ * @param[in] allow Set to true to allow the sender, else false to deny it
+ *
+ * @return 0 on success, otherwise a negative error value.
+ * @retval #MESSAGES_ERROR_NONE Successful
+ * @retval #MESSAGES_ERROR_INVALID_PARAMETER Invalid parameter
+ * @retval #MESSAGES_ERROR_OUT_OF_MEMORY Out of memory
+ *
+ * @see messages_incoming_filter_clear()
+ */
+int messages_incoming_filter_add_sender(messages_service_h service, const char *address, bool allow);
+
+/**
+ * @brief Adds a port to the ports incoming messages are accepted on.
+ * @details While ports are set, only messages to one of them are delivered.
+ *          Add port 0 to also accept messages without a port.
+ *
+ * @param[in] service The message service handle
+ * @param[in] port The port, from 0 to 65535
+ *
+ * @return 0 on success, otherwise a negative error value.
+ * @retval #MESSAGES_ERROR_NONE Successful
+ * @retval #MESSAGES_ERROR_INVALID_PARAMETER Invalid parameter
+ * @retval #MESSAGES_ERROR_OUT_OF_MEMORY Out of memory
+ *
+ * @see messages_incoming_filter_clear()
+ */
+int messages_incoming_filter_add_port(messages_service_h service, int port);
+
+/**
+ * @brief Adds a keyword incoming messages must contain.
+ * @details While keywords are set, only messages containing one of them are delivered.
+ *          Keywords are compared to the SMS text, or to the subject of an MMS message, ignoring ASCII case.
+ *
+ * @param[in] service The message service handle
+ * @param[in] keyword The keyword, up to 64 bytes
+ * @param[in] prefix Set to true to match @a keyword only at the start of the text, else false
+ *
+ * @return 0 on success, otherwise a negative error value.
+ * @retval #MESSAGES_ERROR_NONE Successful
+ * @retval #MESSAGES_ERROR_INVALID_PARAMETER Invalid parameter
+ * @retval #MESSAGES_ERROR_OUT_OF_MEMORY Out of memory
+ *
+ * @see messages_incoming_filter_clear()
+ */
+int messages_incoming_filter_add_keyword(messages_service_h service, const char *keyword, bool prefix);
+
+/**
+ * @brief Sets the type of incoming messages to deliver.
+ *
+ * @param[in] service The message service handle
+ * @param[in] type The message type, or #MESSAGES_TYPE_UNKNOWN for any type
+ *
+ * @return 0 on success, otherwise a negative error value.
+ * @retval #MESSAGES_ERROR_NONE Successful
+ * @retval #MESSAGES_ERROR_INVALID_PARAMETER Invalid parameter
+ * @retval #MESSAGES_ERROR_OUT_OF_MEMORY Out of memory
+ *
+ * @see messages_incoming_filter_clear()
+ */
+int messages_incoming_filter_set_type(messages_service_h service, messages_message_type_e type);
+
+/**
+ * @brief Removes the incoming message filter, so every incoming message is delivered.
+ *
+ * @param[in] service The message service handle
+ *
+ * @return 0 on success, otherwise a negative error value.
+ * @retval #MESSAGES_ERROR_NONE Successful
+ * @retval #MESSAGES_ERROR_INVALID_PARAMETER Invalid parameter
+ *
+ * @see messages_incoming_filter_add_sender()
+ * @see messages_incoming_filter_add_port()
+ * @see messages_incoming_filter_add_keyword()
+ * @see messages_incoming_filter_set_type()
+ */
+int messages_incoming_filter_clear(messages_service_h service);
+
+/**
+ * @brief Sets the window in which a retransmitted incoming message is detected as a duplicate.
+ *
+ * @details An incoming message with the same sender, body and SMSC time stamp as a message received
+ *          within @a window seconds is a duplicate. It is either dropped before any callback is invoked,
+ *          or delivered with a flag that messages_is_duplicate_message() reports.
+ *
+ * @remarks The detection keeps a 64-bit hash of each message for @a window seconds from its first copy.
+ *          A distinct message is only taken as a duplicate when the hashes collide, which is below
+ *          one chance in 10^12 even for 2048 messages within a window.\n
+ *          Up to 2048 messages are remembered. When a window holds more, or many of them compete for the same slots,
+ *          older ones are forgotten early and a later copy of them is delivered as a new message.\n
+ *          Setting a window forgets the messages already received.
+ *
+ * @param[in] service The message service handle
+ * @param[in] window The window in seconds, or 0 to disable duplicate detection
+ * @param[in] drop @c true to drop the duplicates, @c false to deliver them flagged
+ *
+ * @return 0 on success, otherwise a negative error value.
+ * @retval #MESSAGES_ERROR_NONE Successful
+ * @retval #MESSAGES_ERROR_INVALID_PARAMETER Invalid parameter
+ * @retval #MESSAGES_ERROR_OUT_OF_MEMORY Out of memory
+ *
+ * @see messages_is_duplicate_message()
+ */
+int messages_set_incoming_duplicate_window(messages_service_h service, int window, bool drop);
+
+/**
+ * @brief Checks whether an incoming message is a duplicate of a recently received message.
+ *
+ * @param[in] msg The message handle
+ * @param[out] duplicate @c true if the message is a duplicate, otherwise @c false
+ *
+ * @return 0 on success, otherwise a negative error value.
+ * @retval #MESSAGES_ERROR_NONE Successful
+ * @retval #MESSAGES_ERROR_INVALID_PARAMETER Invalid parameter
+ *
+ * @see messages_set_incoming_duplicate_window()
+ */
+int messages_is_duplicate_message(messages_message_h msg, bool *duplicate);
+
+/**
+ * @brief Moves the delivery of incoming messages off the messaging service thread.
+ * @details With @a workers threads, the messaging service thread only copies each incoming message into a queue
+ *          of @a capacity messages. The workers load the MMS bodies and invoke messages_incoming_cb(),
+ *          so a slow callback does not hold up the next message.
+ *
+ * @remarks Call this function before messages_set_message_incoming_cb(), messages_set_message_incoming_batch_cb()
+ *          and messages_add_sms_listening_port(),
+ *          it can be called only once for a service.\n
+ *          With more than one worker, messages_incoming_cb() is invoked concurrently and messages may be
+ *          delivered out of order.\n
+ *          Messages still queued when the service is closed are delivered before messages_close_service() returns.
+ *
+ * @param[in] service The message service handle
+ * @param[in] workers The number of worker threads, from 1 to 16, or 0 to keep delivering on the messaging service thread
+ * @param[in] capacity The number of messages the queue holds, from 1 to 65536, rounded up to a power of two
+ * @param[in] policy What happens to an incoming message when the queue is full
+ *
+ * @return 0 on success, otherwise a negative error value.
+ * @retval #MESSAGES_ERROR_NONE Successful
+ * @retval #MESSAGES_ERROR_INVALID_PARAMETER Invalid parameter, or the incoming callback is already set
+ * @retval #MESSAGES_ERROR_OUT_OF_MEMORY Out of memory
+ *
+ * @see messages_set_message_incoming_cb()
+ * @see messages_get_incoming_queue_statistics()
+ */
+int messages_set_incoming_dispatch(messages_service_h service, int workers, int capacity, messages_incoming_overflow_e policy);
+
+/**
+ * @brief Gets the counters of the incoming message queue.
+ *
+ * @remarks All counters are 0 when incoming messages are delivered on the messaging service thread.
+ *
+ * @param[in] service The message service handle
+ * @param[out] depth The number of messages waiting in the queue
+ * @param[out] peak The largest number of messages which waited in the queue
+ * @param[out] dropped The number of messages dropped because the queue was full
+ *
+ * @return 0 on success, otherwise a negative error value.
+ * @retval #MESSAGES_ERROR_NONE Successful
+ * @retval #MESSAGES_ERROR_INVALID_PARAMETER Invalid parameter
+ *
+ * @see messages_set_incoming_dispatch()
+ */
+int messages_get_incoming_queue_statistics(messages_service_h service, int *depth, int *peak, int *dropped);
+
 /**
  * @brief Adds an additional listening port for the incoming SMS messages.
  *
+ * @remarks Adding a port which is already listened to, by this function or by messages_add_sms_listening_port_cb(),
+ *          has no effect, so each message is received once.
+ *
  * @param[in] service The message service handle
- * @param[in] port The listening port for the SMS messages
+ * @param[in] port The listening port for the SMS messages, from 1 to 65535
  *
  * @return 0 on success, otherwise a negative error value.
  * @retval #MESSAGES_ERROR_NONE Successful
@@ -464,6 +1178,35 @@ int messages_unset_message_incoming_cb(messages_service_h service);
  */
 int messages_add_sms_listening_port(messages_service_h service, int port);
 
+/**
+ * @brief Adds a listening port for the incoming SMS messages with its own callback.
+ *
+ * @details The SMS messages sent to @a port are routed straight to @a callback through a table indexed by the port,
+ *          so there is no need to call messages_get_message_port() and switch on the port in a shared callback.
+ *
+ * @remarks The messages routed to @a callback are not passed to the callbacks of messages_set_message_incoming_cb(),
+ *          messages_add_message_incoming_cb() nor messages_set_message_incoming_batch_cb().\n
+ *          A port can only have one callback and it cannot be removed until the service is closed.
+ *          A port already added with messages_add_sms_listening_port() can be given a callback; it is still listened to once.
+ *
+ * @param[in] service The message service handle
+ * @param[in] port The listening port for the SMS messages, from 1 to 65535
+ * @param[in] callback The callback function
+ * @param[in] user_data The user data to be passed to the callback function
+ *
+ * @return 0 on success, otherwise a negative error value.
+ * @retval #MESSAGES_ERROR_NONE Successful
+ * @retval #MESSAGES_ERROR_INVALID_PARAMETER Invalid parameter or @a port already has a callback
+ * @retval #MESSAGES_ERROR_OUT_OF_MEMORY Out of memory
+ * @retval #MESSAGES_ERROR_OPERATION_FAILED Messaging operation failed
+ *
+ * @post It will invoke messages_incoming_cb().
+ *
+ * @see messages_add_sms_listening_port()
+ * @see messages_incoming_cb()
+ */
+int messages_add_sms_listening_port_cb(messages_service_h service, int port, messages_incoming_cb callback, void *user_data);
+
 /**
  * @addtogroup CAPI_MESSAGING_MESSAGES_MMS_MODULE
  * @{
@@ -509,6 +1252,9 @@ int messages_mms_get_subject(messages_message_h msg, char **subject);
 /**
  * @brief Adds the attachment to the MMS message.
  *
+ * @remarks If @a type is #MESSAGES_MEDIA_UNKNOWN, the type is detected from the first bytes of the file,
+ * or from its extension when the content is not recognized.
+ *
  * @param[in] msg The message handle
  * @param[in] type The attachment type
  * @param[in] path The file path to attach \n
@@ -587,6 +1333,102 @@ int messages_mms_get_attachment_count(messages_message_h msg, int *count);
  * @see messages_mms_get_attachment_count()
  */
 int messages_mms_remove_all_attachments(messages_message_h msg);
+
+
+/**
+ * @brief Opens a reader on the content of the attachment with the specified index.
+ * @details The content is read in chunks of @a chunk_size bytes, each one handed out as a view
+ *          of the mapped file, so a large attachment can be forwarded with constant memory.
+ *
+ * @remarks @a reader must be released with messages_attachment_reader_close() by you.\n
+ *          The reader keeps the file open, it does not depend on @a msg after this call.\n
+ *          The file must not be truncated while it is read.
+ *
+ * @param[in] msg The message handle
+ * @param[in] index The zero-based index of attachment
+ * @param[in] chunk_size The chunk size in bytes, up to 64 MB and rounded up to the page size, or 0 for the default of 64 KB
+ * @param[in] checksum Set to true to compute a checksum of the content while it is read, else false
+ * @param[out] reader The attachment reader handle
+ *
+ * @return 0 on success, otherwise a negative error value.
+ * @retval #MESSAGES_ERROR_NONE Successful
+ * @retval #MESSAGES_ERROR_INVALID_PARAMETER Invalid parameter
+ * @retval #MESSAGES_ERROR_OUT_OF_MEMORY Out of memory
+ * @retval #MESSAGES_ERROR_OPERATION_FAILED The attachment file could not be opened
+ *
+ * @see messages_attachment_reader_read()
+ * @see messages_attachment_reader_close()
+ */
+int messages_mms_open_attachment(messages_message_h msg, int index, int chunk_size, bool checksum,
+								messages_attachment_reader_h *reader);
+
+
+/**
+ * @brief Gets the size of the attachment content.
+ *
+ * @param[in] reader The attachment reader handle
+ * @param[out] size The size in bytes
+ *
+ * @return 0 on success, otherwise a negative error value.
+ * @retval #MESSAGES_ERROR_NONE Successful
+ * @retval #MESSAGES_ERROR_INVALID_PARAMETER Invalid parameter
+ *
+ * @see messages_mms_open_attachment()
+ */
+int messages_attachment_reader_get_size(messages_attachment_reader_h reader, long long *size);
+
+
+/**
+ * @brief Reads the next chunk of the attachment content.
+ *
+ * @remarks @a data must not be released by you, it stays valid until the next call on @a reader.\n
+ *          @a length is 0 at the end of the content.\n
+ *          If the file gets shorter while it is read, the content ends early. @a data may be a view of the file itself,
+ *          so the file must not be truncated while a chunk is in use.
+ *
+ * @param[in] reader The attachment reader handle
+ * @param[out] data The chunk
+ * @param[out] length The length of the chunk in bytes
+ *
+ * @return 0 on success, otherwise a negative error value.
+ * @retval #MESSAGES_ERROR_NONE Successful
+ * @retval #MESSAGES_ERROR_INVALID_PARAMETER Invalid parameter
+ * @retval #MESSAGES_ERROR_OUT_OF_MEMORY Out of memory
+ * @retval #MESSAGES_ERROR_OPERATION_FAILED Reading the file failed
+ *
+ * @see messages_mms_open_attachment()
+ */
+int messages_attachment_reader_read(messages_attachment_reader_h reader, const void **data, int *length);
+
+
+/**
+ * @brief Gets the checksum of the content read so far.
+ * @details The checksum is the 64-bit FNV-1a hash of the bytes handed out by messages_attachment_reader_read().
+ *
+ * @param[in] reader The attachment reader handle
+ * @param[out] checksum The checksum
+ *
+ * @return 0 on success, otherwise a negative error value.
+ * @retval #MESSAGES_ERROR_NONE Successful
+ * @retval #MESSAGES_ERROR_INVALID_PARAMETER Invalid parameter, or @a reader was opened without a checksum
+ *
+ * @see messages_mms_open_attachment()
+ */
+int messages_attachment_reader_get_checksum(messages_attachment_reader_h reader, unsigned long long *checksum);
+
+
+/**
+ * @brief Closes the attachment reader.
+ *
+ * @param[in] reader The attachment reader handle
+ *
+ * @return 0 on success, otherwise a negative error value.
+ * @retval #MESSAGES_ERROR_NONE Successful
+ * @retval #MESSAGES_ERROR_INVALID_PARAMETER Invalid parameter
+ *
+ * @see messages_mms_open_attachment()
+ */
+int messages_attachment_reader_close(messages_attachment_reader_h reader);
 /**
  * @}
  */
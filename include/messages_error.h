@@ -42,6 +42,8 @@ typedef enum {
 	MESSAGES_ERROR_COMMUNICATION_WITH_SERVER_FAILED = TIZEN_ERROR_MESSAGING_CLASS|0x502, /**< Communication with server failed */
 	MESSAGES_ERROR_SENDING_FAILED = TIZEN_ERROR_MESSAGING_CLASS|0x504, /**< Sending a message failed */
 	MESSAGES_ERROR_OPERATION_FAILED = TIZEN_ERROR_MESSAGING_CLASS|0x505, /**< Messaging operation failed */
+	MESSAGES_ERROR_DUPLICATE_MESSAGE = TIZEN_ERROR_MESSAGING_CLASS|0x508, /**< The same message was sent within the duplicate window */
+	MESSAGES_ERROR_MESSAGE_TOO_LARGE = TIZEN_ERROR_MESSAGING_CLASS|0x509, /**< The MMS message is larger than the size limit */
 } messages_error_e;
 
 /**
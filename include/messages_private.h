@@ -22,31 +22,466 @@ extern "C"
 {
 #endif
 
+/* Log-linear latency buckets: 16 sub-buckets for each power of two of microseconds */
+#define MESSAGES_LATENCY_SUB_BUCKET_BITS	4
+#define MESSAGES_LATENCY_SUB_BUCKET_COUNT	(1 << MESSAGES_LATENCY_SUB_BUCKET_BITS)
+#define MESSAGES_LATENCY_MAX_EXPONENT		40
+#define MESSAGES_LATENCY_BUCKET_COUNT \
+	((MESSAGES_LATENCY_MAX_EXPONENT - MESSAGES_LATENCY_SUB_BUCKET_BITS + 2) * MESSAGES_LATENCY_SUB_BUCKET_COUNT)
+
+typedef struct _messages_latency_histogram_s {
+	int          buckets[MESSAGES_LATENCY_BUCKET_COUNT];
+} messages_latency_histogram_s;
+
+#define MESSAGES_TIMER_WHEEL_BITS	6
+#define MESSAGES_TIMER_WHEEL_SLOTS	(1 << MESSAGES_TIMER_WHEEL_BITS)
+#define MESSAGES_TIMER_WHEEL_LEVELS	4
+
+typedef enum {
+	MESSAGES_TIMER_SENDING_TIMEOUT = 0,	/* messages_sent_callback_s */
+	MESSAGES_TIMER_RETRY,				/* messages_retry_s */
+} messages_timer_kind_e;
+
+typedef struct _messages_timer_s {
+	struct _messages_timer_s *prev;
+	struct _messages_timer_s *next;
+	guint64      expires;		/* in ticks */
+	int          level;
+	int          slot;
+	bool         pending;
+	int          kind;			/* messages_timer_kind_e, tells what the timer is embedded in */
+} messages_timer_s;
+
+typedef struct _messages_timer_wheel_s {
+	guint64      now;
+	int          count;
+	messages_timer_s *slots[MESSAGES_TIMER_WHEEL_LEVELS][MESSAGES_TIMER_WHEEL_SLOTS];
+} messages_timer_wheel_s;
+
+#define MESSAGES_DELIVERY_PENDING_COUNT	1024
+#define MESSAGES_DELIVERY_DEST_COUNT	1024
+#define MESSAGES_DELIVERY_DEST_PROBE	16
+#define MESSAGES_DELIVERY_MAX_DEST		10
+
+typedef struct _messages_delivery_stats_s {
+	int          sent;
+	int          delivered;
+	int          failed;
+	gint64       latency_sum;	/* in milliseconds, of delivered messages */
+	int          latency_max;
+} messages_delivery_stats_s;
+
+typedef struct _messages_delivery_pending_s {
+	int          req_id;
+	int          state;
+	int          dest_count;
+	gint64       submit_time;	/* monotonic, in microseconds */
+	short        dest[MESSAGES_DELIVERY_MAX_DEST];	/* indexes into dests */
+	guint64      dest_key[MESSAGES_DELIVERY_MAX_DEST];	/* the keys the dests had, a slot may be reused since */
+} messages_delivery_pending_s;
+
+typedef struct _messages_delivery_dest_s {
+	guint64      key;			/* address hash, 0 for a free slot */
+	gint64       last_used;		/* monotonic, in microseconds */
+	messages_delivery_stats_s stats;
+} messages_delivery_dest_s;
+
+typedef struct _messages_delivery_tracker_s {
+	GMutex       lock;
+	messages_delivery_stats_s total;
+	messages_delivery_pending_s pending[MESSAGES_DELIVERY_PENDING_COUNT];	/* by req_id */
+	messages_delivery_dest_s dests[MESSAGES_DELIVERY_DEST_COUNT];	/* open addressing by key */
+} messages_delivery_tracker_s;
+
+#define MESSAGES_DEDUP_SLOT_COUNT	256
+#define MESSAGES_DEDUP_PROBE		4
+
+typedef struct _messages_dedup_entry_s {
+	guint64      key;			/* message hash, 0 for a free slot */
+	gint64       expires;		/* monotonic, in microseconds */
+} messages_dedup_entry_s;
+
+#define MESSAGES_RETRY_MAX_DELAY		600
+#define MESSAGES_JOURNAL_COMMIT_MSEC	100
+#define MESSAGES_JOURNAL_COMMIT_SIZE	(64 * 1024)
+#define MESSAGES_JOURNAL_COMPACT_SIZE	(1024 * 1024)	/* file size from which closed records are dropped */
+
+typedef struct _messages_journal_s {
+	int          ref;			/* the service, and the commit timer while it is pending */
+	bool         closed;		/* no more records are taken */
+	int          fd;
+	char*        path;
+	int          next_id;
+	GHashTable*  live;			/* id -> copy of the ADD record of each unfinished sending */
+	gint64       live_size;		/* bytes of the records in live */
+	gint64       file_size;		/* bytes committed to the file */
+	char*        buffer;		/* records not committed yet */
+	int          length;
+	int          size;
+	guint        commit_id;
+	GMutex       lock;
+} messages_journal_s;
+
+typedef struct _messages_store_s messages_store_s;
+
+typedef struct _messages_spool_file_s {
+	int          ref;			/* the message whose body refers to it, and each request sending it */
+	bool         keep;			/* left in place when the last reference goes */
+	char         path[1];
+} messages_spool_file_s;
+
+#define MESSAGES_READER_DEFAULT_CHUNK	(64 * 1024)
+#define MESSAGES_READER_MAX_CHUNK		(64 * 1024 * 1024)	/* a page multiple, so rounding it up stays below INT_MAX */
+
+typedef struct _messages_attachment_reader_s {
+	int          fd;
+	off_t        size;
+	off_t        offset;		/* of the next chunk */
+	size_t       chunk;			/* a multiple of the page size */
+	void*        map;			/* view of the current chunk, NULL if none */
+	size_t       map_len;
+	char*        buffer;		/* used when the file can not be mapped */
+	bool         checksum_enabled;
+	guint64      checksum;
+} messages_attachment_reader_s;
+
+#define MESSAGES_DISPATCH_MAX_WORKERS	16
+#define MESSAGES_DISPATCH_MAX_CAPACITY	65536
+
+typedef struct _messages_incoming_slot_s {
+	int          seq;			/* position the slot is ready for */
+	msg_struct_t msg_h;
+	bool         duplicate;		/* flagged by the incoming duplicate filter */
+} messages_incoming_slot_s;
+
+typedef struct _messages_dispatcher_s {
+	messages_incoming_slot_s* slots;
+	int          mask;			/* capacity - 1, capacity is a power of two */
+	int          head;			/* next position to fill */
+	int          tail;			/* next position to take */
+	int          policy;		/* messages_incoming_overflow_e */
+	int          idle;			/* workers waiting for work */
+	int          blocked;		/* producers waiting for room */
+	int          stopping;
+	int          peak;
+	int          dropped;
+	GMutex       lock;			/* only taken to sleep and wake up */
+	GCond        work;
+	GCond        room;
+	GThread**    workers;
+	int          worker_count;
+	struct _messages_service_s* svc;
+} messages_dispatcher_s;
+
+#define MESSAGES_INCOMING_BATCH_MAX_COUNT	1024
+#define MESSAGES_INCOMING_BATCH_MAX_DELAY	60000
+
+typedef struct _messages_incoming_batch_s {
+	void*        cb;			/* messages_incoming_batch_cb, NULL if not set */
+	void*        user_data;
+	int          max_count;
+	int          max_delay;		/* in milliseconds */
+	messages_message_h* msgs;	/* gathered messages, max_count entries */
+	int          count;
+	guint        timer_id;
+	GMutex       lock;
+} messages_incoming_batch_s;
+
+#define MESSAGES_PORT_COUNT			65536	/* SMS application ports are 16 bit */
+#define MESSAGES_FILTER_KEYWORD_MAX	64
+
+typedef struct _messages_filter_keyword_s {
+	char*        word;			/* lower case */
+	int          len;
+	bool         prefix;		/* only at the start of the text */
+} messages_filter_keyword_s;
+
+typedef struct _messages_incoming_filter_s {
+	int          type;			/* messages_message_type_e, MESSAGES_TYPE_UNKNOWN for any type */
+	guint64*     allow;			/* sorted sender hashes, any sender if empty */
+	int          allow_count;
+	guint64*     deny;			/* sorted sender hashes */
+	int          deny_count;
+	guint8*      ports;			/* bitmap of allowed ports, NULL for any port */
+	messages_filter_keyword_s* keywords;	/* any text if empty */
+	int          keyword_count;
+	guint8       first_bytes[32];	/* bitmap of the first bytes of the keywords */
+} messages_incoming_filter_s;
+
+typedef struct _messages_subscriber_s {
+	int          id;
+	void*        cb;			/* messages_incoming_cb */
+	void*        user_data;
+} messages_subscriber_s;
+
+typedef struct _messages_subscriber_list_s {
+	struct _messages_subscriber_list_s* retired_next;	/* replaced lists waiting for readers to leave */
+	int          count;
+	messages_subscriber_s subs[1];
+} messages_subscriber_list_s;
+
+#define MESSAGES_PORT_ROUTE_PAGE 256	/* ports per page of the routing table */
+
+typedef struct _messages_port_route_s {
+	void*        cb;			/* messages_incoming_cb, set once and last */
+	void*        user_data;
+	bool         registered;	/* the mediator is registered with msg-service for the port */
+} messages_port_route_s;
+
+#define MESSAGES_INCOMING_DEDUP_SLOT_COUNT	2048	/* a power of two */
+#define MESSAGES_INCOMING_DEDUP_PROBE		8
+
+typedef struct _messages_incoming_dedup_s {
+	int          window;		/* in seconds */
+	bool         drop;			/* drop duplicates instead of flagging them */
+	messages_dedup_entry_s slots[MESSAGES_INCOMING_DEDUP_SLOT_COUNT];	/* open addressing by key */
+} messages_incoming_dedup_s;
+
 typedef struct _messages_service_s {
+	int          ref;			/* the application and each main loop source */
+	int          closed;		/* set by messages_close_service() */
 	msg_handle_t service_h;
 	void*        incoming_cb;
 	void*        incoming_cb_user_data;
 	bool         incoming_cb_enabled;
-	GSList*      sent_cb_list;
+	bool         incoming_registered;	/* the mediator is registered to msg-service */
+	bool         incoming_mediator;		/* the mediator is registered for all SMS and MMS */
+	messages_incoming_batch_s incoming_batch;
+	messages_incoming_filter_s* incoming_filter;	/* NULL to accept every message */
+	GMutex       incoming_filter_lock;
+	messages_subscriber_list_s* subscribers;	/* read without a lock, NULL if none */
+	messages_subscriber_list_s* subscribers_retired;
+	int          subscriber_readers;
+	int          next_subscriber_id;
+	GMutex       subscriber_lock;		/* serializes the writers */
+	messages_port_route_s* port_routes[MESSAGES_PORT_COUNT / MESSAGES_PORT_ROUTE_PAGE];	/* pages allocated on first use */
+	int          port_route_count;
+	GMutex       port_route_lock;		/* serializes the writers */
+	messages_incoming_dedup_s* incoming_dedup;	/* NULL to deliver duplicates unnoticed */
+	GMutex       incoming_dedup_lock;
+	messages_dispatcher_s* dispatcher;	/* NULL to deliver on the msg-service thread */
+	GHashTable*  sent_cb_table;	/* req_id -> messages_sent_callback_s */
+	GMutex       sent_cb_lock;
+	messages_timer_wheel_s sent_timer_wheel;
+	guint        sent_timer_id;
+	GThread*     sent_timer_thread;	/* running the timer tick, NULL if none */
+	GCond        sent_timer_idle;	/* signaled when the tick is over */
+	int          sent_timeout;		/* in seconds, 0 for no timeout */
+	messages_latency_histogram_s latency[2][2];	/* [SMS, MMS][succeeded, failed] */
+	bool         delivery_report;
+	messages_delivery_tracker_s* delivery;	/* allocated when delivery reports are first enabled */
+	int          dedup_window;		/* in seconds, 0 for no duplicate suppression */
+	GMutex       dedup_lock;
+	messages_dedup_entry_s dedup[MESSAGES_DEDUP_SLOT_COUNT];
+	int          retry_limit;		/* retries after a failed sending, 0 for none */
+	int          retry_delay;		/* in seconds, before the first retry */
+	messages_journal_s* journal;	/* outbox journal, NULL if not set */
+	GMutex       journal_lock;		/* guards journal */
+	int          next_request_id;
+	char*        spool_dir;		/* directory for MMS text files, NULL for the default */
+	GMutex       spool_lock;		/* guards spool_dir and store */
+	int          mms_size_limit;	/* in bytes, 0 for no limit */
+	messages_store_s* store;		/* attachment store, NULL if disabled, guarded by spool_lock */
 } messages_service_s;
 
+typedef struct _messages_attachment_s {
+    int           media_type;
+    const char*   filepath;		/* interned */
+} messages_attachment_s;
+
 typedef struct _messages_message_s {
 	msg_struct_t  msg_h;	
 	char*         text;
-	GSList*       attachment_list;
+	messages_attachment_s* attachments;	/* array of attachment_count, shared with clones while attachment_ref is set */
+	int           attachment_count;
+	int           attachment_size;
+	int*          msg_h_ref;		/* Owner count when msg_h is shared with clones, NULL if exclusive */
+	int*          text_ref;			/* Owner count when text is shared with clones, NULL if exclusive */
+	int*          attachment_ref;	/* Owner count when attachments is shared with clones, NULL if exclusive */
+	bool          msg_h_borrowed;	/* msg_h belongs to msg-service and must not be released */
+	bool          mms_built;		/* msg_h holds an MMS body built from the current text and attachments */
+	int           mms_store_id;		/* attachment store the built body refers to, 0 for none */
+	messages_spool_file_s* text_file;	/* file holding the text of the built MMS body */
+	bool          duplicate;		/* incoming copy of a message received within the duplicate window */
 } messages_message_s;
 
-typedef struct _messages_attachment_s {
-    int           media_type;
-    char          filepath[MSG_FILEPATH_LEN_MAX];
-} messages_attachment_s;
+
+typedef struct _messages_retry_s {
+	messages_timer_s  timer;		/* must be the first member */
+	int               request_id;
+	int               id;			/* journal record id, 0 if not journaled */
+	messages_journal_s* journal;	/* the journal id is recorded in, NULL if not journaled */
+	int               attempts;		/* retries done so far */
+	time_t            when;			/* scheduled sending time, 0 to send at once */
+	guint64           dedup_key;	/* of the first attempt, 0 if it was not checked for duplicates */
+	bool              save_to_sentbox;
+	messages_message_h msg;			/* private clone of the message being sent */
+	void*             callback;
+	void*             user_data;
+} messages_retry_s;
 
 typedef struct _messages_sent_callback_s {
+	messages_timer_s  timer;		/* must be the first member */
+	messages_retry_s* retry;		/* NULL if the message is not retried */
+	int               request_id;	/* given to the application, unlike req_id it is kept across retries */
 	int               req_id;
+	guint64           dedup_key;	/* forgotten if the request is canceled, 0 if none */
+	int               msg_type;
+	gint64            submit_time;	/* monotonic, in microseconds */
+	messages_spool_file_s* text_file;	/* kept until the sending status, NULL if none */
+	messages_store_s* store;		/* holding the staged attachments until the sending status, NULL if none */
 	void*             callback;
 	void*             user_data;
 } messages_sent_callback_s;
 
+typedef struct _messages_sent_batch_s {
+	int               pending;		/* submitted parts not yet reported, plus one while submitting */
+	int               failed;
+	void*             callback;
+	void*             user_data;
+} messages_sent_batch_s;
+
+typedef struct _messages_sms_text_info_s {
+	messages_sms_encoding_e encoding;
+	int               length;		/* septets for GSM 7-bit, code units for UCS-2 */
+	int               segments;
+} messages_sms_text_info_s;
+
+#ifdef LOG_TAG
+#undef LOG_TAG
+#endif
+#define LOG_TAG "CAPI_MESSAGING"
+
+#define MAX_MESSAGES_TEXT_LEN		1530
+#define MAX_MESSAGES_SEGMENT_COUNT	10
+
+#define MESSAGES_GSM7_SINGLE_SEGMENT_LEN	160
+#define MESSAGES_GSM7_MULTI_SEGMENT_LEN		153
+#define MESSAGES_UCS2_SINGLE_SEGMENT_LEN	70
+#define MESSAGES_UCS2_MULTI_SEGMENT_LEN		67
+
+#define MESSAGES_DEFAULT_SPOOL_DIR		"/tmp"
+
+#define MESSAGES_TIMER_TICK_SEC			1
+#define MESSAGES_DEFAULT_SENDING_TIMEOUT	0	/* disabled, the application opts in */
+
+/* Private Utility Functions */
+int _messages_error_converter(int err, const char *func, int line);
+int _messages_get_media_type_from_filepath(const char *filepath);
+int _messages_save_mms_data(messages_message_s *msg, const char *spool_dir, messages_store_s *store);
+int _messages_load_mms_data(messages_message_s *msg, msg_handle_t handle);
+int _messages_save_textfile(const char *spool_dir, const char *text, messages_spool_file_s **file);
+messages_spool_file_s *_messages_spool_file_ref(messages_spool_file_s *file);
+void _messages_spool_file_unref(messages_spool_file_s *file);
+void _messages_release_text_file(messages_message_s *msg);
+int _messages_load_textfiles(GSList *filepaths, char **text);
+void _messages_sent_mediator_cb(msg_handle_t handle, msg_struct_t pStatus, void *user_param);
+
+int _messages_convert_mbox_to_fw(messages_message_box_e mbox);
+int _messages_convert_msgtype_to_fw(messages_message_type_e type);
+int _messages_convert_recipient_to_fw(messages_recipient_type_e type);
+
+int _messages_copy_msg_struct(msg_struct_t src, msg_struct_t *dst);
+int _messages_detach_msg_h(messages_message_s *msg);
+int _messages_detach_attachments(messages_message_s *msg);
+int _messages_append_attachment(messages_message_s *msg, int media_type, const char *path);
+void _messages_release_text(messages_message_s *msg);
+void _messages_release_attachments(messages_message_s *msg);
+int _messages_release_msg_h(messages_message_s *msg);
+
+int _messages_sms_analyze_text(const char *text, int len, messages_sms_text_info_s *info);
+int _messages_sms_split_text(const char *text, int len, int **offsets, int *count);
+
+void _messages_latency_record(messages_service_s *svc, int msg_type, int result, gint64 usec);
+
+guint64 _messages_get_tick(void);
+void _messages_add_sent_callback(messages_service_s *svc, messages_sent_callback_s *cb);
+messages_sent_callback_s *_messages_take_sent_callback(messages_service_s *svc, int req_id);
+void _messages_free_sent_callback(gpointer data);
+messages_service_s *_messages_service_ref(messages_service_s *svc);
+void _messages_service_unref(gpointer data);
+
+void _messages_timer_wheel_init(messages_timer_wheel_s *wheel, guint64 now);
+void _messages_timer_wheel_add(messages_timer_wheel_s *wheel, messages_timer_s *timer, guint64 expires);
+void _messages_timer_wheel_remove(messages_timer_wheel_s *wheel, messages_timer_s *timer);
+messages_timer_s *_messages_timer_wheel_advance(messages_timer_wheel_s *wheel, guint64 now);
+messages_timer_s *_messages_timer_wheel_drain(messages_timer_wheel_s *wheel);
+void _messages_timer_wheel_foreach(messages_timer_wheel_s *wheel, void (*func)(messages_timer_s *timer, void *user_data), void *user_data);
+void _messages_add_timer(messages_service_s *svc, messages_timer_s *timer, int seconds);
+
+#define MESSAGES_HASH_INIT	0xcbf29ce484222325ULL
+
+const char *_messages_intern_path(const char *path);
+const char *_messages_intern_ref(const char *path);
+void _messages_intern_unref(const char *path);
+int _messages_intern_media_type(const char *path);
+
+int _messages_mms_estimate_size(messages_message_s *msg, int limit, int *size, int *first_oversized);
+bool _messages_mms_fits(messages_service_s *svc, messages_message_s *msg);
+
+void _messages_smil_layout(messages_message_s *msg, msg_struct_t mms_data, const char *text_path, const char **paths);
+bool _messages_smil_has_page(int media_type);
+
+void _messages_incoming_mediator_cb(msg_handle_t handle, msg_struct_t msg, void *user_param);
+void _messages_incoming_deliver(messages_service_s *svc, msg_handle_t handle, msg_struct_t msg_h, bool borrowed, bool duplicate);
+bool _messages_incoming_wanted(messages_service_s *svc);
+bool _messages_incoming_filter_match(messages_service_s *svc, msg_struct_t msg);
+void _messages_incoming_filter_destroy(messages_incoming_filter_s *filter);
+void _messages_incoming_subscribers_notify(messages_service_s *svc, messages_message_h msg);
+void _messages_incoming_subscribers_destroy(messages_service_s *svc);
+bool _messages_incoming_route(messages_service_s *svc, messages_message_h msg);
+void _messages_port_routes_destroy(messages_service_s *svc);
+int _messages_port_register(messages_service_s *svc, int port);
+bool _messages_incoming_dedup_check(messages_service_s *svc, msg_struct_t msg, bool *drop);
+int _messages_register_incoming_mediator(messages_service_s *svc);
+bool _messages_incoming_batch_add(messages_service_s *svc, messages_message_s *msg);
+void _messages_incoming_batch_flush(messages_service_s *svc);
+bool _messages_dispatch_incoming(messages_dispatcher_s *dispatcher, msg_struct_t msg, bool duplicate);
+void _messages_dispatcher_stop(messages_dispatcher_s *dispatcher);
+void _messages_dispatcher_destroy(messages_dispatcher_s *dispatcher);
+
+messages_store_s *_messages_store_create(const char *spool_dir);
+messages_store_s *_messages_store_ref(messages_store_s *store);
+void _messages_store_unref(messages_store_s *store);
+void _messages_store_keep(messages_store_s *store);
+int _messages_store_id(messages_store_s *store);
+const char *_messages_store_stage(messages_store_s *store, const char *path);
+
+guint64 _messages_hash_bytes(guint64 hash, const void *data, size_t len);
+guint64 _messages_hash_address(guint64 hash, const char *address);
+
+int _messages_delivery_enable(messages_service_s *svc, bool enable);
+void _messages_delivery_destroy(messages_service_s *svc);
+void _messages_delivery_submitted(messages_service_s *svc, int req_id, msg_struct_t msg_h, gint64 submit_time);
+void _messages_delivery_sent(messages_service_s *svc, int req_id, bool sent);
+void _messages_delivery_reported(messages_service_s *svc, int req_id, bool delivered);
+
+guint64 _messages_dedup_key(messages_message_s *msg, messages_message_type_e type);
+bool _messages_dedup_check(messages_service_s *svc, guint64 key);
+void _messages_dedup_forget(messages_service_s *svc, guint64 key);
+
+int _messages_new_request_id(messages_service_s *svc);
+int _messages_send_message(messages_service_s *svc, messages_message_h msg, bool save_to_sentbox,
+							messages_sent_cb callback, void *user_data, int request_id, bool check_duplicate,
+							messages_retry_s *retry);
+messages_retry_s *_messages_retry_create(messages_service_s *svc, messages_message_h msg, bool save_to_sentbox,
+							messages_sent_cb callback, void *user_data, int request_id, time_t when);
+bool _messages_retry_schedule(messages_service_s *svc, messages_retry_s *retry);
+void _messages_retry_finish(messages_service_s *svc, messages_retry_s *retry);
+void _messages_retry_release(messages_retry_s *retry);
+int _messages_retry_delay_until(time_t when);
+void _messages_journal_close(messages_journal_s *journal);
+messages_journal_s *_messages_journal_ref(messages_journal_s *journal);
+void _messages_journal_unref(gpointer data);
+
+#define ERROR_CONVERT(err) _messages_error_converter(err, __FUNCTION__, __LINE__);
+#define CHECK_NULL(p) \
+	if (NULL == p) { \
+		LOGE("[%s] INVALID_PARAMETER(0x%08x) %s is null.", \
+			__FUNCTION__, MESSAGES_ERROR_INVALID_PARAMETER, #p); \
+		return MESSAGES_ERROR_INVALID_PARAMETER; \
+	}
+
 #ifdef __cplusplus
 }
 #endif
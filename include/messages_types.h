@@ -40,6 +40,11 @@ typedef struct messages_service_s *messages_service_h;
  */
 typedef struct messages_message_s *messages_message_h;
 
+/**
+ * @brief The attachment reader handle.
+ */
+typedef struct messages_attachment_reader_s *messages_attachment_reader_h;
+
 /**
  * @brief The message box type.
  */
@@ -82,14 +87,32 @@ typedef enum {
 	MESSAGES_RECIPIENT_BCC = 3, /**< The 'Bcc' (blind carbon copy) recipient */
 } messages_recipient_type_e;
 
+/**
+ * @brief The encoding of the SMS message text.
+ */
+typedef enum {
+	MESSAGES_SMS_ENCODING_GSM7BIT = 0, /**< GSM 7-bit default alphabet with its extension table */
+	MESSAGES_SMS_ENCODING_UCS2 = 1, /**< UCS-2 */
+} messages_sms_encoding_e;
+
 /**
  * @brief The result of sending a message.
  */
 typedef enum {
+	MESSAGES_SENDING_CANCELED = -3, /**< Message sending is canceled */
+	MESSAGES_SENDING_TIMED_OUT = -2, /**< No sending status was reported within the sending timeout */
 	MESSAGES_SENDING_FAILED = -1, /**< Message sending is failed */
 	MESSAGES_SENDING_SUCCEEDED = 0, /**< Message sending is succeeded */
 } messages_sending_result_e;
 
+/**
+ * @brief What happens to an incoming message when the dispatch queue is full.
+ */
+typedef enum {
+	MESSAGES_INCOMING_OVERFLOW_DROP = 0, /**< The message is dropped and counted */
+	MESSAGES_INCOMING_OVERFLOW_BLOCK = 1, /**< The messaging service thread waits until there is room */
+} messages_incoming_overflow_e;
+
 
 /**
  * @brief Called when the process of sending a message to all recipients finishes. 
@@ -119,6 +142,20 @@ typedef void (* messages_sent_cb)(messages_sending_result_e result, void *user_d
  */
 typedef void (* messages_incoming_cb)(messages_message_h incoming_msg, void *user_data);
 
+/**
+ * @brief Called with a batch of incoming messages.
+ *
+ * @remarks The message handles are released after the callback returns, use messages_clone_message() to keep one.
+ *
+ * @param[in] incoming_msgs The incoming messages, in the order they were gathered
+ * @param[in] count The number of messages in @a incoming_msgs
+ * @param[in] user_data The user data passed from the callback registration function
+ *
+ * @see messages_set_message_incoming_batch_cb()
+ * @see messages_unset_message_incoming_batch_cb()
+ */
+typedef void (* messages_incoming_batch_cb)(messages_message_h *incoming_msgs, int count, void *user_data);
+
 
 /**
  * @brief Called when a message is retrieved from a search request.
@@ -15,6 +15,7 @@
  */
 
 #include <sys/stat.h>
+#include <fcntl.h>
 #include <unistd.h>
 
 #include <stdio.h>
@@ -32,35 +33,24 @@
 #include <messages_types.h>
 #include <messages_private.h>
 
-#ifdef LOG_TAG
-#undef LOG_TAG
-#endif
-#define LOG_TAG "CAPI_MESSAGING"
 #define DBG_MODE (1)
 
-#define MAX_MESSAGES_TEXT_LEN		1530
-
-/* Private Utility Functions */
-int _messages_error_converter(int err, const char *func, int line);
-int _messages_get_media_type_from_filepath(const char *filepath);
-int _messages_save_mms_data(messages_message_s *msg);
-int _messages_load_mms_data(messages_message_s *msg, msg_handle_t handle);
-int _messages_save_textfile(const char *text, char **filepath);
-int _messages_load_textfile(const char *filepath, char **text);
-void _messages_sent_mediator_cb(msg_handle_t handle, msg_struct_t pStatus, void *user_param);
-
-int _messages_convert_mbox_to_fw(messages_message_box_e mbox);
-int _messages_convert_msgtype_to_fw(messages_message_type_e type);
-int _messages_convert_recipient_to_fw(messages_recipient_type_e type);
-
+// Releases the locks initialized by messages_open_service() and the service itself.
+static void _messages_service_free(messages_service_s *svc)
+{
+	g_mutex_clear(&svc->sent_cb_lock);
+	g_cond_clear(&svc->sent_timer_idle);
+	g_mutex_clear(&svc->dedup_lock);
+	g_mutex_clear(&svc->incoming_batch.lock);
+	g_mutex_clear(&svc->incoming_filter_lock);
+	g_mutex_clear(&svc->subscriber_lock);
+	g_mutex_clear(&svc->port_route_lock);
+	g_mutex_clear(&svc->incoming_dedup_lock);
+	g_mutex_clear(&svc->spool_lock);
+	g_mutex_clear(&svc->journal_lock);
 
-#define ERROR_CONVERT(err) _messages_error_converter(err, __FUNCTION__, __LINE__);
-#define CHECK_NULL(p) \
-	if (NULL == p) { \
-		LOGE("[%s] INVALID_PARAMETER(0x%08x) %s is null.", \
-			__FUNCTION__, MESSAGES_ERROR_INVALID_PARAMETER, #p); \
-		return MESSAGES_ERROR_INVALID_PARAMETER; \
-	}	
+	free(svc);
+}
 
 int messages_open_service(messages_service_h *svc)
 {
@@ -70,26 +60,43 @@ int messages_open_service(messages_service_h *svc)
 	CHECK_NULL(svc);
 
 	_svc = (messages_service_s*)calloc(1, sizeof(messages_service_s));
-	if (NULL == svc)
+	if (NULL == _svc)
 	{
 		LOGE("[%s] OUT_OF_MEMORY(0x%08x) fail to create a 'svc'."
 			, __FUNCTION__, MESSAGES_ERROR_OUT_OF_MEMORY);
 		return MESSAGES_ERROR_OUT_OF_MEMORY;
 	}
 
-	_svc->sent_cb_list = NULL;
+	_svc->ref = 1;
+	_svc->sent_cb_table = g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL, _messages_free_sent_callback);
+	_svc->sent_timeout = MESSAGES_DEFAULT_SENDING_TIMEOUT;
+	_svc->sent_timer_id = 0;
+	g_mutex_init(&_svc->sent_cb_lock);
+	g_cond_init(&_svc->sent_timer_idle);
+	g_mutex_init(&_svc->dedup_lock);
+	g_mutex_init(&_svc->incoming_batch.lock);
+	g_mutex_init(&_svc->incoming_filter_lock);
+	g_mutex_init(&_svc->subscriber_lock);
+	g_mutex_init(&_svc->port_route_lock);
+	g_mutex_init(&_svc->incoming_dedup_lock);
+	g_mutex_init(&_svc->spool_lock);
+	g_mutex_init(&_svc->journal_lock);
+	_messages_timer_wheel_init(&_svc->sent_timer_wheel, _messages_get_tick());
 	_svc->incoming_cb = NULL;
 	_svc->incoming_cb_enabled = false;
 
 	ret = msg_open_msg_handle(&_svc->service_h);
 	if (MSG_SUCCESS != ret) {
-		free(_svc);
+		g_hash_table_destroy(_svc->sent_cb_table);
+		_messages_service_free(_svc);
 		return ERROR_CONVERT(ret);
 	}
 	
 	ret = msg_reg_sent_status_callback(_svc->service_h, &_messages_sent_mediator_cb, (void*)_svc);
 	if (MSG_SUCCESS != ret) {
-		free(_svc);
+		msg_close_msg_handle(&_svc->service_h);
+		g_hash_table_destroy(_svc->sent_cb_table);
+		_messages_service_free(_svc);
 		return ERROR_CONVERT(ret);
 	}	
 
@@ -98,22 +105,105 @@ int messages_open_service(messages_service_h *svc)
 	return MESSAGES_ERROR_NONE;
 }
 
+// The request is still pending in msg-service, so its files may still be read.
+static void _messages_abandon_sent_callback(gpointer key, gpointer value, gpointer user_data)
+{
+	messages_sent_callback_s *cb = (messages_sent_callback_s *)value;
+
+	if (NULL != cb->retry)
+	{
+		_messages_retry_release(cb->retry);
+		cb->retry = NULL;
+	}
+
+	if (NULL != cb->text_file)
+	{
+		cb->text_file->keep = true;
+	}
+	_messages_store_keep(cb->store);
+}
+
+messages_service_s *_messages_service_ref(messages_service_s *svc)
+{
+	g_atomic_int_inc(&svc->ref);
+
+	return svc;
+}
+
+// Main loop sources hold a reference, so the service outlives a callback running while it is closed.
+void _messages_service_unref(gpointer data)
+{
+	messages_service_s *svc = (messages_service_s *)data;
+
+	if (!g_atomic_int_dec_and_test(&svc->ref))
+	{
+		return;
+	}
+
+	_messages_service_free(svc);
+}
+
 int messages_close_service(messages_service_h svc)
 {
 	int ret;
+	messages_timer_s *timer;
+	messages_timer_s *next;
 	
 	messages_service_s *_svc = (messages_service_s *)svc;
 	CHECK_NULL(_svc);
 
-	ret = msg_close_msg_handle(&_svc->service_h);
-	
-	if (_svc->sent_cb_list) {	
-		g_slist_foreach(_svc->sent_cb_list, (GFunc)g_free, NULL);
-		g_slist_free(_svc->sent_cb_list);
-		_svc->sent_cb_list = NULL;
+	// A tick running on another thread is waited for. One running on this thread, because the service
+	// is closed from a sent callback, sees the closed flag when the callback returns.
+	g_mutex_lock(&_svc->sent_cb_lock);
+	g_atomic_int_set(&_svc->closed, 1);
+	if (0 != _svc->sent_timer_id) {
+		g_source_remove(_svc->sent_timer_id);
+		_svc->sent_timer_id = 0;
+	}
+	while (NULL != _svc->sent_timer_thread && g_thread_self() != _svc->sent_timer_thread) {
+		g_cond_wait(&_svc->sent_timer_idle, &_svc->sent_cb_lock);
 	}
+	g_mutex_unlock(&_svc->sent_cb_lock);
 
-	free(svc);
+	// The workers load MMS bodies through the handle, so they finish before it is closed.
+	_messages_dispatcher_stop(_svc->dispatcher);
+
+	ret = msg_close_msg_handle(&_svc->service_h);
+
+	_messages_dispatcher_destroy(_svc->dispatcher);
+	_svc->dispatcher = NULL;
+	_messages_incoming_batch_flush(_svc);
+
+	// Unfinished retries stay in the journal to be resent when it is set again.
+	for (timer = _messages_timer_wheel_drain(&_svc->sent_timer_wheel); NULL != timer; timer = next) {
+		next = timer->next;
+		if (MESSAGES_TIMER_RETRY == timer->kind) {
+			_messages_retry_release((messages_retry_s *)timer);
+		}
+	}
+	
+	if (_svc->sent_cb_table) {	
+		g_hash_table_foreach(_svc->sent_cb_table, _messages_abandon_sent_callback, NULL);
+		g_hash_table_destroy(_svc->sent_cb_table);
+		_svc->sent_cb_table = NULL;
+	}
+	g_mutex_lock(&_svc->journal_lock);
+	_messages_journal_close(_svc->journal);
+	_svc->journal = NULL;
+	g_mutex_unlock(&_svc->journal_lock);
+	free(_svc->spool_dir);
+	_svc->spool_dir = NULL;
+	_messages_store_unref(_svc->store);
+	_svc->store = NULL;
+	_messages_incoming_filter_destroy(_svc->incoming_filter);
+	_svc->incoming_filter = NULL;
+	_messages_incoming_subscribers_destroy(_svc);
+	_messages_port_routes_destroy(_svc);
+	free(_svc->incoming_dedup);
+	_svc->incoming_dedup = NULL;
+	_messages_delivery_destroy(_svc);
+
+	_messages_service_unref(_svc);
 
 	return ERROR_CONVERT(ret);
 }
@@ -143,7 +233,7 @@ int messages_create_message(messages_message_type_e type, messages_message_h *ms
 	}
 
 	_msg->text = NULL;
-	_msg->attachment_list = NULL;
+	_msg->attachments = NULL;
 
 	if (MESSAGES_TYPE_SMS == type)
 	{
@@ -187,20 +277,114 @@ int messages_destroy_message(messages_message_h msg)
 	
 	CHECK_NULL(_msg);
 
-	messages_mms_remove_all_attachments(msg);
-	if (_msg->text)
-	{
-		free(_msg->text);
-		_msg->text = NULL;
-	}
+	_messages_release_attachments(_msg);
+	_messages_release_text(_msg);
+	_messages_release_text_file(_msg);
 
-	ret = msg_release_struct(&_msg->msg_h);
+	ret = _messages_release_msg_h(_msg);
 
 	free(msg);
 
 	return ERROR_CONVERT(ret);
 }
 
+int messages_clone_message(messages_message_h msg, messages_message_h *clone)
+{
+	int ret;
+
+	messages_message_s *_msg = (messages_message_s*)msg;
+	messages_message_s *_clone = NULL;
+
+	CHECK_NULL(_msg);
+	CHECK_NULL(_msg->msg_h);
+	CHECK_NULL(clone);
+
+	_clone = (messages_message_s*)calloc(1, sizeof(messages_message_s));
+	if (NULL == _clone)
+	{
+		LOGE("[%s] OUT_OF_MEMORY(0x%08x) fail to create '_clone'."
+			, __FUNCTION__, MESSAGES_ERROR_OUT_OF_MEMORY);
+		return MESSAGES_ERROR_OUT_OF_MEMORY;
+	}
+
+	// The incoming message handle is released by msg-service after the callback, so copy it now.
+	if (_msg->msg_h_borrowed)
+	{
+		ret = _messages_copy_msg_struct(_msg->msg_h, &_clone->msg_h);
+		if (MESSAGES_ERROR_NONE != ret)
+		{
+			free(_clone);
+			return ret;
+		}
+	}
+	else
+	{
+		if (NULL == _msg->msg_h_ref)
+		{
+			_msg->msg_h_ref = (int*)malloc(sizeof(int));
+			if (NULL == _msg->msg_h_ref)
+			{
+				LOGE("[%s] OUT_OF_MEMORY(0x%08x) fail to create '_msg->msg_h_ref'."
+					, __FUNCTION__, MESSAGES_ERROR_OUT_OF_MEMORY);
+				free(_clone);
+				return MESSAGES_ERROR_OUT_OF_MEMORY;
+			}
+			*_msg->msg_h_ref = 1;
+		}
+		g_atomic_int_inc(_msg->msg_h_ref);
+		_clone->msg_h = _msg->msg_h;
+		_clone->msg_h_ref = _msg->msg_h_ref;
+	}
+
+	if (NULL != _msg->text)
+	{
+		if (NULL == _msg->text_ref)
+		{
+			_msg->text_ref = (int*)malloc(sizeof(int));
+			if (NULL == _msg->text_ref)
+			{
+				LOGE("[%s] OUT_OF_MEMORY(0x%08x) fail to create '_msg->text_ref'."
+					, __FUNCTION__, MESSAGES_ERROR_OUT_OF_MEMORY);
+				messages_destroy_message((messages_message_h)_clone);
+				return MESSAGES_ERROR_OUT_OF_MEMORY;
+			}
+			*_msg->text_ref = 1;
+		}
+		g_atomic_int_inc(_msg->text_ref);
+		_clone->text = _msg->text;
+		_clone->text_ref = _msg->text_ref;
+	}
+
+	if (NULL != _msg->attachments)
+	{
+		if (NULL == _msg->attachment_ref)
+		{
+			_msg->attachment_ref = (int*)malloc(sizeof(int));
+			if (NULL == _msg->attachment_ref)
+			{
+				LOGE("[%s] OUT_OF_MEMORY(0x%08x) fail to create '_msg->attachment_ref'."
+					, __FUNCTION__, MESSAGES_ERROR_OUT_OF_MEMORY);
+				messages_destroy_message((messages_message_h)_clone);
+				return MESSAGES_ERROR_OUT_OF_MEMORY;
+			}
+			*_msg->attachment_ref = 1;
+		}
+		g_atomic_int_inc(_msg->attachment_ref);
+		_clone->attachments = _msg->attachments;
+		_clone->attachment_count = _msg->attachment_count;
+		_clone->attachment_size = _msg->attachment_size;
+		_clone->attachment_ref = _msg->attachment_ref;
+	}
+
+	// The text file of the built MMS body belongs to msg, so the clone builds its own body before sending.
+
+	_clone->duplicate = _msg->duplicate;
+
+	*clone = (messages_message_h)_clone;
+
+	return MESSAGES_ERROR_NONE;
+}
+
 int messages_get_message_type(messages_message_h msg, messages_message_type_e *type)
 {
 	int msgType;
@@ -254,6 +438,11 @@ int messages_add_address(messages_message_h msg, const char *address, messages_r
 	CHECK_NULL(_msg);
 	CHECK_NULL(_msg->msg_h);
 	CHECK_NULL(address);
+
+	ret = _messages_detach_msg_h(_msg);
+	if (MESSAGES_ERROR_NONE != ret) {
+		return ret;
+	}
 	
 	msg_get_int_value(_msg->msg_h, MSG_MESSAGE_TYPE_INT, (int *)&msgType);
 	
@@ -402,6 +591,11 @@ int messages_remove_all_addresses(messages_message_h msg)
 	CHECK_NULL(_msg);
 	CHECK_NULL(_msg->msg_h);
 
+	ret = _messages_detach_msg_h(_msg);
+	if (MESSAGES_ERROR_NONE != ret) {
+		return ret;
+	}
+
 	ret = msg_get_list_handle(_msg->msg_h, MSG_MESSAGE_ADDR_LIST_STRUCT, (void **)&addr_list);
 	if (MSG_SUCCESS == ret)
 	{
@@ -418,37 +612,152 @@ void _dump_message(messages_message_h msg)
 
 int messages_send_message(messages_service_h svc, messages_message_h msg, bool save_to_sentbox,
 							messages_sent_cb callback, void *user_data)
+{
+	messages_service_s *_svc = (messages_service_s*)svc;
+	messages_message_s *_msg = (messages_message_s*)msg;
+
+	CHECK_NULL(_svc);
+	CHECK_NULL(_svc->service_h);
+	CHECK_NULL(_msg);
+	CHECK_NULL(_msg->msg_h);
+
+	return _messages_send_message(_svc, msg, save_to_sentbox, callback, user_data, _messages_new_request_id(_svc), true, NULL);
+}
+
+int messages_send_message_with_id(messages_service_h svc, messages_message_h msg, bool save_to_sentbox,
+							messages_sent_cb callback, void *user_data, int *request_id)
+{
+	int _request_id;
+
+	messages_service_s *_svc = (messages_service_s*)svc;
+	messages_message_s *_msg = (messages_message_s*)msg;
+
+	CHECK_NULL(_svc);
+	CHECK_NULL(_svc->service_h);
+	CHECK_NULL(_msg);
+	CHECK_NULL(_msg->msg_h);
+	CHECK_NULL(request_id);
+
+	_request_id = _messages_new_request_id(_svc);
+	*request_id = _request_id;
+
+	return _messages_send_message(_svc, msg, save_to_sentbox, callback, user_data, _request_id, true, NULL);
+}
+
+int messages_send_message_at(messages_service_h svc, messages_message_h msg, time_t when, bool save_to_sentbox,
+							messages_sent_cb callback, void *user_data, int *request_id)
+{
+	messages_message_type_e msgType;
+	messages_retry_s *_retry;
+
+	messages_service_s *_svc = (messages_service_s*)svc;
+	messages_message_s *_msg = (messages_message_s*)msg;
+
+	CHECK_NULL(_svc);
+	CHECK_NULL(_svc->service_h);
+	CHECK_NULL(_msg);
+	CHECK_NULL(_msg->msg_h);
+
+	messages_get_message_type(msg, &msgType);
+	if (MESSAGES_TYPE_SMS != msgType && MESSAGES_TYPE_MMS != msgType)
+	{
+		LOGE("[%s] INVALID_PARAMETER(0x%08x) : Invalid Message Type.", 
+				__FUNCTION__, MESSAGES_ERROR_INVALID_PARAMETER);		
+		return MESSAGES_ERROR_INVALID_PARAMETER;
+	}
+
+	if (MESSAGES_TYPE_MMS == msgType && !_messages_mms_fits(_svc, _msg))
+	{
+		return MESSAGES_ERROR_MESSAGE_TOO_LARGE;
+	}
+
+	_retry = _messages_retry_create(_svc, msg, save_to_sentbox, callback, user_data, _messages_new_request_id(_svc), when);
+	if (NULL == _retry)
+	{
+		return MESSAGES_ERROR_OUT_OF_MEMORY;
+	}
+
+	if (NULL != request_id)
+	{
+		*request_id = _retry->request_id;
+	}
+
+	// The message is sent from the timer wheel of the service, like a retry.
+	_messages_add_timer(_svc, &_retry->timer, _messages_retry_delay_until(when));
+
+	return MESSAGES_ERROR_NONE;
+}
+
+int _messages_new_request_id(messages_service_s *svc)
+{
+	return g_atomic_int_add(&svc->next_request_id, 1) + 1;
+}
+
+// Sends msg, or resends the message of retry. The retry is owned by this function.
+// check_duplicate is false when the caller already checked msg against the duplicate window.
+int _messages_send_message(messages_service_s *svc, messages_message_h msg, bool save_to_sentbox,
+							messages_sent_cb callback, void *user_data, int request_id, bool check_duplicate,
+							messages_retry_s *retry)
 {
 	int ret;
 	int reqId;
+	gint64 submit_time = 0;
+	guint64 dedup_key = 0;
+	char *spool_dir;
+	messages_store_s *store = NULL;
+	bool resend = (NULL != retry);
 	msg_struct_t req;
 	msg_struct_t sendOpt;
 	msg_struct_t option = NULL;
 	messages_message_type_e msgType;
 
-	messages_service_s *_svc = (messages_service_s*)svc;
+	messages_service_s *_svc = svc;
 	messages_message_s *_msg = (messages_message_s*)msg;
 	
 	messages_sent_callback_s *_cb;
 
-	CHECK_NULL(_svc);
-	CHECK_NULL(_svc->service_h);
-	CHECK_NULL(_msg);
-	CHECK_NULL(_msg->msg_h);
-
 	sendOpt = msg_create_struct(MSG_STRUCT_SENDOPT);
 	msg_set_bool_value(sendOpt, MSG_SEND_OPT_SETTING_BOOL, true);
-	msg_set_bool_value(sendOpt, MSG_SEND_OPT_DELIVER_REQ_BOOL, false);
+	msg_set_bool_value(sendOpt, MSG_SEND_OPT_DELIVER_REQ_BOOL, _svc->delivery_report);
 	msg_set_bool_value(sendOpt, MSG_SEND_OPT_KEEPCOPY_BOOL, save_to_sentbox);	
 
 	messages_get_message_type(msg, &msgType);
 
+	if (!resend && MESSAGES_TYPE_MMS == msgType && !_messages_mms_fits(_svc, _msg))
+	{
+		msg_release_struct(&sendOpt);
+		return MESSAGES_ERROR_MESSAGE_TOO_LARGE;
+	}
+
+	if (!resend && check_duplicate && _svc->dedup_window > 0 && (MESSAGES_TYPE_SMS == msgType || MESSAGES_TYPE_MMS == msgType))
+	{
+		dedup_key = _messages_dedup_key(_msg, msgType);
+		if (_messages_dedup_check(_svc, dedup_key))
+		{
+			msg_release_struct(&sendOpt);
+			LOGE("[%s] DUPLICATE_MESSAGE(0x%08x) : the same message was sent within %d seconds."
+				, __FUNCTION__, MESSAGES_ERROR_DUPLICATE_MESSAGE, _svc->dedup_window);
+			return MESSAGES_ERROR_DUPLICATE_MESSAGE;
+		}
+	}
+
+	if (!resend && (0 < _svc->retry_limit || NULL != g_atomic_pointer_get(&_svc->journal))
+		&& (MESSAGES_TYPE_SMS == msgType || MESSAGES_TYPE_MMS == msgType))
+	{
+		retry = _messages_retry_create(_svc, msg, save_to_sentbox, callback, user_data, request_id, 0);
+		if (NULL != retry)
+		{
+			retry->dedup_key = dedup_key;
+		}
+	}
+
 	if (MESSAGES_TYPE_SMS == msgType)
 	{	
 		req = msg_create_struct(MSG_STRUCT_REQUEST_INFO);
 		msg_set_struct_handle(req, MSG_REQUEST_MESSAGE_HND, _msg->msg_h);
 		msg_set_struct_handle(req, MSG_REQUEST_SENDOPT_HND, sendOpt);	
 		
+		submit_time = g_get_monotonic_time();
 		ret = msg_sms_send_message(_svc->service_h, req);
 		
 		msg_get_int_value(req, MSG_REQUEST_REQUESTID_INT, &reqId);
@@ -456,7 +765,17 @@ int messages_send_message(messages_service_h svc, messages_message_h msg, bool s
 	}
 	else if (MESSAGES_TYPE_MMS == msgType)
 	{
-		ret = _messages_save_mms_data(_msg);
+		ret = _messages_detach_msg_h(_msg);
+		if (MESSAGES_ERROR_NONE == ret)
+		{
+			g_mutex_lock(&_svc->spool_lock);
+			spool_dir = g_strdup(_svc->spool_dir);
+			store = _messages_store_ref(_svc->store);
+			g_mutex_unlock(&_svc->spool_lock);
+
+			ret = _messages_save_mms_data(_msg, spool_dir, store);
+			g_free(spool_dir);
+		}
 		if (MESSAGES_ERROR_NONE == ret)
 		{
 			if (DBG_MODE)
@@ -474,6 +793,7 @@ int messages_send_message(messages_service_h svc, messages_message_h msg, bool s
 			msg_set_int_value(option, MSG_MMS_SENDOPTION_EXPIRY_TIME_INT, MSG_EXPIRY_TIME_MAXIMUM);
 			msg_set_int_value(option, MSG_MMS_SENDOPTION_DELIVERY_TIME_INT, MSG_DELIVERY_TIME_IMMEDIATLY);			
 			
+			submit_time = g_get_monotonic_time();
 			ret = msg_mms_send_message(_svc->service_h, req);
 			
 			msg_get_int_value(req, MSG_REQUEST_REQUESTID_INT, &reqId);
@@ -484,93 +804,314 @@ int messages_send_message(messages_service_h svc, messages_message_h msg, bool s
 	{
 		LOGE("[%s] INVALID_PARAMETER(0x%08x) : Invalid Message Type.", 
 				__FUNCTION__, TIZEN_ERROR_INVALID_PARAMETER);		
+		if (NULL != retry)
+		{
+			_messages_retry_finish(_svc, retry);
+		}
 		return TIZEN_ERROR_INVALID_PARAMETER;
 	}
 	
 	msg_release_struct(&sendOpt);
 	
-	if (NULL != callback && MSG_SUCCESS == ret)
+	if (MSG_SUCCESS == ret)
 	{
-		// Add callback to mapping table
-		_cb = (messages_sent_callback_s *)malloc(sizeof(messages_sent_callback_s));
-		if (NULL != _cb) {
-			_cb->req_id = reqId;
-			_cb->callback = (void *)callback;
-			_cb->user_data = user_data;
-			_svc->sent_cb_list = g_slist_append(_svc->sent_cb_list, _cb);
+		// Before the retry can be finished below, as a resent message belongs to it.
+		if (_svc->delivery_report)
+		{
+			_messages_delivery_submitted(_svc, reqId, _msg->msg_h, submit_time);
 		}
-	}
 
-	return ERROR_CONVERT(ret);
-}
-
-int messages_get_message_count(messages_service_h service, 
-							messages_message_box_e mbox, messages_message_type_e type,
-							int *count)
-{
-	int ret;
-	msg_folder_id_t folderId;
-	msg_struct_t countInfo = NULL;
-	int nSms, nMms;
-	
-	messages_service_s *_svc = (messages_service_s*)service;
-	
-	CHECK_NULL(_svc);
-	CHECK_NULL(count);
-	
-	nSms = 0;
-	nMms = 0;
-	
-	if (MESSAGES_MBOX_ALL == mbox)
-	{
-		if (MESSAGES_TYPE_SMS == type || MESSAGES_TYPE_UNKNOWN == type)
+		// Add callback to mapping table. Requests without a callback are tracked for the latency statistics.
+		_cb = (messages_sent_callback_s *)calloc(1, sizeof(messages_sent_callback_s));
+		if (NULL == _cb)
 		{
-			ret = ERROR_CONVERT(msg_count_msg_by_type(_svc->service_h, MSG_TYPE_SMS, &nSms));
-			if (MESSAGES_ERROR_NONE != ret)
+			// The status of the request can not be followed, so it is reported at once rather than never.
+			LOGE("[%s] OUT_OF_MEMORY(0x%08x) fail to track request %d, it is reported as failed."
+				, __FUNCTION__, MESSAGES_ERROR_OUT_OF_MEMORY, reqId);
+			if (NULL != callback)
 			{
-				return ret;
+				callback(MESSAGES_SENDING_FAILED, user_data);
 			}
-		}
-
-		if (MESSAGES_TYPE_MMS == type || MESSAGES_TYPE_UNKNOWN == type)
-		{
-			ret = ERROR_CONVERT(msg_count_msg_by_type(_svc->service_h, MSG_TYPE_MMS, &nMms));
-			if (MESSAGES_ERROR_NONE != ret)
+			if (NULL != retry)
 			{
-				return ret;
+				_messages_retry_finish(_svc, retry);
 			}
 		}
-
-		*count = nSms + nMms;
+		else
+		{
+			_cb->retry = retry;
+			_cb->request_id = request_id;
+			_cb->req_id = reqId;
+			_cb->dedup_key = (NULL != retry) ? retry->dedup_key : dedup_key;
+			_cb->msg_type = msgType;
+			_cb->submit_time = submit_time;
+			// msg-service reads the text file while sending, even if the message is destroyed meanwhile.
+			_cb->text_file = _messages_spool_file_ref(_msg->text_file);
+			_cb->store = store;
+			store = NULL;
+			_cb->callback = (void *)callback;
+			_cb->user_data = user_data;
+			_messages_add_sent_callback(_svc, _cb);
+		}
+	}
+	else if (NULL != retry && MSG_ERR_TRANSPORT_ERROR == ret && _messages_retry_schedule(_svc, retry))
+	{
+		// The result is reported to the callback once the retries are over.
+		_messages_store_unref(store);
+		return MESSAGES_ERROR_NONE;
 	}
 	else
 	{
-		countInfo = msg_create_struct(MSG_STRUCT_COUNT_INFO);
-		folderId = _messages_convert_mbox_to_fw(mbox);
-		ret = ERROR_CONVERT(msg_count_message(_svc->service_h, folderId, countInfo));
-		if (MESSAGES_ERROR_NONE != ret)
+		if (0 != dedup_key)
 		{
-			return ret;
+			_messages_dedup_forget(_svc, dedup_key);
 		}
-		
-		msg_get_int_value(countInfo, MSG_COUNT_INFO_SMS_INT, &nSms);
-		msg_get_int_value(countInfo, MSG_COUNT_INFO_MMS_INT, &nMms);
-
-		msg_release_struct(&countInfo);
 
-		switch (type)
+		if (NULL != retry)
 		{
-		case MESSAGES_TYPE_SMS:	*count = nSms; break;
-		case MESSAGES_TYPE_MMS: *count = nMms; break;
-		case MESSAGES_TYPE_UNKNOWN: *count = nSms + nMms; break;
-		default: *count = 0; break;
+			// A resend has no caller to return the error to.
+			if (resend && NULL != callback)
+			{
+				callback(MESSAGES_SENDING_FAILED, user_data);
+			}
+			_messages_retry_finish(_svc, retry);
 		}
 	}
-	
-	return MESSAGES_ERROR_NONE;
-}
 
-int messages_search_message(messages_service_h service,
+	// Held by the pending request when it was submitted.
+	_messages_store_unref(store);
+
+	return ERROR_CONVERT(ret);
+}
+
+static void _messages_sent_batch_cb(messages_sending_result_e result, void *user_data)
+{
+	messages_sent_batch_s *batch = (messages_sent_batch_s *)user_data;
+
+	if (MESSAGES_SENDING_SUCCEEDED != result)
+	{
+		g_atomic_int_set(&batch->failed, 1);
+	}
+
+	if (g_atomic_int_dec_and_test(&batch->pending))
+	{
+		((messages_sent_cb)batch->callback)(
+				g_atomic_int_get(&batch->failed) ? MESSAGES_SENDING_FAILED : MESSAGES_SENDING_SUCCEEDED,
+				batch->user_data);
+		free(batch);
+	}
+}
+
+int messages_sms_send_long_text(messages_service_h svc, messages_message_h msg, const char *text,
+							bool save_to_sentbox, messages_sent_cb callback, void *user_data)
+{
+	int i;
+	int ret;
+	int *offsets = NULL;
+	int count = 0;
+	int submitted = 0;
+	guint64 dedup_key = 0;
+	char *part_text;
+	messages_message_h part;
+	messages_message_type_e msgType;
+	messages_sent_batch_s *batch = NULL;
+
+	messages_service_s *_svc = (messages_service_s*)svc;
+	messages_message_s *_msg = (messages_message_s*)msg;
+
+	CHECK_NULL(_svc);
+	CHECK_NULL(_svc->service_h);
+	CHECK_NULL(_msg);
+	CHECK_NULL(_msg->msg_h);
+	CHECK_NULL(text);
+
+	messages_get_message_type(msg, &msgType);
+	if (MESSAGES_TYPE_SMS != msgType)
+	{
+		LOGE("[%s] INVALID_PARAMETER(0x%08x) : the message type should be MESSAGES_TYPE_SMS"
+			, __FUNCTION__, MESSAGES_ERROR_INVALID_PARAMETER);
+		return MESSAGES_ERROR_INVALID_PARAMETER;
+	}
+
+	// The duplicate window applies to the whole text; its parts may repeat each other.
+	if (_svc->dedup_window > 0)
+	{
+		dedup_key = _messages_dedup_key(_msg, msgType);
+		dedup_key = _messages_hash_bytes(dedup_key, text, strlen(text));
+		if (_messages_dedup_check(_svc, dedup_key))
+		{
+			LOGE("[%s] DUPLICATE_MESSAGE(0x%08x) : the same text was sent within %d seconds."
+				, __FUNCTION__, MESSAGES_ERROR_DUPLICATE_MESSAGE, _svc->dedup_window);
+			return MESSAGES_ERROR_DUPLICATE_MESSAGE;
+		}
+	}
+
+	ret = _messages_sms_split_text(text, strlen(text), &offsets, &count);
+	if (MESSAGES_ERROR_NONE != ret)
+	{
+		if (0 != dedup_key)
+		{
+			_messages_dedup_forget(_svc, dedup_key);
+		}
+		return ret;
+	}
+
+	if (NULL != callback)
+	{
+		batch = (messages_sent_batch_s *)calloc(1, sizeof(messages_sent_batch_s));
+		if (NULL == batch)
+		{
+			LOGE("[%s] OUT_OF_MEMORY(0x%08x) fail to create 'batch'."
+				, __FUNCTION__, MESSAGES_ERROR_OUT_OF_MEMORY);
+			free(offsets);
+			if (0 != dedup_key)
+			{
+				_messages_dedup_forget(_svc, dedup_key);
+			}
+			return MESSAGES_ERROR_OUT_OF_MEMORY;
+		}
+		batch->pending = 1;
+		batch->callback = (void *)callback;
+		batch->user_data = user_data;
+	}
+
+	// Submit every part back to back; the status reports are aggregated by the batch.
+	for (i=0; i < count; i++)
+	{
+		part_text = strndup(text + offsets[i], offsets[i+1] - offsets[i]);
+		if (NULL == part_text)
+		{
+			LOGE("[%s] OUT_OF_MEMORY(0x%08x) fail to create 'part_text'."
+				, __FUNCTION__, MESSAGES_ERROR_OUT_OF_MEMORY);
+			ret = MESSAGES_ERROR_OUT_OF_MEMORY;
+			break;
+		}
+
+		ret = messages_clone_message(msg, &part);
+		if (MESSAGES_ERROR_NONE == ret)
+		{
+			ret = messages_set_text(part, part_text);
+			if (MESSAGES_ERROR_NONE == ret)
+			{
+				if (NULL != batch)
+				{
+					g_atomic_int_inc(&batch->pending);
+				}
+				ret = _messages_send_message(_svc, part, save_to_sentbox,
+						(NULL != batch) ? _messages_sent_batch_cb : NULL, batch,
+						_messages_new_request_id(_svc), false, NULL);
+				if (MESSAGES_ERROR_NONE != ret && NULL != batch)
+				{
+					g_atomic_int_add(&batch->pending, -1);
+				}
+			}
+			messages_destroy_message(part);
+		}
+		free(part_text);
+
+		if (MESSAGES_ERROR_NONE != ret)
+		{
+			LOGE("[%s:%d] sending part %d of %d failed. ret = %d"
+				, __FUNCTION__, __LINE__, i + 1, count, ret);
+			break;
+		}
+		submitted++;
+	}
+
+	free(offsets);
+
+	if (0 == submitted)
+	{
+		if (0 != dedup_key)
+		{
+			_messages_dedup_forget(_svc, dedup_key);
+		}
+		free(batch);
+		return ret;
+	}
+
+	if (NULL != batch)
+	{
+		if (MESSAGES_ERROR_NONE != ret)
+		{
+			g_atomic_int_set(&batch->failed, 1);
+		}
+		_messages_sent_batch_cb(MESSAGES_ERROR_NONE == ret ? MESSAGES_SENDING_SUCCEEDED : MESSAGES_SENDING_FAILED, batch);
+
+		// The failure is reported through the callback.
+		return MESSAGES_ERROR_NONE;
+	}
+
+	return ret;
+}
+
+int messages_get_message_count(messages_service_h service, 
+							messages_message_box_e mbox, messages_message_type_e type,
+							int *count)
+{
+	int ret;
+	msg_folder_id_t folderId;
+	msg_struct_t countInfo = NULL;
+	int nSms, nMms;
+	
+	messages_service_s *_svc = (messages_service_s*)service;
+	
+	CHECK_NULL(_svc);
+	CHECK_NULL(count);
+	
+	nSms = 0;
+	nMms = 0;
+	
+	if (MESSAGES_MBOX_ALL == mbox)
+	{
+		if (MESSAGES_TYPE_SMS == type || MESSAGES_TYPE_UNKNOWN == type)
+		{
+			ret = ERROR_CONVERT(msg_count_msg_by_type(_svc->service_h, MSG_TYPE_SMS, &nSms));
+			if (MESSAGES_ERROR_NONE != ret)
+			{
+				return ret;
+			}
+		}
+
+		if (MESSAGES_TYPE_MMS == type || MESSAGES_TYPE_UNKNOWN == type)
+		{
+			ret = ERROR_CONVERT(msg_count_msg_by_type(_svc->service_h, MSG_TYPE_MMS, &nMms));
+			if (MESSAGES_ERROR_NONE != ret)
+			{
+				return ret;
+			}
+		}
+
+		*count = nSms + nMms;
+	}
+	else
+	{
+		countInfo = msg_create_struct(MSG_STRUCT_COUNT_INFO);
+		folderId = _messages_convert_mbox_to_fw(mbox);
+		ret = ERROR_CONVERT(msg_count_message(_svc->service_h, folderId, countInfo));
+		if (MESSAGES_ERROR_NONE != ret)
+		{
+			return ret;
+		}
+		
+		msg_get_int_value(countInfo, MSG_COUNT_INFO_SMS_INT, &nSms);
+		msg_get_int_value(countInfo, MSG_COUNT_INFO_MMS_INT, &nMms);
+
+		msg_release_struct(&countInfo);
+
+		switch (type)
+		{
+		case MESSAGES_TYPE_SMS:	*count = nSms; break;
+		case MESSAGES_TYPE_MMS: *count = nMms; break;
+		case MESSAGES_TYPE_UNKNOWN: *count = nSms + nMms; break;
+		default: *count = 0; break;
+		}
+	}
+	
+	return MESSAGES_ERROR_NONE;
+}
+
+int messages_search_message(messages_service_h service,
 							messages_message_box_e mbox,
 							messages_message_type_e type,
 							const char *keyword, const char *address,
@@ -626,8 +1167,6 @@ int messages_search_message(messages_service_h service,
 	for (i=0; i < msg_list.nCount; i++)
 	{
 		_msg = (messages_message_s*)calloc(1, sizeof(messages_message_s));
-		_msg->text = NULL;
-		_msg->attachment_list = NULL;
 		if (NULL == _msg)
 		{
 			LOGE("[%s:%d] OUT_OF_MEMORY(0x%08x) fail to create '_msg'."
@@ -646,127 +1185,577 @@ int messages_search_message(messages_service_h service,
 			// Shoud I load mms data at here?
 			_messages_load_mms_data(_msg, _svc->service_h);
 		}
-		
-		_array[i] = (messages_message_h)_msg;
+		
+		_array[i] = (messages_message_h)_msg;
+	}
+	
+	*message_array = (messages_message_h*)_array;
+	
+	if (NULL != length)
+	{
+		*length = msg_list.nCount;
+	}
+	
+	if (NULL != total)
+	{
+		*total = -1; // TODO: total count is not supported yet.
+	}
+	
+	// TODO: where should I free msg_list?
+	
+
+	return MESSAGES_ERROR_NONE;
+}
+
+int messages_free_message_array(messages_message_h *message_array)
+{
+	int ret;
+	int i=0;
+
+	messages_message_h* _array = (messages_message_h*)message_array;
+	CHECK_NULL(_array);
+	
+	while (_array[i] != NULL)
+	{
+		ret = messages_destroy_message(_array[i]);
+		if (MESSAGES_ERROR_NONE != ret)
+		{
+			LOGW("[%s:%d] messages_destroy_message() is fail. ret = %d"
+				, __FUNCTION__, __LINE__, ret);
+		}
+		
+		i++;
+	}
+	
+	free(message_array);
+	
+	return MESSAGES_ERROR_NONE;
+}
+
+int messages_foreach_message(messages_service_h svc,
+							 messages_message_box_e mbox,
+							 messages_message_type_e type,
+							 const char *keyword, const char *address,
+							 int offset, int limit,
+							 messages_search_cb callback, void *user_data)
+{
+	int i;
+	int ret;
+	bool ret_cb;
+
+	messages_message_h* msg_array;
+	int length;
+	int total;
+	
+	ret = messages_search_message(svc, mbox, type, keyword, address, offset, limit,
+								&msg_array, &length, &total);
+	if (MESSAGES_ERROR_NONE != ret)
+	{
+		return ret;			
+	}
+	
+	for (i=0; i < length; i++)
+	{
+		ret_cb = callback((messages_message_h)msg_array[i], i, length, total, user_data);
+	}
+	
+	ret = messages_free_message_array(msg_array);
+	if (MESSAGES_ERROR_NONE != ret)
+	{
+		return ret;			
+	}
+	
+	return MESSAGES_ERROR_NONE;
+}
+
+void _messages_sent_mediator_cb(msg_handle_t handle, msg_struct_t pStatus, void *user_param)
+{
+	messages_sending_result_e ret;
+	messages_service_s *_svc = (messages_service_s*)user_param;
+
+	int status = MSG_NETWORK_SEND_FAIL;
+	int reqId = 0;
+	messages_sent_callback_s *_cb;
+
+	msg_get_int_value(pStatus, MSG_SENT_STATUS_REQUESTID_INT, &reqId);
+	msg_get_int_value(pStatus, MSG_SENT_STATUS_NETWORK_STATUS_INT, &status);
+
+	if (NULL == _svc)
+	{
+		return;
+	}
+
+	// Delivery reports come through the sending status of the same request.
+	if (MSG_NETWORK_DELIVER_SUCCESS == status || MSG_NETWORK_DELIVER_FAIL == status)
+	{
+		_messages_delivery_reported(_svc, reqId, MSG_NETWORK_DELIVER_SUCCESS == status);
+		return;
+	}
+
+	_messages_delivery_sent(_svc, reqId, MSG_NETWORK_SEND_SUCCESS == status);
+
+	_cb = _messages_take_sent_callback(_svc, reqId);
+	if (NULL != _cb)
+	{
+		ret = (status == MSG_NETWORK_SEND_SUCCESS) ? 
+				MESSAGES_SENDING_SUCCEEDED : MESSAGES_SENDING_FAILED;
+
+		_messages_latency_record(_svc, _cb->msg_type, ret, g_get_monotonic_time() - _cb->submit_time);
+
+		if (MESSAGES_SENDING_FAILED == ret && NULL != _cb->retry && _messages_retry_schedule(_svc, _cb->retry))
+		{
+			_messages_free_sent_callback(_cb);
+			return;
+		}
+
+		if (NULL != _cb->callback)
+		{
+			((messages_sent_cb)_cb->callback)(ret, _cb->user_data);
+		}
+		if (NULL != _cb->retry)
+		{
+			_messages_retry_finish(_svc, _cb->retry);
+		}
+		_messages_free_sent_callback(_cb);
+	}
+}
+
+guint64 _messages_get_tick(void)
+{
+	return g_get_monotonic_time() / (G_USEC_PER_SEC * MESSAGES_TIMER_TICK_SEC);
+}
+
+static gboolean _messages_sent_timer_cb(gpointer user_data)
+{
+	int timeout;
+	gboolean keep;
+	messages_timer_s *expired;
+	messages_timer_s *timer;
+	messages_sent_callback_s *_cb;
+	messages_retry_s *_retry;
+	messages_service_s *_svc = (messages_service_s*)user_data;
+
+	g_mutex_lock(&_svc->sent_cb_lock);
+
+	if (g_atomic_int_get(&_svc->closed))
+	{
+		g_mutex_unlock(&_svc->sent_cb_lock);
+		return FALSE;
+	}
+
+	// messages_close_service() waits for this tick to finish.
+	_svc->sent_timer_thread = g_thread_self();
+	timeout = _svc->sent_timeout;
+
+	expired = _messages_timer_wheel_advance(&_svc->sent_timer_wheel, _messages_get_tick());
+	for (timer = expired; NULL != timer; timer = timer->next)
+	{
+		if (MESSAGES_TIMER_SENDING_TIMEOUT == timer->kind)
+		{
+			_cb = (messages_sent_callback_s *)timer;
+			g_hash_table_steal(_svc->sent_cb_table, GINT_TO_POINTER(_cb->req_id));
+		}
+	}
+
+	g_mutex_unlock(&_svc->sent_cb_lock);
+
+	while (NULL != expired)
+	{
+		timer = expired;
+		expired = expired->next;
+
+		// A callback closed the service, the rest is dropped like the requests pending at close.
+		if (g_atomic_int_get(&_svc->closed))
+		{
+			if (MESSAGES_TIMER_RETRY == timer->kind)
+			{
+				_messages_retry_release((messages_retry_s *)timer);
+			}
+			else
+			{
+				_messages_free_sent_callback(timer);
+			}
+			continue;
+		}
+
+		if (MESSAGES_TIMER_RETRY == timer->kind)
+		{
+			_retry = (messages_retry_s *)timer;
+			_messages_send_message(_svc, _retry->msg, _retry->save_to_sentbox,
+					(messages_sent_cb)_retry->callback, _retry->user_data, _retry->request_id, false, _retry);
+			continue;
+		}
+
+		_cb = (messages_sent_callback_s *)timer;
+		LOGW("[%s] no sending status for request %d in %d seconds."
+			, __FUNCTION__, _cb->req_id, timeout);
+		if (NULL != _cb->callback)
+		{
+			((messages_sent_cb)_cb->callback)(MESSAGES_SENDING_TIMED_OUT, _cb->user_data);
+		}
+		if (NULL != _cb->retry)
+		{
+			_messages_retry_finish(_svc, _cb->retry);
+		}
+		_messages_free_sent_callback(_cb);
+	}
+
+	// The callbacks and resendings may have added timers while this source is still running.
+	g_mutex_lock(&_svc->sent_cb_lock);
+	_svc->sent_timer_thread = NULL;
+	g_cond_broadcast(&_svc->sent_timer_idle);
+	keep = !g_atomic_int_get(&_svc->closed) && (0 < _svc->sent_timer_wheel.count);
+	if (!keep && !g_atomic_int_get(&_svc->closed))
+	{
+		_svc->sent_timer_id = 0;
+	}
+	g_mutex_unlock(&_svc->sent_cb_lock);
+
+	return keep;
+}
+
+// Must be called with svc->sent_cb_lock held.
+static void _messages_add_timer_locked(messages_service_s *svc, messages_timer_s *timer, int seconds)
+{
+	guint64 tick;
+
+	tick = _messages_get_tick();
+	if (0 == svc->sent_timer_wheel.count)
+	{
+		// An idle wheel catches up at once instead of walking the ticks it slept through.
+		_messages_timer_wheel_advance(&svc->sent_timer_wheel, tick);
+	}
+	_messages_timer_wheel_add(&svc->sent_timer_wheel, timer,
+			tick + (seconds + MESSAGES_TIMER_TICK_SEC - 1) / MESSAGES_TIMER_TICK_SEC);
+	if (0 == svc->sent_timer_id)
+	{
+		svc->sent_timer_id = g_timeout_add_seconds_full(G_PRIORITY_DEFAULT, MESSAGES_TIMER_TICK_SEC,
+				_messages_sent_timer_cb, _messages_service_ref(svc), _messages_service_unref);
+	}
+}
+
+void _messages_add_timer(messages_service_s *svc, messages_timer_s *timer, int seconds)
+{
+	g_mutex_lock(&svc->sent_cb_lock);
+	_messages_add_timer_locked(svc, timer, seconds);
+	g_mutex_unlock(&svc->sent_cb_lock);
+}
+
+void _messages_add_sent_callback(messages_service_s *svc, messages_sent_callback_s *cb)
+{
+	messages_sent_callback_s *old;
+
+	g_mutex_lock(&svc->sent_cb_lock);
+
+	old = (messages_sent_callback_s *)g_hash_table_lookup(svc->sent_cb_table, GINT_TO_POINTER(cb->req_id));
+	if (NULL != old)
+	{
+		LOGW("[%s] request %d is already pending, the old callback is dropped.", __FUNCTION__, cb->req_id);
+		_messages_timer_wheel_remove(&svc->sent_timer_wheel, &old->timer);
+	}
+	g_hash_table_insert(svc->sent_cb_table, GINT_TO_POINTER(cb->req_id), cb);
+
+	if (0 < svc->sent_timeout)
+	{
+		_messages_add_timer_locked(svc, &cb->timer, svc->sent_timeout);
+	}
+
+	g_mutex_unlock(&svc->sent_cb_lock);
+}
+
+void _messages_free_sent_callback(gpointer data)
+{
+	messages_sent_callback_s *cb = (messages_sent_callback_s *)data;
+
+	_messages_spool_file_unref(cb->text_file);
+	_messages_store_unref(cb->store);
+	free(cb);
+}
+
+messages_sent_callback_s *_messages_take_sent_callback(messages_service_s *svc, int req_id)
+{
+	messages_sent_callback_s *cb;
+
+	g_mutex_lock(&svc->sent_cb_lock);
+
+	cb = (messages_sent_callback_s *)g_hash_table_lookup(svc->sent_cb_table, GINT_TO_POINTER(req_id));
+	if (NULL != cb)
+	{
+		g_hash_table_steal(svc->sent_cb_table, GINT_TO_POINTER(req_id));
+		_messages_timer_wheel_remove(&svc->sent_timer_wheel, &cb->timer);
+	}
+
+	g_mutex_unlock(&svc->sent_cb_lock);
+
+	return cb;
+}
+
+int messages_set_sending_timeout(messages_service_h service, int timeout)
+{
+	messages_service_s *_svc = (messages_service_s*)service;
+
+	CHECK_NULL(_svc);
+
+	if (timeout < 0)
+	{
+		LOGE("[%s] INVALID_PARAMETER(0x%08x) : timeout(%d) is negative."
+			, __FUNCTION__, MESSAGES_ERROR_INVALID_PARAMETER, timeout);
+		return MESSAGES_ERROR_INVALID_PARAMETER;
+	}
+
+	g_mutex_lock(&_svc->sent_cb_lock);
+	_svc->sent_timeout = timeout;
+	g_mutex_unlock(&_svc->sent_cb_lock);
+
+	return MESSAGES_ERROR_NONE;
+}
+
+int messages_mms_set_spool_directory(messages_service_h service, const char *path)
+{
+	char *old;
+	char *_path = NULL;
+	struct stat st;
+
+	messages_service_s *_svc = (messages_service_s*)service;
+
+	CHECK_NULL(_svc);
+
+	if (NULL != path)
+	{
+		if (0 != stat(path, &st) || !S_ISDIR(st.st_mode))
+		{
+			LOGE("[%s] INVALID_PARAMETER(0x%08x) : '%s' is not a directory."
+				, __FUNCTION__, MESSAGES_ERROR_INVALID_PARAMETER, path);
+			return MESSAGES_ERROR_INVALID_PARAMETER;
+		}
+
+		_path = strdup(path);
+		if (NULL == _path)
+		{
+			LOGE("[%s] OUT_OF_MEMORY(0x%08x) fail to create a '_path'."
+				, __FUNCTION__, MESSAGES_ERROR_OUT_OF_MEMORY);
+			return MESSAGES_ERROR_OUT_OF_MEMORY;
+		}
+	}
+
+	g_mutex_lock(&_svc->spool_lock);
+	old = _svc->spool_dir;
+	_svc->spool_dir = _path;
+	g_mutex_unlock(&_svc->spool_lock);
+
+	free(old);
+
+	return MESSAGES_ERROR_NONE;
+}
+
+typedef struct {
+	messages_service_s *svc;
+	int          request_id;	/* 0 for all requests */
+	GSList*      retries;		/* retries taken from the timer wheel */
+	GSList*      req_ids;		/* msg-service requests waiting for their sending status */
+} messages_cancel_s;
+
+static void _messages_cancel_retry_cb(messages_timer_s *timer, void *user_data)
+{
+	messages_cancel_s *cancel = (messages_cancel_s *)user_data;
+
+	if (MESSAGES_TIMER_RETRY == timer->kind
+		&& (0 == cancel->request_id || ((messages_retry_s *)timer)->request_id == cancel->request_id))
+	{
+		_messages_timer_wheel_remove(&cancel->svc->sent_timer_wheel, timer);
+		cancel->retries = g_slist_prepend(cancel->retries, timer);
+	}
+}
+
+static void _messages_cancel_sent_cb(gpointer key, gpointer value, gpointer user_data)
+{
+	messages_sent_callback_s *cb = (messages_sent_callback_s *)value;
+	messages_cancel_s *cancel = (messages_cancel_s *)user_data;
+
+	if (0 == cancel->request_id || cb->request_id == cancel->request_id)
+	{
+		cancel->req_ids = g_slist_prepend(cancel->req_ids, GINT_TO_POINTER(cb->req_id));
+	}
+}
+
+static int _messages_cancel_sending(messages_service_s *svc, int request_id)
+{
+	int ret;
+	int result = MESSAGES_ERROR_NONE;
+	bool found;
+	GSList *iter;
+	messages_retry_s *_retry;
+	messages_sent_callback_s *_cb;
+	messages_cancel_s cancel;
+
+	memset(&cancel, 0, sizeof(cancel));
+	cancel.svc = svc;
+	cancel.request_id = request_id;
+
+	g_mutex_lock(&svc->sent_cb_lock);
+	_messages_timer_wheel_foreach(&svc->sent_timer_wheel, _messages_cancel_retry_cb, &cancel);
+	g_hash_table_foreach(svc->sent_cb_table, _messages_cancel_sent_cb, &cancel);
+	g_mutex_unlock(&svc->sent_cb_lock);
+
+	found = (NULL != cancel.retries || NULL != cancel.req_ids);
+
+	// Waiting retries are not known to msg-service.
+	for (iter = cancel.retries; iter; iter = g_slist_next(iter))
+	{
+		_retry = (messages_retry_s *)iter->data;
+
+		// A canceled message can be corrected and sent again within the duplicate window.
+		if (0 != _retry->dedup_key)
+		{
+			_messages_dedup_forget(svc, _retry->dedup_key);
+		}
+		if (NULL != _retry->callback)
+		{
+			((messages_sent_cb)_retry->callback)(MESSAGES_SENDING_CANCELED, _retry->user_data);
+		}
+		_messages_retry_finish(svc, _retry);
+	}
+
+	for (iter = cancel.req_ids; iter; iter = g_slist_next(iter))
+	{
+		ret = msg_cancel_req(svc->service_h, GPOINTER_TO_INT(iter->data));
+		if (MSG_SUCCESS != ret)
+		{
+			LOGE("[%s] request %d can not be canceled, ret = %d.", __FUNCTION__, GPOINTER_TO_INT(iter->data), ret);
+			result = ERROR_CONVERT(ret);
+			continue;
+		}
+
+		// The sending status may have been reported in the meantime.
+		_cb = _messages_take_sent_callback(svc, GPOINTER_TO_INT(iter->data));
+		if (NULL != _cb)
+		{
+			if (0 != _cb->dedup_key)
+			{
+				_messages_dedup_forget(svc, _cb->dedup_key);
+			}
+			if (NULL != _cb->callback)
+			{
+				((messages_sent_cb)_cb->callback)(MESSAGES_SENDING_CANCELED, _cb->user_data);
+			}
+			if (NULL != _cb->retry)
+			{
+				_messages_retry_finish(svc, _cb->retry);
+			}
+			_messages_free_sent_callback(_cb);
+		}
 	}
-	
-	*message_array = (messages_message_h*)_array;
-	
-	if (NULL != length)
+
+	g_slist_free(cancel.retries);
+	g_slist_free(cancel.req_ids);
+
+	if (!found && 0 != request_id)
 	{
-		*length = msg_list.nCount;
+		LOGE("[%s] INVALID_PARAMETER(0x%08x) : request %d is not pending."
+			, __FUNCTION__, MESSAGES_ERROR_INVALID_PARAMETER, request_id);
+		return MESSAGES_ERROR_INVALID_PARAMETER;
 	}
-	
-	if (NULL != total)
+
+	return result;
+}
+
+int messages_cancel_sending(messages_service_h service, int request_id)
+{
+	messages_service_s *_svc = (messages_service_s*)service;
+
+	CHECK_NULL(_svc);
+	CHECK_NULL(_svc->service_h);
+
+	if (request_id <= 0)
 	{
-		*total = -1; // TODO: total count is not supported yet.
+		LOGE("[%s] INVALID_PARAMETER(0x%08x) : request_id(%d) is invalid."
+			, __FUNCTION__, MESSAGES_ERROR_INVALID_PARAMETER, request_id);
+		return MESSAGES_ERROR_INVALID_PARAMETER;
 	}
-	
-	// TODO: where should I free msg_list?
-	
 
-	return MESSAGES_ERROR_NONE;
+	return _messages_cancel_sending(_svc, request_id);
 }
 
-int messages_free_message_array(messages_message_h *message_array)
+int messages_cancel_all_sendings(messages_service_h service)
 {
-	int ret;
-	int i=0;
+	messages_service_s *_svc = (messages_service_s*)service;
 
-	messages_message_h* _array = (messages_message_h*)message_array;
-	CHECK_NULL(_array);
-	
-	while (_array[i] != NULL)
+	CHECK_NULL(_svc);
+	CHECK_NULL(_svc->service_h);
+
+	return _messages_cancel_sending(_svc, 0);
+}
+
+// msg_h is released with the message handle unless it is borrowed from msg-service.
+void _messages_incoming_deliver(messages_service_s *svc, msg_handle_t handle, msg_struct_t msg_h, bool borrowed, bool duplicate)
+{
+	messages_message_type_e msgType;
+	messages_message_s *_msg;
+
+	if (!_messages_incoming_wanted(svc))
 	{
-		ret = messages_destroy_message(_array[i]);
-		if (MESSAGES_ERROR_NONE != ret)
+		if (!borrowed)
 		{
-			LOGW("[%s:%d] messages_destroy_message() is fail. ret = %d"
-				, __FUNCTION__, __LINE__, ret);
+			msg_release_struct(&msg_h);
 		}
-		
-		i++;
+		return;
 	}
-	
-	free(message_array);
-	
-	return MESSAGES_ERROR_NONE;
-}
-
-int messages_foreach_message(messages_service_h svc,
-							 messages_message_box_e mbox,
-							 messages_message_type_e type,
-							 const char *keyword, const char *address,
-							 int offset, int limit,
-							 messages_search_cb callback, void *user_data)
-{
-	int i;
-	int ret;
-	bool ret_cb;
 
-	messages_message_h* msg_array;
-	int length;
-	int total;
-	
-	ret = messages_search_message(svc, mbox, type, keyword, address, offset, limit,
-								&msg_array, &length, &total);
-	if (MESSAGES_ERROR_NONE != ret)
+	_msg = (messages_message_s*)calloc(1, sizeof(messages_message_s));
+	if (NULL == _msg)
 	{
-		return ret;			
+		LOGE("[%s] OUT_OF_MEMORY(0x%08x) fail to create '_msg'."
+			, __FUNCTION__, MESSAGES_ERROR_OUT_OF_MEMORY);
+		if (!borrowed)
+		{
+			msg_release_struct(&msg_h);
+		}
+		return;
 	}
-	
-	for (i=0; i < length; i++)
+
+	_msg->msg_h = msg_h;
+	_msg->msg_h_borrowed = borrowed;
+	_msg->duplicate = duplicate;
+
+	messages_get_message_type((messages_message_h)_msg, &msgType);
+
+	if (MESSAGES_TYPE_MMS == msgType)
 	{
-		ret_cb = callback((messages_message_h)msg_array[i], i, length, total, user_data);
+		_messages_load_mms_data(_msg, handle);
 	}
-	
-	ret = messages_free_message_array(msg_array);
-	if (MESSAGES_ERROR_NONE != ret)
+	else if (_messages_incoming_route(svc, (messages_message_h)_msg))
 	{
-		return ret;			
+		// The port has its own handler, the other callbacks do not see it.
+		messages_destroy_message((messages_message_h)_msg);
+		return;
 	}
-	
-	return MESSAGES_ERROR_NONE;
-}
-
-void _messages_sent_mediator_cb(msg_handle_t handle, msg_struct_t pStatus, void *user_param)
-{
-	messages_sending_result_e ret;
-	messages_service_s *_svc = (messages_service_s*)user_param;
 
-	int i;
-	int status = MSG_NETWORK_SEND_FAIL;
-	int reqId = 0;
-	messages_sent_callback_s *_cb;
+	if (svc->incoming_cb_enabled && NULL != svc->incoming_cb)
+	{
+		((messages_incoming_cb)svc->incoming_cb)((messages_message_h)_msg, svc->incoming_cb_user_data);
+	}
 
-	msg_get_int_value(pStatus, MSG_SENT_STATUS_REQUESTID_INT, &reqId);
-	msg_get_int_value(pStatus, MSG_SENT_STATUS_NETWORK_STATUS_INT, &status);
+	// Every subscriber gets the same decoded message.
+	_messages_incoming_subscribers_notify(svc, (messages_message_h)_msg);
 
-	if (NULL == _svc)
+	if (_messages_incoming_batch_add(svc, _msg))
 	{
 		return;
 	}
 
-	for (i=0; i < g_slist_length(_svc->sent_cb_list); i++)
-	{
-		_cb = (messages_sent_callback_s *)g_slist_nth_data(_svc->sent_cb_list, i);
-		if (NULL != _cb && _cb->req_id == reqId)
-		{
-			ret = (status == MSG_NETWORK_SEND_SUCCESS) ? 
-					MESSAGES_SENDING_SUCCEEDED : MESSAGES_SENDING_FAILED;
+	messages_destroy_message((messages_message_h)_msg);
+}
 
-			((messages_sent_cb)_cb->callback)(ret, _cb->user_data);
-			_svc->sent_cb_list = g_slist_remove(_svc->sent_cb_list, _cb);
-			free(_cb);
-			break;
-		}
-	}
+bool _messages_incoming_wanted(messages_service_s *svc)
+{
+	return (svc->incoming_cb_enabled && NULL != svc->incoming_cb) || NULL != g_atomic_pointer_get(&svc->incoming_batch.cb)
+		|| NULL != g_atomic_pointer_get(&svc->subscribers) || 0 != g_atomic_int_get(&svc->port_route_count);
 }
 
 void _messages_incoming_mediator_cb(msg_handle_t handle, msg_struct_t msg, void *user_param)
 {
-	messages_message_type_e msgType;
-	messages_message_s *_msg;
+	bool drop;
+	bool duplicate;
 	messages_service_s *_svc = (messages_service_s*)user_param;
 
 	if (NULL == _svc)
@@ -774,29 +1763,28 @@ void _messages_incoming_mediator_cb(msg_handle_t handle, msg_struct_t msg, void
 		return;
 	}
 
-	if (_svc->incoming_cb_enabled && _svc->incoming_cb != NULL)
+	// Rejected messages cost no allocation nor body load.
+	if (!_messages_incoming_filter_match(_svc, msg))
 	{
-		_msg = (messages_message_s*)calloc(1, sizeof(messages_message_s));
-		if (NULL == _msg)
-		{
-			LOGE("[%s] OUT_OF_MEMORY(0x%08x) fail to create '_msg'."
-				, __FUNCTION__, MESSAGES_ERROR_OUT_OF_MEMORY);
-			return;
-		}
-		
-		_msg->msg_h = msg;
+		return;
+	}
 
-		messages_get_message_type((messages_message_h)_msg, &msgType);
+	duplicate = _messages_incoming_dedup_check(_svc, msg, &drop);
+	if (duplicate && drop)
+	{
+		return;
+	}
 
-		if (MESSAGES_TYPE_MMS == msgType)
+	if (NULL != _svc->dispatcher)
+	{
+		if (_messages_incoming_wanted(_svc))
 		{
-			_messages_load_mms_data(_msg, handle);
+			_messages_dispatch_incoming(_svc->dispatcher, msg, duplicate);
 		}
-
-		((messages_incoming_cb)_svc->incoming_cb)((messages_message_h)_msg, _svc->incoming_cb_user_data);
-
-		free(_msg);
+		return;
 	}
+
+	_messages_incoming_deliver(_svc, handle, msg, true, duplicate);
 }
 
 int messages_set_message_incoming_cb(messages_service_h svc, messages_incoming_cb callback, void *user_data)
@@ -808,23 +1796,10 @@ int messages_set_message_incoming_cb(messages_service_h svc, messages_incoming_c
 	CHECK_NULL(_svc);
 	CHECK_NULL(callback);
 
-	if (NULL == _svc->incoming_cb)
+	ret = _messages_register_incoming_mediator(_svc);
+	if (MESSAGES_ERROR_NONE != ret)
 	{
-		ret = ERROR_CONVERT(
-				msg_reg_sms_message_callback(_svc->service_h, &_messages_incoming_mediator_cb, 0, (void*)_svc)
-			);
-		if (MESSAGES_ERROR_NONE != ret)
-		{
-			return ret;
-		}
-
-		ret = ERROR_CONVERT(
-				msg_reg_mms_conf_message_callback(_svc->service_h, &_messages_incoming_mediator_cb, NULL, (void*)_svc)
-			);
-		if (MESSAGES_ERROR_NONE != ret)
-		{
-			return ret;
-		}
+		return ret;
 	}
 
 	_svc->incoming_cb = (void*)callback;
@@ -834,29 +1809,51 @@ int messages_set_message_incoming_cb(messages_service_h svc, messages_incoming_c
 	return MESSAGES_ERROR_NONE;
 }
 
-int messages_add_sms_listening_port(messages_service_h service, int port)
+int _messages_register_incoming_mediator(messages_service_s *svc)
 {
 	int ret;
-	messages_service_s *_svc = (messages_service_s*)service;
-	CHECK_NULL(_svc);
-	
-	if (port <= 0)
+
+	if (svc->incoming_mediator)
 	{
-		return MESSAGES_ERROR_INVALID_PARAMETER;
+		return MESSAGES_ERROR_NONE;
 	}
-	
+
 	ret = ERROR_CONVERT(
-			msg_reg_sms_message_callback(_svc->service_h, &_messages_incoming_mediator_cb, port, (void*)_svc)
+			msg_reg_sms_message_callback(svc->service_h, &_messages_incoming_mediator_cb, 0, (void*)svc)
 		);
-		
 	if (MESSAGES_ERROR_NONE != ret)
 	{
 		return ret;
 	}
-	
+	svc->incoming_registered = true;
+
+	ret = ERROR_CONVERT(
+			msg_reg_mms_conf_message_callback(svc->service_h, &_messages_incoming_mediator_cb, NULL, (void*)svc)
+		);
+	if (MESSAGES_ERROR_NONE != ret)
+	{
+		return ret;
+	}
+
+	svc->incoming_mediator = true;
+
 	return MESSAGES_ERROR_NONE;
 }
 
+int messages_add_sms_listening_port(messages_service_h service, int port)
+{
+	messages_service_s *_svc = (messages_service_s*)service;
+	CHECK_NULL(_svc);
+	
+	if (port <= 0 || MESSAGES_PORT_COUNT <= port)
+	{
+		return MESSAGES_ERROR_INVALID_PARAMETER;
+	}
+	
+	// A port that already has a callback is registered once for both.
+	return _messages_port_register(_svc, port);
+}
+
 int messages_unset_message_incoming_cb(messages_service_h svc)
 {
 	messages_service_s *_svc = (messages_service_s*)svc;
@@ -894,6 +1891,7 @@ int messages_set_text(messages_message_h msg, const char *text)
 	int ret;
 	int len;
 	messages_message_type_e type;
+	messages_sms_text_info_s info;
 
 	messages_message_s *_msg = (messages_message_s*)msg;
 	CHECK_NULL(_msg);
@@ -914,14 +1912,23 @@ int messages_set_text(messages_message_h msg, const char *text)
 				, __FUNCTION__, MESSAGES_ERROR_INVALID_PARAMETER);
 			return MESSAGES_ERROR_INVALID_PARAMETER;
 		}
+		_messages_sms_analyze_text(text, len, &info);
+		if (info.segments > MAX_MESSAGES_SEGMENT_COUNT)
+		{
+			LOGE("[%s] INVALID_PARAMETER(0x%08x) : the body needs %d segments, the max is %d."
+				, __FUNCTION__, MESSAGES_ERROR_INVALID_PARAMETER, info.segments, MAX_MESSAGES_SEGMENT_COUNT);
+			return MESSAGES_ERROR_INVALID_PARAMETER;
+		}
+		ret = _messages_detach_msg_h(_msg);
+		if (MESSAGES_ERROR_NONE != ret) {
+			return ret;
+		}
 		ret = ERROR_CONVERT(msg_set_str_value(_msg->msg_h, MSG_MESSAGE_SMS_DATA_STR, (char *)text, len));
 	}
 	else if (MESSAGES_TYPE_MMS == type)
 	{
-		if (NULL != _msg->text)
-		{
-			free(_msg->text);
-		}
+		_messages_release_text(_msg);
+		_msg->mms_built = false;
 
 		_msg->text = strdup(text);
 		if (NULL == _msg->text)
@@ -1073,8 +2080,6 @@ int messages_search_message_by_id(messages_service_h service, int msg_id, messag
 	}
 	
 	_msg = (messages_message_s*)calloc(1, sizeof(messages_message_s));
-	_msg->text = NULL;
-	_msg->attachment_list = NULL;
 	if (NULL == _msg)
 	{
 		LOGE("[%s:%d] OUT_OF_MEMORY(0x%08x) fail to create '_msg'."
@@ -1160,6 +2165,11 @@ int messages_mms_set_subject(messages_message_h msg, const char *subject)
 			, __FUNCTION__, MESSAGES_ERROR_INVALID_PARAMETER);
 		return MESSAGES_ERROR_INVALID_PARAMETER;		
 	}
+
+	ret = _messages_detach_msg_h(_msg);
+	if (MESSAGES_ERROR_NONE != ret) {
+		return ret;
+	}
 	
 	ret = msg_set_str_value(_msg->msg_h, MSG_MESSAGE_SUBJECT_STR, (char *)subject, strlen(subject));
 
@@ -1213,13 +2223,21 @@ int messages_mms_add_attachment(messages_message_h msg, messages_media_type_e ty
 {
 	messages_message_type_e msg_type;	
 
+	int ret;
+
 	messages_message_s *_msg = (messages_message_s*)msg;
-	messages_attachment_s *attach;
 
 	CHECK_NULL(_msg);
 	CHECK_NULL(_msg->msg_h);
 	CHECK_NULL(path);
 
+	if (strlen(path) >= MSG_FILEPATH_LEN_MAX)
+	{
+		LOGE("[%s] INVALID_PARAMETER(0x%08x) : the path is too long."
+			, __FUNCTION__, MESSAGES_ERROR_INVALID_PARAMETER);
+		return MESSAGES_ERROR_INVALID_PARAMETER;
+	}
+
 	// Check Message Type
 	messages_get_message_type(msg, &msg_type);
 	if (MESSAGES_TYPE_MMS != msg_type)
@@ -1229,20 +2247,18 @@ int messages_mms_add_attachment(messages_message_h msg, messages_media_type_e ty
 		return MESSAGES_ERROR_INVALID_PARAMETER;		
 	}
 
-	// New Attach
-	attach = (messages_attachment_s *)calloc(1, sizeof(messages_attachment_s));
-	if (NULL == attach)
+	if (MESSAGES_ERROR_NONE != _messages_detach_attachments(_msg))
 	{
-		LOGE("[%s] OUT_OF_MEMORY(0x%08x) fail to create a 'attach'."
-			, __FUNCTION__, MESSAGES_ERROR_OUT_OF_MEMORY);
-		return MESSAGES_ERROR_OUT_OF_MEMORY;		
+		return MESSAGES_ERROR_OUT_OF_MEMORY;
 	}
 
-	attach->media_type = type;	
-	strncpy(attach->filepath, path, strlen(path));
-
 	// Append
-	_msg->attachment_list = g_slist_append(_msg->attachment_list, attach);
+	ret = _messages_append_attachment(_msg, type, path);
+	if (MESSAGES_ERROR_NONE != ret)
+	{
+		return ret;
+	}
+	_msg->mms_built = false;
 
 	return MESSAGES_ERROR_NONE;
 }
@@ -1267,7 +2283,7 @@ int messages_mms_get_attachment_count(messages_message_h msg, int *count)
 	}
 
 	// Count
-	*count = g_slist_length(_msg->attachment_list);
+	*count = _msg->attachment_count;
 
 	return MESSAGES_ERROR_NONE;
 }
@@ -1292,7 +2308,7 @@ int messages_mms_get_attachment(messages_message_h msg, int index, messages_medi
 		return MESSAGES_ERROR_INVALID_PARAMETER;		
 	}
 
-	_attach = (messages_attachment_s *)g_slist_nth_data(_msg->attachment_list, index);
+	_attach = (0 <= index && index < _msg->attachment_count) ? &_msg->attachments[index] : NULL;
 	if (NULL == _attach)
 	{
 		*type = MESSAGES_MEDIA_UNKNOWN;
@@ -1320,182 +2336,94 @@ int messages_mms_remove_all_attachments(messages_message_h msg)
 	CHECK_NULL(_msg);
 	CHECK_NULL(_msg->msg_h);
 
-	if (_msg->attachment_list)
-	{
-		g_slist_foreach(_msg->attachment_list, (GFunc)g_free, NULL);
-		g_slist_free(_msg->attachment_list);
-		_msg->attachment_list = NULL;
-	}
+	_messages_release_attachments(_msg);
+	_msg->mms_built = false;
 
 	return MESSAGES_ERROR_NONE;
 }
 
-int _messages_save_mms_data(messages_message_s *msg)
+int _messages_save_mms_data(messages_message_s *msg, const char *spool_dir, messages_store_s *store)
 {
 	int i;
 	int ret;
 
 	msg_struct_t mms_data;
-	msg_struct_t region;
-	
-	msg_struct_t page;
-	msg_struct_t media;
-	msg_struct_t smil_text;
 	msg_struct_t mms_attach;
 
 	messages_attachment_s *attach;
-	messages_attachment_s *image;
-	messages_attachment_s *audio;
 
-	char *filepath = NULL;
+	const char **paths = NULL;
+	bool complete = true;
 
 	CHECK_NULL(msg);
-	
-	mms_data = msg_create_struct(MSG_STRUCT_MMS);
-	if (NULL == mms_data)
-	{
-	   	LOGE("[%s:%d] OPERATION_FAILED(0x%08x) : msg_mms_create_message failed.", 
-	   		__FUNCTION__, __LINE__, MESSAGES_ERROR_OPERATION_FAILED);
-		return MESSAGES_ERROR_OPERATION_FAILED;
-	}
-
-	// Check Attachments
-	image = NULL;
-	audio = NULL;
-	for (i=0; i < g_slist_length(msg->attachment_list); i++)
-	{
-		attach = g_slist_nth_data(msg->attachment_list, i);
-		if (MESSAGES_MEDIA_IMAGE == attach->media_type)
-		{
-			if (NULL == image)
-			{
-				image = attach;
-			}
-		}
-		else if (MESSAGES_MEDIA_VIDEO == attach->media_type)
-		{
-			if (NULL == image)
-			{
-				image = attach;
-			}
-		}
-		else if (MESSAGES_MEDIA_AUDIO == attach->media_type)
-		{
-			if (NULL == audio)
-			{
-				audio = attach;
-			}
-		}
-	}
 
-	// Layout Setting
-	msg_set_int_value(mms_data, MSG_MMS_ROOTLAYOUT_WIDTH_INT, 100);
-	msg_set_int_value(mms_data, MSG_MMS_ROOTLAYOUT_HEIGHT_INT, 100);
-	msg_set_int_value(mms_data, MSG_MMS_ROOTLAYOUT_BGCOLOR_INT, 0xffffff);
-	msg_set_bool_value(mms_data, MSG_MMS_ROOTLAYOUT_WIDTH_PERCENT_BOOL, true);
-	msg_set_bool_value(mms_data, MSG_MMS_ROOTLAYOUT_HEIGHT_PERCENT_BOOL, true);
-
-	if (NULL == image)
-	{
-		msg_mms_add_item(mms_data, MSG_STRUCT_MMS_REGION, &region);
-		msg_set_str_value(region, MSG_MMS_REGION_ID_STR, (char *)"Text", 4);
-		msg_set_int_value(region, MSG_MMS_REGION_LENGTH_LEFT_INT, 0);
-		msg_set_int_value(region, MSG_MMS_REGION_LENGTH_TOP_INT, 0);
-		msg_set_int_value(region, MSG_MMS_REGION_LENGTH_WIDTH_INT, 100);
-		msg_set_int_value(region, MSG_MMS_REGION_LENGTH_HEIGHT_INT, 100);
-		msg_set_int_value(region, MSG_MMS_REGION_BGCOLOR_INT, 0xffffff);		
-	}
-	else if (NULL == msg->text)
-	{
-		msg_mms_add_item(mms_data, MSG_STRUCT_MMS_REGION, &region);
-		msg_set_str_value(region, MSG_MMS_REGION_ID_STR, (char *)"Image", 5);
-		msg_set_int_value(region, MSG_MMS_REGION_LENGTH_LEFT_INT, 0);
-		msg_set_int_value(region, MSG_MMS_REGION_LENGTH_TOP_INT, 0);
-		msg_set_int_value(region, MSG_MMS_REGION_LENGTH_WIDTH_INT, 100);
-		msg_set_int_value(region, MSG_MMS_REGION_LENGTH_HEIGHT_INT, 100);
-		msg_set_int_value(region, MSG_MMS_REGION_BGCOLOR_INT, 0xffffff);		
-	}
-	else
-	{
-		msg_mms_add_item(mms_data, MSG_STRUCT_MMS_REGION, &region);
-		msg_set_str_value(region, MSG_MMS_REGION_ID_STR, (char *)"Image", 5);
-		msg_set_int_value(region, MSG_MMS_REGION_LENGTH_LEFT_INT, 0);
-		msg_set_int_value(region, MSG_MMS_REGION_LENGTH_TOP_INT, 0);
-		msg_set_int_value(region, MSG_MMS_REGION_LENGTH_WIDTH_INT, 100);
-		msg_set_int_value(region, MSG_MMS_REGION_LENGTH_HEIGHT_INT, 50);
-		msg_set_int_value(region, MSG_MMS_REGION_BGCOLOR_INT, 0xffffff);
-		
-		msg_mms_add_item(mms_data, MSG_STRUCT_MMS_REGION, &region);
-		msg_set_str_value(region, MSG_MMS_REGION_ID_STR, (char *)"Text", 4);
-		msg_set_int_value(region, MSG_MMS_REGION_LENGTH_LEFT_INT, 0);
-		msg_set_int_value(region, MSG_MMS_REGION_LENGTH_TOP_INT, 50);
-		msg_set_int_value(region, MSG_MMS_REGION_LENGTH_WIDTH_INT, 100);
-		msg_set_int_value(region, MSG_MMS_REGION_LENGTH_HEIGHT_INT, 50);
-		msg_set_int_value(region, MSG_MMS_REGION_BGCOLOR_INT, 0xffffff);
-	}
-
-	// Add Media
-	msg_mms_add_item(mms_data, MSG_STRUCT_MMS_PAGE, &page);
-	msg_set_int_value(page, MSG_MMS_PAGE_PAGE_DURATION_INT, 5440);
-
-	if (NULL != image)
+	// Nothing changed since the last build: the body in msg_h and its text file are reused.
+	// Staged attachments only stay valid with the store which staged them.
+	if (msg->mms_built && msg->mms_store_id == _messages_store_id(store))
 	{
-		if (MESSAGES_MEDIA_IMAGE == image->media_type)
-		{
-			msg_mms_add_item(page, MSG_STRUCT_MMS_MEDIA, &media);
-			msg_set_int_value(media, MSG_MMS_MEDIA_TYPE_INT, MMS_SMIL_MEDIA_IMG);
-			msg_set_str_value(media, MSG_MMS_MEDIA_REGION_ID_STR, (char *)"Image", 5);
-			msg_set_str_value(media, MSG_MMS_MEDIA_FILEPATH_STR, (char *)image->filepath, MAX_IMAGE_PATH_LEN);
-		}
-		else if (MESSAGES_MEDIA_VIDEO == image->media_type)
-		{
-			msg_mms_add_item(page, MSG_STRUCT_MMS_MEDIA, &media);
-			msg_set_int_value(media, MSG_MMS_MEDIA_TYPE_INT, MMS_SMIL_MEDIA_VIDEO);
-			msg_set_str_value(media, MSG_MMS_MEDIA_REGION_ID_STR, (char *)"Image", 5);
-			msg_set_str_value(media, MSG_MMS_MEDIA_FILEPATH_STR, (char *)image->filepath, MAX_IMAGE_PATH_LEN);
-		}
+		return MESSAGES_ERROR_NONE;
 	}
 
-	if (NULL != audio)
+	_messages_release_text_file(msg);
+	
+	mms_data = msg_create_struct(MSG_STRUCT_MMS);
+	if (NULL == mms_data)
 	{
-		msg_mms_add_item(page, MSG_STRUCT_MMS_MEDIA, &media);
-		msg_set_int_value(media, MSG_MMS_MEDIA_TYPE_INT, MMS_SMIL_MEDIA_AUDIO);
-		msg_set_str_value(media, MSG_MMS_MEDIA_REGION_ID_STR, (char *)"Audio", 5);
-		msg_set_str_value(media, MSG_MMS_MEDIA_FILEPATH_STR, (char *)audio->filepath, MAX_IMAGE_PATH_LEN);
+	   	LOGE("[%s:%d] OPERATION_FAILED(0x%08x) : msg_mms_create_message failed.", 
+	   		__FUNCTION__, __LINE__, MESSAGES_ERROR_OPERATION_FAILED);
+		return MESSAGES_ERROR_OPERATION_FAILED;
 	}
 
 	if (NULL != msg->text)
 	{
-		ret = _messages_save_textfile(msg->text, &filepath);
-		if (MESSAGES_ERROR_NONE == ret)
+		// The text file lives as long as the body referring to it, or the requests sending it.
+		ret = _messages_save_textfile(spool_dir, msg->text, &msg->text_file);
+		if (MESSAGES_ERROR_NONE != ret)
 		{
-			msg_mms_add_item(page, MSG_STRUCT_MMS_MEDIA, &media);
-			msg_set_int_value(media, MSG_MMS_MEDIA_TYPE_INT, MMS_SMIL_MEDIA_TEXT);
-			msg_set_str_value(media, MSG_MMS_MEDIA_REGION_ID_STR, (char *)"Text", 4);
-			msg_set_str_value(media, MSG_MMS_MEDIA_FILEPATH_STR, (char *)filepath, MAX_IMAGE_PATH_LEN);
-			
-			msg_get_struct_handle(media, MSG_MMS_MEDIA_SMIL_TEXT_HND, &smil_text);
-			msg_set_int_value(smil_text, MSG_MMS_SMIL_TEXT_COLOR_INT, 0x000000);
-			msg_set_int_value(smil_text, MSG_MMS_SMIL_TEXT_SIZE_INT, MMS_SMIL_FONT_SIZE_NORMAL);
-			msg_set_bool_value(smil_text, MSG_MMS_SMIL_TEXT_BOLD_BOOL, false);
+			complete = false;
 		}
+	}
 
-		if (NULL != filepath)
+	// Files with the same content are handed over from the same staged path.
+	if (0 < msg->attachment_count)
+	{
+		paths = (const char **)calloc(msg->attachment_count, sizeof(const char *));
+		if (NULL == paths)
+		{
+			LOGE("[%s] OUT_OF_MEMORY(0x%08x) fail to create 'paths'."
+				, __FUNCTION__, MESSAGES_ERROR_OUT_OF_MEMORY);
+			msg_release_struct(&mms_data);
+			return MESSAGES_ERROR_OUT_OF_MEMORY;
+		}
+		for (i=0; i < msg->attachment_count; i++)
 		{
-			free(filepath);
+			paths[i] = _messages_store_stage(store, msg->attachments[i].filepath);
+			if (NULL == paths[i])
+			{
+				paths[i] = _messages_intern_ref(msg->attachments[i].filepath);
+			}
 		}
 	}
 
+	// Add Media
+	_messages_smil_layout(msg, mms_data, (NULL != msg->text_file) ? msg->text_file->path : NULL, paths);
+
 	// Add Attachment
-	for (i=0; i < g_slist_length(msg->attachment_list); i++)
+	for (i=0; i < msg->attachment_count; i++)
 	{
-		attach = g_slist_nth_data(msg->attachment_list, i);
-		if (image != attach && audio != attach)
+		attach = &msg->attachments[i];
+		if (!_messages_smil_has_page(attach->media_type))
 		{
 			msg_mms_add_item(mms_data, MSG_STRUCT_MMS_ATTACH, &mms_attach);
-			msg_set_str_value(mms_attach, MSG_MMS_ATTACH_FILEPATH_STR, (char *)attach->filepath, MAX_IMAGE_PATH_LEN);
+			msg_set_str_value(mms_attach, MSG_MMS_ATTACH_FILEPATH_STR, (char *)paths[i], strlen(paths[i]));
 		}
 	}
+
+	for (i=0; i < msg->attachment_count; i++)
+	{
+		_messages_intern_unref(paths[i]);
+	}
+	free(paths);
 	
 	ret = msg_set_mms_struct(msg->msg_h, mms_data);
 	if (MSG_SUCCESS != ret)
@@ -1508,6 +2436,9 @@ int _messages_save_mms_data(messages_message_s *msg)
 	
 	msg_release_struct(&mms_data);
 
+	msg->mms_built = complete;
+	msg->mms_store_id = _messages_store_id(store);
+
 	return MESSAGES_ERROR_NONE;
 }
 
@@ -1533,7 +2464,7 @@ int _messages_load_mms_data(messages_message_s *msg, msg_handle_t handle)
 	msg_struct_t mms_media;
 	msg_struct_t mms_attach;
 	
-	messages_attachment_s *attach;
+	GSList *text_files = NULL;
 
 	CHECK_NULL(msg);
 
@@ -1589,50 +2520,53 @@ int _messages_load_mms_data(messages_message_s *msg, msg_handle_t handle)
 		msg_get_list_handle(mms_page, MSG_MMS_PAGE_MEDIA_LIST_HND, (void **)&mms_media_list);		
 		for (j=0; j < msg_list_length(mms_media_list); j++)
 		{
-			mms_media = (msg_struct_t)msg_list_nth_data(mms_media_list, i);
+			mms_media = (msg_struct_t)msg_list_nth_data(mms_media_list, j);
 			if (NULL == mms_media)
 			{
 				continue;
 			}
 
-			attach = (messages_attachment_s *)calloc(1, sizeof(messages_attachment_s));
-			if (NULL == attach)
-			{
-				LOGW("[%s] OUT_OF_MEMORY(0x%08x) fail to create a 'attach'."
-					, __FUNCTION__, MESSAGES_ERROR_OUT_OF_MEMORY);
-				break;
-			}
-			
 			msg_get_int_value(mms_media, MSG_MMS_MEDIA_TYPE_INT, &media_type);
 			msg_get_str_value(mms_media, MSG_MMS_MEDIA_FILEPATH_STR, filepath, MAX_IMAGE_PATH_LEN);
 			
 			if (MMS_SMIL_MEDIA_TEXT == media_type)
 			{
-				_messages_load_textfile(filepath, &msg->text);
+				// The text of all pages is loaded at once below.
+				text_files = g_slist_append(text_files, strdup(filepath));
 			}
 			else
 			{
-				strncpy(attach->filepath, filepath, MAX_IMAGE_PATH_LEN);
 				switch (media_type)
 				{
 					case MMS_SMIL_MEDIA_IMG:
-						attach->media_type = MESSAGES_MEDIA_IMAGE;
+						media_type = MESSAGES_MEDIA_IMAGE;
 						break;
 					case MMS_SMIL_MEDIA_VIDEO:
-						attach->media_type = MESSAGES_MEDIA_VIDEO;
+						media_type = MESSAGES_MEDIA_VIDEO;
 						break;
 					case MMS_SMIL_MEDIA_AUDIO:
-						attach->media_type = MESSAGES_MEDIA_AUDIO;
+						media_type = MESSAGES_MEDIA_AUDIO;
 						break;
 					default:
-						attach->media_type = MESSAGES_MEDIA_UNKNOWN;
+						media_type = MESSAGES_MEDIA_UNKNOWN;
 				}
 
-				msg->attachment_list = g_slist_append(msg->attachment_list, attach);
+				if (MESSAGES_ERROR_NONE != _messages_append_attachment(msg, media_type, filepath))
+				{
+					LOGW("[%s] OUT_OF_MEMORY(0x%08x) fail to append an attachment."
+						, __FUNCTION__, MESSAGES_ERROR_OUT_OF_MEMORY);
+					break;
+				}
 			}
 		}
 	}
 
+	if (NULL != text_files)
+	{
+		_messages_load_textfiles(text_files, &msg->text);
+		g_slist_free_full(text_files, free);
+	}
+
 	// Load Attachments
 	msg_get_list_handle(mms_data, MSG_MMS_ATTACH_LIST_HND, (void **)&mms_attach_list);
 	for (i=0; i < msg_list_length(mms_attach_list); i++)
@@ -1643,16 +2577,13 @@ int _messages_load_mms_data(messages_message_s *msg, msg_handle_t handle)
 			continue;
 		}
 
-		attach = (messages_attachment_s *)calloc(1, sizeof(messages_attachment_s));
-		if (NULL == attach)
+		msg_get_str_value(mms_attach, MSG_MMS_ATTACH_FILEPATH_STR, filepath, MAX_IMAGE_PATH_LEN);
+		if (MESSAGES_ERROR_NONE != _messages_append_attachment(msg, MESSAGES_MEDIA_UNKNOWN, filepath))
 		{
-			LOGW("[%s] OUT_OF_MEMORY(0x%08x) fail to create a 'attach'."
+			LOGW("[%s] OUT_OF_MEMORY(0x%08x) fail to append an attachment."
 				, __FUNCTION__, MESSAGES_ERROR_OUT_OF_MEMORY);
 			break;
 		}
-		msg_get_str_value(mms_attach, MSG_MMS_ATTACH_FILEPATH_STR, filepath, MAX_IMAGE_PATH_LEN);
-		strncpy(attach->filepath, filepath, MAX_IMAGE_PATH_LEN);
-		attach->media_type = _messages_get_media_type_from_filepath(attach->filepath);
 	}
 
 	msg_release_struct(&new_msg_h);
@@ -1661,120 +2592,520 @@ int _messages_load_mms_data(messages_message_s *msg, msg_handle_t handle)
 	return MESSAGES_ERROR_NONE;
 }
 
-int _messages_save_textfile(const char *text, char **filepath)
+// Each body gets its own file, so concurrent sendings do not overwrite each other's text.
+int _messages_save_textfile(const char *spool_dir, const char *text, messages_spool_file_s **spool_file)
 {
-	FILE* file = NULL;
+	int fd;
+	int ret = MESSAGES_ERROR_NONE;
+	size_t len;
+	ssize_t written;
+	messages_spool_file_s *_spool_file;
 
 	CHECK_NULL(text);
 
-	*filepath = (char *)malloc(sizeof(char)*MSG_FILEPATH_LEN_MAX+1);
-	if (NULL == *filepath)
+	*spool_file = NULL;
+
+	_spool_file = (messages_spool_file_s *)calloc(1, sizeof(messages_spool_file_s) + MSG_FILEPATH_LEN_MAX);
+	if (NULL == _spool_file)
 	{
-		LOGE("[%s:%d] OUT_OF_MEMORY(0x%08x) fail to create a '*filepath'."
+		LOGE("[%s:%d] OUT_OF_MEMORY(0x%08x) fail to create a 'spool_file'."
 			, __FUNCTION__, __LINE__, MESSAGES_ERROR_OUT_OF_MEMORY);
 		return MESSAGES_ERROR_OUT_OF_MEMORY;
 	}
+	_spool_file->ref = 1;
 
-	snprintf(*filepath, MSG_FILEPATH_LEN_MAX+1, "/tmp/.capi_messages_text_%d.txt", getpid());
+	snprintf(_spool_file->path, MSG_FILEPATH_LEN_MAX+1, "%s/.capi_messages_text_XXXXXX.txt",
+		(NULL != spool_dir) ? spool_dir : MESSAGES_DEFAULT_SPOOL_DIR);
 
-	file = fopen(*filepath, "w");
-	if (file != NULL)
-	{
-		 fputs(text, file);
-		 fclose(file);
-	}
-	else
+	// A new file with a unique name, so nothing planted in a shared spool directory such as /tmp is followed or truncated.
+	// It is opened for reading to msg-service, which runs as another user.
+	fd = mkstemps(_spool_file->path, strlen(".txt"));
+	if (fd < 0 || 0 != fchmod(fd, 0644))
 	{
 	   	LOGE("[%s:%d] OPERATION_FAILED(0x%08x) : opening file for text of message failed.", 
 	   		__FUNCTION__, __LINE__, MESSAGES_ERROR_OPERATION_FAILED);
+		if (fd >= 0)
+		{
+			close(fd);
+			unlink(_spool_file->path);
+		}
+		free(_spool_file);
+		return MESSAGES_ERROR_OPERATION_FAILED;
+	}
+
+	for (len = strlen(text); len > 0; text += written, len -= written)
+	{
+		written = write(fd, text, len);
+		if (written < 0)
+		{
+			if (EINTR == errno)
+			{
+				written = 0;
+				continue;
+			}
+			ret = MESSAGES_ERROR_OPERATION_FAILED;
+			break;
+		}
+	}
+
+	// A short body must not be sent as if it were the whole text.
+	if (0 != close(fd) || MESSAGES_ERROR_NONE != ret)
+	{
+		LOGE("[%s:%d] OPERATION_FAILED(0x%08x) : writing file for text of message failed, errno = %d.",
+			__FUNCTION__, __LINE__, MESSAGES_ERROR_OPERATION_FAILED, errno);
+		unlink(_spool_file->path);
+		free(_spool_file);
 		return MESSAGES_ERROR_OPERATION_FAILED;
 	}
 
+	*spool_file = _spool_file;
+
 	return MESSAGES_ERROR_NONE;
 }
 
-int _messages_load_textfile(const char *filepath, char **text)
+messages_spool_file_s *_messages_spool_file_ref(messages_spool_file_s *file)
 {
-	FILE *file = NULL;
-	char buf[1024];
-	struct stat st;
-	size_t nread, len;
+	if (NULL != file)
+	{
+		g_atomic_int_inc(&file->ref);
+	}
+
+	return file;
+}
+
+// The file is removed with the last reference, unless a pending request left it to msg-service.
+void _messages_spool_file_unref(messages_spool_file_s *file)
+{
+	if (NULL != file && g_atomic_int_dec_and_test(&file->ref))
+	{
+		if (!file->keep)
+		{
+			unlink(file->path);
+		}
+		free(file);
+	}
+}
+
+void _messages_release_text_file(messages_message_s *msg)
+{
+	_messages_spool_file_unref(msg->text_file);
+	msg->text_file = NULL;
+}
+
+typedef struct {
+	int          fd;
+	size_t       len;		/* size when the file was opened */
+} messages_text_file_s;
+
+// Sizes the text files of all pages first, so the text is read once into a buffer of its final size.
+// The files belong to msg-service and may change meanwhile, so they are read with pread() rather than
+// mapped: a file which got shorter ends its page early instead of faulting.
+int _messages_load_textfiles(GSList *filepaths, char **text)
+{
+	int i;
+	int count;
+	int ret = MESSAGES_ERROR_NONE;
+	size_t len = 0;
+	size_t done;
+	ssize_t read_len;
 	char *pos;
+	struct stat st;
+	GSList *iter;
+	messages_text_file_s *files;
 
-	CHECK_NULL(filepath);
+	CHECK_NULL(text);
 
-	file = fopen(filepath, "r");
+	count = g_slist_length(filepaths);
+	files = (messages_text_file_s *)calloc(count, sizeof(messages_text_file_s));
+	if (NULL == files)
+	{
+		LOGE("[%s:%d] OUT_OF_MEMORY(0x%08x) fail to create a 'files'."
+			, __FUNCTION__, __LINE__, MESSAGES_ERROR_OUT_OF_MEMORY);
+		return MESSAGES_ERROR_OUT_OF_MEMORY;
+	}
 
-	if (NULL == file)
+	if (NULL != *text)
 	{
-		LOGE("[%s:%d] OPERATION_FAILED(0x%08x) : opening file for text of message failed.", 
-			__FUNCTION__, __LINE__, MESSAGES_ERROR_OPERATION_FAILED);
-		return MESSAGES_ERROR_OPERATION_FAILED;
+		len = strlen(*text);
 	}
 
-	fstat(fileno(file), &st);
+	for (i=0, iter = filepaths; iter; i++, iter = g_slist_next(iter))
+	{
+		files[i].fd = open((const char *)iter->data, O_RDONLY);
+		if (files[i].fd < 0)
+		{
+			LOGE("[%s:%d] OPERATION_FAILED(0x%08x) : opening file for text of message failed.", 
+				__FUNCTION__, __LINE__, MESSAGES_ERROR_OPERATION_FAILED);
+			ret = MESSAGES_ERROR_OPERATION_FAILED;
+			continue;
+		}
+
+		if (0 == fstat(files[i].fd, &st) && 0 < st.st_size)
+		{
+			files[i].len = st.st_size;
+		}
+
+		len += files[i].len + 1;	// and a line break between pages
+	}
 
-	if (NULL == *text)
+	pos = (char *)realloc(*text, len + 1);
+	if (NULL == pos)
 	{
-		*text = (char*)calloc(1, st.st_size + 1);
-		pos = *text;
+		LOGE("[%s:%d] OUT_OF_MEMORY(0x%08x) fail to create a '*text'."
+			, __FUNCTION__, __LINE__, MESSAGES_ERROR_OUT_OF_MEMORY);
+		ret = MESSAGES_ERROR_OUT_OF_MEMORY;
 	}
 	else
 	{
-		len = strlen(*text);
-		(*text)[len] = '\n';
-		*text = (char*)realloc(*text, len + st.st_size + 1);
-		pos = *text + len;
+		if (NULL == *text)
+		{
+			pos[0] = '\0';
+		}
+		*text = pos;
+		pos += strlen(pos);
+
+		for (i=0; i < count; i++)
+		{
+			if (files[i].fd < 0 || 0 == files[i].len)
+			{
+				continue;
+			}
+			if (pos != *text)
+			{
+				*pos++ = '\n';
+			}
+
+			// Whatever was appended since the file was sized is left out.
+			for (done=0; done < files[i].len; done += read_len)
+			{
+				read_len = pread(files[i].fd, pos + done, files[i].len - done, done);
+				if (read_len < 0 && EINTR == errno)
+				{
+					read_len = 0;
+					continue;
+				}
+				if (read_len <= 0)
+				{
+					break;
+				}
+			}
+			if (read_len < 0)
+			{
+				ret = MESSAGES_ERROR_OPERATION_FAILED;
+			}
+			pos += done;
+		}
+		*pos = '\0';
 	}
 
-	while(0 < (nread = fread(buf, 1, 1024, file)))
+	for (i=0; i < count; i++)
 	{
-		memcpy(pos, buf, nread);
-		pos += nread;
+		if (files[i].fd >= 0)
+		{
+			close(files[i].fd);
+		}
 	}
-	pos[0] = '\0';
+	free(files);
 
-	return 0;
+	return ret;
 }
 
-int _messages_get_media_type_from_filepath(const char *filepath)
+int _messages_copy_msg_struct(msg_struct_t src, msg_struct_t *dst)
+{
+	int i;
+	int ret;
+	int value;
+	bool flag;
+	char *buf;
+
+	msg_struct_t new_msg_h;
+	msg_struct_t mms_data;
+	msg_struct_list_s *src_addr_list = NULL;
+	msg_struct_list_s *dst_addr_list = NULL;
+
+	static const int int_fields[] = {
+		MSG_MESSAGE_ID_INT, MSG_MESSAGE_THREAD_ID_INT, MSG_MESSAGE_FOLDER_ID_INT,
+		MSG_MESSAGE_TYPE_INT, MSG_MESSAGE_STORAGE_ID_INT, MSG_MESSAGE_DISPLAY_TIME_INT,
+		MSG_MESSAGE_NETWORK_STATUS_INT, MSG_MESSAGE_ENCODE_TYPE_INT, MSG_MESSAGE_PRIORITY_INT,
+		MSG_MESSAGE_DIRECTION_INT, MSG_MESSAGE_DEST_PORT_INT, MSG_MESSAGE_SRC_PORT_INT,
+	};
+	static const int bool_fields[] = {
+		MSG_MESSAGE_READ_BOOL, MSG_MESSAGE_PROTECTED_BOOL, MSG_MESSAGE_BACKUP_BOOL,
+		MSG_MESSAGE_PORT_VALID_BOOL,
+	};
+
+	CHECK_NULL(src);
+	CHECK_NULL(dst);
+
+	new_msg_h = msg_create_struct(MSG_STRUCT_MESSAGE_INFO);
+	if (NULL == new_msg_h)
+	{
+		LOGE("[%s] OUT_OF_MEMORY(0x%08x) fail to create 'new_msg_h'."
+			, __FUNCTION__, MESSAGES_ERROR_OUT_OF_MEMORY);
+		return MESSAGES_ERROR_OUT_OF_MEMORY;
+	}
+
+	buf = (char*)malloc(MAX_MSG_TEXT_LEN + 1);
+	if (NULL == buf)
+	{
+		LOGE("[%s] OUT_OF_MEMORY(0x%08x) fail to create 'buf'."
+			, __FUNCTION__, MESSAGES_ERROR_OUT_OF_MEMORY);
+		msg_release_struct(&new_msg_h);
+		return MESSAGES_ERROR_OUT_OF_MEMORY;
+	}
+
+	for (i=0; i < sizeof(int_fields)/sizeof(int_fields[0]); i++)
+	{
+		if (MSG_SUCCESS == msg_get_int_value(src, int_fields[i], &value))
+		{
+			msg_set_int_value(new_msg_h, int_fields[i], value);
+		}
+	}
+
+	for (i=0; i < sizeof(bool_fields)/sizeof(bool_fields[0]); i++)
+	{
+		if (MSG_SUCCESS == msg_get_bool_value(src, bool_fields[i], &flag))
+		{
+			msg_set_bool_value(new_msg_h, bool_fields[i], flag);
+		}
+	}
+
+	memset(buf, 0, MAX_MSG_TEXT_LEN + 1);
+	if (MSG_SUCCESS == msg_get_str_value(src, MSG_MESSAGE_SUBJECT_STR, buf, MAX_SUBJECT_LEN))
+	{
+		msg_set_str_value(new_msg_h, MSG_MESSAGE_SUBJECT_STR, buf, strlen(buf));
+	}
+
+	memset(buf, 0, MAX_MSG_TEXT_LEN + 1);
+	if (MSG_SUCCESS == msg_get_str_value(src, MSG_MESSAGE_SMS_DATA_STR, buf, MAX_MSG_TEXT_LEN))
+	{
+		msg_set_str_value(new_msg_h, MSG_MESSAGE_SMS_DATA_STR, buf, strlen(buf));
+	}
+
+	// Addresses
+	ret = msg_get_list_handle(src, MSG_MESSAGE_ADDR_LIST_STRUCT, (void **)&src_addr_list);
+	if (MSG_SUCCESS == ret)
+	{
+		ret = msg_get_list_handle(new_msg_h, MSG_MESSAGE_ADDR_LIST_STRUCT, (void **)&dst_addr_list);
+	}
+	if (MSG_SUCCESS != ret)
+	{
+		free(buf);
+		msg_release_struct(&new_msg_h);
+		return ERROR_CONVERT(ret);
+	}
+
+	for (i=0; i < src_addr_list->nCount; i++)
+	{
+		msg_struct_t src_addr = src_addr_list->msg_struct_info[i];
+		msg_struct_t dst_addr = dst_addr_list->msg_struct_info[i];
+
+		if (MSG_SUCCESS == msg_get_int_value(src_addr, MSG_ADDRESS_INFO_ADDRESS_TYPE_INT, &value))
+		{
+			msg_set_int_value(dst_addr, MSG_ADDRESS_INFO_ADDRESS_TYPE_INT, value);
+		}
+		if (MSG_SUCCESS == msg_get_int_value(src_addr, MSG_ADDRESS_INFO_RECIPIENT_TYPE_INT, &value))
+		{
+			msg_set_int_value(dst_addr, MSG_ADDRESS_INFO_RECIPIENT_TYPE_INT, value);
+		}
+
+		memset(buf, 0, MAX_ADDRESS_VAL_LEN + 1);
+		msg_get_str_value(src_addr, MSG_ADDRESS_INFO_ADDRESS_VALUE_STR, buf, MAX_ADDRESS_VAL_LEN);
+		msg_set_str_value(dst_addr, MSG_ADDRESS_INFO_ADDRESS_VALUE_STR, buf, strlen(buf));
+	}
+	dst_addr_list->nCount = src_addr_list->nCount;
+
+	free(buf);
+
+	// MMS body, if one was already built
+	if (MSG_SUCCESS == msg_get_int_value(src, MSG_MESSAGE_TYPE_INT, &value) && MSG_TYPE_MMS == value)
+	{
+		mms_data = msg_create_struct(MSG_STRUCT_MMS);
+		if (NULL != mms_data)
+		{
+			if (MSG_SUCCESS == msg_get_mms_struct(src, mms_data))
+			{
+				msg_set_mms_struct(new_msg_h, mms_data);
+			}
+			msg_release_struct(&mms_data);
+		}
+	}
+
+	*dst = new_msg_h;
+
+	return MESSAGES_ERROR_NONE;
+}
+
+int _messages_detach_msg_h(messages_message_s *msg)
 {
-	int len;
 	int ret;
-	char *file_ext;
+	msg_struct_t new_msg_h;
+
+	CHECK_NULL(msg);
+
+	if (NULL == msg->msg_h_ref)
+	{
+		return MESSAGES_ERROR_NONE;
+	}
+
+	if (1 == g_atomic_int_get(msg->msg_h_ref))
+	{
+		free(msg->msg_h_ref);
+		msg->msg_h_ref = NULL;
+		return MESSAGES_ERROR_NONE;
+	}
+
+	ret = _messages_copy_msg_struct(msg->msg_h, &new_msg_h);
+	if (MESSAGES_ERROR_NONE != ret)
+	{
+		return ret;
+	}
+
+	// The other owners may have gone away while copying.
+	if (g_atomic_int_dec_and_test(msg->msg_h_ref))
+	{
+		msg_release_struct(&msg->msg_h);
+		free(msg->msg_h_ref);
+	}
+
+	msg->msg_h = new_msg_h;
+	msg->msg_h_ref = NULL;
+
+	return MESSAGES_ERROR_NONE;
+}
+
+int _messages_detach_attachments(messages_message_s *msg)
+{
+	int i;
+	messages_attachment_s *attachments;
+
+	CHECK_NULL(msg);
+
+	if (NULL == msg->attachment_ref)
+	{
+		return MESSAGES_ERROR_NONE;
+	}
+
+	if (1 == g_atomic_int_get(msg->attachment_ref))
+	{
+		free(msg->attachment_ref);
+		msg->attachment_ref = NULL;
+		return MESSAGES_ERROR_NONE;
+	}
+
+	attachments = (messages_attachment_s *)malloc(sizeof(messages_attachment_s) * msg->attachment_size);
+	if (NULL == attachments)
+	{
+		LOGE("[%s] OUT_OF_MEMORY(0x%08x) fail to create 'attachments'."
+			, __FUNCTION__, MESSAGES_ERROR_OUT_OF_MEMORY);
+		return MESSAGES_ERROR_OUT_OF_MEMORY;
+	}
+
+	// The paths are interned, so copying them only takes another reference.
+	for (i=0; i < msg->attachment_count; i++)
+	{
+		attachments[i].media_type = msg->attachments[i].media_type;
+		attachments[i].filepath = _messages_intern_ref(msg->attachments[i].filepath);
+	}
+
+	i = msg->attachment_count;
+	_messages_release_attachments(msg);
+	msg->attachments = attachments;
+	msg->attachment_count = i;
+	msg->attachment_size = i;
+
+	return MESSAGES_ERROR_NONE;
+}
+
+int _messages_append_attachment(messages_message_s *msg, int media_type, const char *path)
+{
+	int size;
+	const char *filepath;
+	messages_attachment_s *attachments;
+
+	if (msg->attachment_count == msg->attachment_size)
+	{
+		size = (0 == msg->attachment_size) ? 4 : msg->attachment_size * 2;
+		attachments = (messages_attachment_s *)realloc(msg->attachments, sizeof(messages_attachment_s) * size);
+		if (NULL == attachments)
+		{
+			LOGE("[%s] OUT_OF_MEMORY(0x%08x) fail to grow 'attachments'."
+				, __FUNCTION__, MESSAGES_ERROR_OUT_OF_MEMORY);
+			return MESSAGES_ERROR_OUT_OF_MEMORY;
+		}
+		msg->attachments = attachments;
+		msg->attachment_size = size;
+	}
 
+	filepath = _messages_intern_path(path);
 	if (NULL == filepath)
 	{
-		return MESSAGES_MEDIA_UNKNOWN;
+		return MESSAGES_ERROR_OUT_OF_MEMORY;
 	}
-	// check the length of filepath
-	len = strlen(filepath);
-	if (len < 5) 
+
+	if (MESSAGES_MEDIA_UNKNOWN == media_type)
 	{
-		return MESSAGES_MEDIA_UNKNOWN;
+		media_type = _messages_intern_media_type(filepath);
 	}
 
-	// check extension of file
-	file_ext = (char *)&filepath[len - 4];
+	msg->attachments[msg->attachment_count].media_type = media_type;
+	msg->attachments[msg->attachment_count].filepath = filepath;
+	msg->attachment_count++;
 
-	if(strncmp(file_ext,".jpg",4) !=0 && strncmp(file_ext,".gif",4) !=0 
-				&& strncmp(file_ext,".bmp",4) !=0 && strncmp(file_ext,".png",4) !=0)
+	return MESSAGES_ERROR_NONE;
+}
+
+void _messages_release_text(messages_message_s *msg)
+{
+	if (NULL == msg->text_ref || g_atomic_int_dec_and_test(msg->text_ref))
 	{
-		ret = MESSAGES_MEDIA_IMAGE;
+		free(msg->text);
+		free(msg->text_ref);
 	}
-	else if(strncmp(file_ext,".mp4",4) !=0 && strncmp(file_ext,".3gp",4) !=0)
+
+	msg->text = NULL;
+	msg->text_ref = NULL;
+}
+
+void _messages_release_attachments(messages_message_s *msg)
+{
+	int i;
+
+	if (NULL == msg->attachment_ref || g_atomic_int_dec_and_test(msg->attachment_ref))
 	{
-		ret = MESSAGES_MEDIA_VIDEO;
+		for (i=0; i < msg->attachment_count; i++)
+		{
+			_messages_intern_unref(msg->attachments[i].filepath);
+		}
+		free(msg->attachments);
+		free(msg->attachment_ref);
 	}
-	else if(strncmp(file_ext,".mid",4) !=0 && strncmp(file_ext,".aac",4) !=0 && strncmp(file_ext,".amr",4) !=0)
+
+	msg->attachments = NULL;
+	msg->attachment_count = 0;
+	msg->attachment_size = 0;
+	msg->attachment_ref = NULL;
+}
+
+int _messages_release_msg_h(messages_message_s *msg)
+{
+	int ret = MSG_SUCCESS;
+
+	if (msg->msg_h_borrowed)
 	{
-		ret = MESSAGES_MEDIA_AUDIO;
+		msg->msg_h = NULL;
+		return MSG_SUCCESS;
 	}
-	else
+
+	if (NULL == msg->msg_h_ref || g_atomic_int_dec_and_test(msg->msg_h_ref))
 	{
-		ret = MESSAGES_MEDIA_UNKNOWN;
+		ret = msg_release_struct(&msg->msg_h);
+		free(msg->msg_h_ref);
 	}
 
+	msg->msg_h = NULL;
+	msg->msg_h_ref = NULL;
+
 	return ret;
 }
 
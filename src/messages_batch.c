@@ -0,0 +1,248 @@
+/*
+ * Copyright (c) 2011 Samsung Electronics Co., Ltd All Rights Reserved
+ *
+ * Licensed under the Apache License, Version 2.0 (the License);
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an AS IS BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License. 
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <memory.h>
+
+#include <glib.h>
+
+#include <dlog.h>
+#include <msg.h>
+
+#include <messages.h>
+#include <messages_types.h>
+#include <messages_private.h>
+
+/*
+ * Batched incoming delivery.
+ * Incoming messages are gathered until the batch is full or the oldest one has waited
+ * for the batch delay, then handed to the batch callback together.
+ */
+
+static void _messages_incoming_batch_deliver(messages_incoming_batch_cb cb, void *user_data, messages_message_h *msgs, int count)
+{
+	int i;
+
+	if (NULL != cb && 0 < count)
+	{
+		cb(msgs, count, user_data);
+	}
+
+	for (i=0; i < count; i++)
+	{
+		messages_destroy_message(msgs[i]);
+	}
+	free(msgs);
+}
+
+// Takes the gathered messages, the batch lock must be held.
+static messages_message_h *_messages_incoming_batch_take(messages_incoming_batch_s *batch, int *count)
+{
+	messages_message_h *msgs = batch->msgs;
+
+	*count = batch->count;
+	batch->msgs = NULL;
+	batch->count = 0;
+
+	if (0 != batch->timer_id)
+	{
+		g_source_remove(batch->timer_id);
+		batch->timer_id = 0;
+	}
+
+	return msgs;
+}
+
+static gboolean _messages_incoming_batch_timer_cb(gpointer user_data)
+{
+	int count;
+	void *cb_data;
+	messages_message_h *msgs;
+	messages_incoming_batch_cb cb;
+	messages_incoming_batch_s *batch = &((messages_service_s *)user_data)->incoming_batch;
+
+	g_mutex_lock(&batch->lock);
+
+	// The batch was taken while this tick waited for the lock, and may already belong to a newer timer.
+	if (batch->timer_id != g_source_get_id(g_main_current_source()))
+	{
+		g_mutex_unlock(&batch->lock);
+		return FALSE;
+	}
+
+	batch->timer_id = 0;
+	msgs = _messages_incoming_batch_take(batch, &count);
+	cb = (messages_incoming_batch_cb)batch->cb;
+	cb_data = batch->user_data;
+	g_mutex_unlock(&batch->lock);
+
+	_messages_incoming_batch_deliver(cb, cb_data, msgs, count);
+
+	return FALSE;
+}
+
+// Returns true if msg was taken into the batch.
+bool _messages_incoming_batch_add(messages_service_s *svc, messages_message_s *msg)
+{
+	int count = 0;
+	void *cb_data = NULL;
+	msg_struct_t msg_h;
+	messages_message_h *msgs = NULL;
+	messages_incoming_batch_cb cb = NULL;
+	messages_incoming_batch_s *batch = &svc->incoming_batch;
+
+	if (NULL == g_atomic_pointer_get(&batch->cb))
+	{
+		return false;
+	}
+
+	// The message outlives the msg-service callback, so a borrowed msg_h is copied.
+	if (msg->msg_h_borrowed)
+	{
+		if (MESSAGES_ERROR_NONE != _messages_copy_msg_struct(msg->msg_h, &msg_h))
+		{
+			LOGE("[%s] OUT_OF_MEMORY(0x%08x) fail to copy an incoming message, it is not batched."
+				, __FUNCTION__, MESSAGES_ERROR_OUT_OF_MEMORY);
+			return false;
+		}
+		msg->msg_h = msg_h;
+		msg->msg_h_borrowed = false;
+	}
+
+	g_mutex_lock(&batch->lock);
+
+	if (NULL == batch->cb)
+	{
+		g_mutex_unlock(&batch->lock);
+		return false;
+	}
+
+	if (NULL == batch->msgs)
+	{
+		batch->msgs = (messages_message_h *)malloc(sizeof(messages_message_h) * batch->max_count);
+		if (NULL == batch->msgs)
+		{
+			g_mutex_unlock(&batch->lock);
+			LOGE("[%s] OUT_OF_MEMORY(0x%08x) fail to create a batch."
+				, __FUNCTION__, MESSAGES_ERROR_OUT_OF_MEMORY);
+			return false;
+		}
+	}
+
+	batch->msgs[batch->count++] = (messages_message_h)msg;
+
+	if (batch->count == batch->max_count)
+	{
+		msgs = _messages_incoming_batch_take(batch, &count);
+		cb = (messages_incoming_batch_cb)batch->cb;
+		cb_data = batch->user_data;
+	}
+	else if (0 == batch->timer_id)
+	{
+		// The source keeps the service alive until a tick blocked on the lock returns.
+		batch->timer_id = g_timeout_add_full(G_PRIORITY_DEFAULT, batch->max_delay,
+				_messages_incoming_batch_timer_cb, _messages_service_ref(svc), _messages_service_unref);
+	}
+
+	g_mutex_unlock(&batch->lock);
+
+	_messages_incoming_batch_deliver(cb, cb_data, msgs, count);
+
+	return true;
+}
+
+// Hands the gathered messages to the callback at once.
+void _messages_incoming_batch_flush(messages_service_s *svc)
+{
+	int count;
+	void *cb_data;
+	messages_message_h *msgs;
+	messages_incoming_batch_cb cb;
+	messages_incoming_batch_s *batch = &svc->incoming_batch;
+
+	g_mutex_lock(&batch->lock);
+	msgs = _messages_incoming_batch_take(batch, &count);
+	cb = (messages_incoming_batch_cb)batch->cb;
+	cb_data = batch->user_data;
+	g_mutex_unlock(&batch->lock);
+
+	_messages_incoming_batch_deliver(cb, cb_data, msgs, count);
+}
+
+int messages_set_message_incoming_batch_cb(messages_service_h service, int max_count, int max_delay,
+										messages_incoming_batch_cb callback, void *user_data)
+{
+	int ret;
+	int count;
+	void *cb_data;
+	messages_message_h *msgs;
+	messages_incoming_batch_cb cb;
+
+	messages_service_s *_svc = (messages_service_s*)service;
+
+	CHECK_NULL(_svc);
+	CHECK_NULL(callback);
+
+	if (max_count < 1 || MESSAGES_INCOMING_BATCH_MAX_COUNT < max_count
+		|| max_delay < 1 || MESSAGES_INCOMING_BATCH_MAX_DELAY < max_delay)
+	{
+		LOGE("[%s] INVALID_PARAMETER(0x%08x) : max_count or max_delay is out of range."
+			, __FUNCTION__, MESSAGES_ERROR_INVALID_PARAMETER);
+		return MESSAGES_ERROR_INVALID_PARAMETER;
+	}
+
+	ret = _messages_register_incoming_mediator(_svc);
+	if (MESSAGES_ERROR_NONE != ret)
+	{
+		return ret;
+	}
+
+	// Messages gathered for the previous setting go out with it.
+	g_mutex_lock(&_svc->incoming_batch.lock);
+	msgs = _messages_incoming_batch_take(&_svc->incoming_batch, &count);
+	cb = (messages_incoming_batch_cb)_svc->incoming_batch.cb;
+	cb_data = _svc->incoming_batch.user_data;
+
+	_svc->incoming_batch.max_count = max_count;
+	_svc->incoming_batch.max_delay = max_delay;
+	_svc->incoming_batch.user_data = user_data;
+	g_atomic_pointer_set(&_svc->incoming_batch.cb, (gpointer)callback);
+	g_mutex_unlock(&_svc->incoming_batch.lock);
+
+	_messages_incoming_batch_deliver(cb, cb_data, msgs, count);
+
+	return MESSAGES_ERROR_NONE;
+}
+
+int messages_unset_message_incoming_batch_cb(messages_service_h service)
+{
+	int count;
+	messages_message_h *msgs;
+
+	messages_service_s *_svc = (messages_service_s*)service;
+
+	CHECK_NULL(_svc);
+
+	g_mutex_lock(&_svc->incoming_batch.lock);
+	msgs = _messages_incoming_batch_take(&_svc->incoming_batch, &count);
+	g_atomic_pointer_set(&_svc->incoming_batch.cb, NULL);
+	g_mutex_unlock(&_svc->incoming_batch.lock);
+
+	_messages_incoming_batch_deliver(NULL, NULL, msgs, count);
+
+	return MESSAGES_ERROR_NONE;
+}
@@ -0,0 +1,318 @@
+/*
+ * Copyright (c) 2011 Samsung Electronics Co., Ltd All Rights Reserved
+ *
+ * Licensed under the Apache License, Version 2.0 (the License);
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an AS IS BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License. 
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <memory.h>
+
+#include <glib.h>
+
+#include <dlog.h>
+#include <msg.h>
+
+#include <messages.h>
+#include <messages_types.h>
+#include <messages_private.h>
+
+/*
+ * Duplicate send suppression.
+ * A message is identified by a hash of its recipients and content. The recipients are combined
+ * so that their order does not matter. Recent keys are kept in a small fixed table; when every
+ * probed slot is live the oldest one is replaced, so a flood of distinct messages can only make
+ * the suppression forget, never grow.
+ *
+ * Incoming duplicates are keyed by the sender, the body and the SMSC time stamp, and kept the same
+ * way in a larger table. The full 64-bit keys are compared, so a distinct message is only taken as a
+ * duplicate on a hash collision. Dropping real messages costs more than delivering a copy, so when
+ * the table is full the oldest key is forgotten early rather than sharing a slot.
+ */
+
+guint64 _messages_dedup_key(messages_message_s *msg, messages_message_type_e type)
+{
+	int i;
+	char address[MAX_ADDRESS_VAL_LEN + 1];
+	char text[MAX_MSG_TEXT_LEN + 1];
+	char subject[MAX_SUBJECT_LEN + 1];
+	guint64 recipients = 0;
+	guint64 key = MESSAGES_HASH_INIT;
+	msg_struct_list_s *addr_list = NULL;
+
+	if (MSG_SUCCESS == msg_get_list_handle(msg->msg_h, MSG_MESSAGE_ADDR_LIST_STRUCT, (void **)&addr_list))
+	{
+		for (i=0; i < addr_list->nCount; i++)
+		{
+			memset(address, 0, sizeof(address));
+			msg_get_str_value(addr_list->msg_struct_info[i], MSG_ADDRESS_INFO_ADDRESS_VALUE_STR, address, MAX_ADDRESS_VAL_LEN);
+			recipients += _messages_hash_address(MESSAGES_HASH_INIT, address);
+		}
+	}
+	key = _messages_hash_bytes(key, &recipients, sizeof(recipients));
+	key = _messages_hash_bytes(key, &type, sizeof(type));
+
+	if (MESSAGES_TYPE_SMS == type)
+	{
+		memset(text, 0, sizeof(text));
+		msg_get_str_value(msg->msg_h, MSG_MESSAGE_SMS_DATA_STR, text, MAX_MSG_TEXT_LEN);
+		key = _messages_hash_bytes(key, text, strlen(text));
+	}
+	else
+	{
+		memset(subject, 0, sizeof(subject));
+		msg_get_str_value(msg->msg_h, MSG_MESSAGE_SUBJECT_STR, subject, MAX_SUBJECT_LEN);
+		key = _messages_hash_bytes(key, subject, strlen(subject) + 1);
+
+		if (NULL != msg->text)
+		{
+			key = _messages_hash_bytes(key, msg->text, strlen(msg->text) + 1);
+		}
+
+		for (i=0; i < msg->attachment_count; i++)
+		{
+			key = _messages_hash_bytes(key, msg->attachments[i].filepath, strlen(msg->attachments[i].filepath) + 1);
+		}
+	}
+
+	return key ? key : 1;
+}
+
+bool _messages_dedup_check(messages_service_s *svc, guint64 key)
+{
+	int i;
+	gint64 now;
+	messages_dedup_entry_s *entry;
+	messages_dedup_entry_s *victim = NULL;
+
+	g_mutex_lock(&svc->dedup_lock);
+
+	now = g_get_monotonic_time();
+
+	for (i=0; i < MESSAGES_DEDUP_PROBE; i++)
+	{
+		entry = &svc->dedup[(key + i) % MESSAGES_DEDUP_SLOT_COUNT];
+
+		if (entry->key == key && entry->expires > now)
+		{
+			g_mutex_unlock(&svc->dedup_lock);
+			return true;
+		}
+
+		if (NULL == victim || entry->expires < victim->expires)
+		{
+			victim = entry;
+		}
+	}
+
+	victim->key = key;
+	victim->expires = now + (gint64)svc->dedup_window * G_USEC_PER_SEC;
+
+	g_mutex_unlock(&svc->dedup_lock);
+
+	return false;
+}
+
+void _messages_dedup_forget(messages_service_s *svc, guint64 key)
+{
+	int i;
+	messages_dedup_entry_s *entry;
+
+	g_mutex_lock(&svc->dedup_lock);
+
+	for (i=0; i < MESSAGES_DEDUP_PROBE; i++)
+	{
+		entry = &svc->dedup[(key + i) % MESSAGES_DEDUP_SLOT_COUNT];
+		if (entry->key == key)
+		{
+			entry->key = 0;
+			entry->expires = 0;
+		}
+	}
+
+	g_mutex_unlock(&svc->dedup_lock);
+}
+
+int messages_set_duplicate_window(messages_service_h service, int window)
+{
+	messages_service_s *_svc = (messages_service_s*)service;
+
+	CHECK_NULL(_svc);
+
+	if (window < 0)
+	{
+		LOGE("[%s] INVALID_PARAMETER(0x%08x) : window should not be negative."
+			, __FUNCTION__, MESSAGES_ERROR_INVALID_PARAMETER);
+		return MESSAGES_ERROR_INVALID_PARAMETER;
+	}
+
+	g_mutex_lock(&_svc->dedup_lock);
+	_svc->dedup_window = window;
+	memset(_svc->dedup, 0, sizeof(_svc->dedup));
+	g_mutex_unlock(&_svc->dedup_lock);
+
+	return MESSAGES_ERROR_NONE;
+}
+
+static guint64 _messages_incoming_dedup_key(msg_struct_t msg)
+{
+	int type = 0;
+	int size = 0;
+	int display_time = 0;
+	char address[MAX_ADDRESS_VAL_LEN + 1];
+	char text[MAX_MSG_TEXT_LEN + 1];
+	guint64 key = MESSAGES_HASH_INIT;
+	msg_struct_list_s *addr_list = NULL;
+
+	if (MSG_SUCCESS == msg_get_list_handle(msg, MSG_MESSAGE_ADDR_LIST_STRUCT, (void **)&addr_list)
+		&& NULL != addr_list && 0 < addr_list->nCount)
+	{
+		memset(address, 0, sizeof(address));
+		msg_get_str_value(addr_list->msg_struct_info[0], MSG_ADDRESS_INFO_ADDRESS_VALUE_STR, address, MAX_ADDRESS_VAL_LEN);
+		key = _messages_hash_address(key, address);
+	}
+
+	msg_get_int_value(msg, MSG_MESSAGE_TYPE_INT, &type);
+	msg_get_int_value(msg, MSG_MESSAGE_DISPLAY_TIME_INT, &display_time);
+	key = _messages_hash_bytes(key, &type, sizeof(type));
+	key = _messages_hash_bytes(key, &display_time, sizeof(display_time));
+
+	// The MMS body is not loaded yet, its subject and size stand for it.
+	memset(text, 0, sizeof(text));
+	if (MSG_SUCCESS == msg_get_str_value(msg, MSG_MESSAGE_SMS_DATA_STR, text, MAX_MSG_TEXT_LEN) && '\0' != text[0])
+	{
+		key = _messages_hash_bytes(key, text, strlen(text));
+	}
+	else
+	{
+		memset(text, 0, sizeof(text));
+		msg_get_str_value(msg, MSG_MESSAGE_SUBJECT_STR, text, MAX_SUBJECT_LEN);
+		msg_get_int_value(msg, MSG_MESSAGE_DATA_SIZE_INT, &size);
+		key = _messages_hash_bytes(key, text, strlen(text) + 1);
+		key = _messages_hash_bytes(key, &size, sizeof(size));
+	}
+
+	return key;
+}
+
+bool _messages_incoming_dedup_check(messages_service_s *svc, msg_struct_t msg, bool *drop)
+{
+	int i;
+	gint64 now;
+	guint64 key;
+	bool duplicate = false;
+	messages_dedup_entry_s *entry;
+	messages_dedup_entry_s *victim = NULL;
+	messages_incoming_dedup_s *dedup;
+
+	*drop = false;
+
+	if (NULL == g_atomic_pointer_get(&svc->incoming_dedup))
+	{
+		return false;
+	}
+
+	key = _messages_incoming_dedup_key(msg);
+	key = key ? key : 1;
+
+	g_mutex_lock(&svc->incoming_dedup_lock);
+
+	dedup = svc->incoming_dedup;
+	if (NULL == dedup)
+	{
+		g_mutex_unlock(&svc->incoming_dedup_lock);
+		return false;
+	}
+
+	now = g_get_monotonic_time();
+
+	for (i=0; i < MESSAGES_INCOMING_DEDUP_PROBE; i++)
+	{
+		entry = &dedup->slots[(key + i) & (MESSAGES_INCOMING_DEDUP_SLOT_COUNT - 1)];
+
+		if (entry->key == key && entry->expires > now)
+		{
+			duplicate = true;
+			break;
+		}
+
+		if (NULL == victim || entry->expires < victim->expires)
+		{
+			victim = entry;
+		}
+	}
+
+	// The window runs from the first copy, so a series of copies does not keep it open.
+	if (!duplicate)
+	{
+		victim->key = key;
+		victim->expires = now + (gint64)dedup->window * G_USEC_PER_SEC;
+	}
+
+	*drop = dedup->drop;
+
+	g_mutex_unlock(&svc->incoming_dedup_lock);
+
+	return duplicate;
+}
+
+int messages_set_incoming_duplicate_window(messages_service_h service, int window, bool drop)
+{
+	messages_incoming_dedup_s *dedup = NULL;
+	messages_incoming_dedup_s *old;
+
+	messages_service_s *_svc = (messages_service_s*)service;
+
+	CHECK_NULL(_svc);
+
+	if (window < 0)
+	{
+		LOGE("[%s] INVALID_PARAMETER(0x%08x) : window should not be negative."
+			, __FUNCTION__, MESSAGES_ERROR_INVALID_PARAMETER);
+		return MESSAGES_ERROR_INVALID_PARAMETER;
+	}
+
+	if (0 < window)
+	{
+		dedup = (messages_incoming_dedup_s *)calloc(1, sizeof(messages_incoming_dedup_s));
+		if (NULL == dedup)
+		{
+			LOGE("[%s] OUT_OF_MEMORY(0x%08x) fail to create the duplicate filter."
+				, __FUNCTION__, MESSAGES_ERROR_OUT_OF_MEMORY);
+			return MESSAGES_ERROR_OUT_OF_MEMORY;
+		}
+		dedup->window = window;
+		dedup->drop = drop;
+	}
+
+	g_mutex_lock(&_svc->incoming_dedup_lock);
+	old = _svc->incoming_dedup;
+	g_atomic_pointer_set(&_svc->incoming_dedup, dedup);
+	g_mutex_unlock(&_svc->incoming_dedup_lock);
+
+	free(old);
+
+	return MESSAGES_ERROR_NONE;
+}
+
+int messages_is_duplicate_message(messages_message_h msg, bool *duplicate)
+{
+	messages_message_s *_msg = (messages_message_s*)msg;
+
+	CHECK_NULL(_msg);
+	CHECK_NULL(duplicate);
+
+	*duplicate = _msg->duplicate;
+
+	return MESSAGES_ERROR_NONE;
+}
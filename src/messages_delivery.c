@@ -0,0 +1,370 @@
+/*
+ * Copyright (c) 2011 Samsung Electronics Co., Ltd All Rights Reserved
+ *
+ * Licensed under the Apache License, Version 2.0 (the License);
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an AS IS BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License. 
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <memory.h>
+
+#include <glib.h>
+
+#include <dlog.h>
+#include <msg.h>
+
+#include <messages.h>
+#include <messages_types.h>
+#include <messages_private.h>
+
+/*
+ * Delivery report tracking.
+ * All tables are allocated once when delivery reports are enabled, so tracking a report never allocates.
+ * Pending requests are direct-mapped by req_id: msg-service hands out sequential ids, so a slot is
+ * reused only after MESSAGES_DELIVERY_PENDING_COUNT newer requests, which drops the oldest unreported one.
+ * Destinations are hashed by address; when the probed slots are all taken, the least recently used one
+ * is given to the new address and its statistics are reset.
+ */
+
+enum {
+	DELIVERY_STATE_NONE = 0,
+	DELIVERY_STATE_SUBMITTED,
+	DELIVERY_STATE_SENT,
+};
+
+static messages_delivery_dest_s *_messages_delivery_find_dest(messages_delivery_tracker_s *tracker, guint64 key, bool create)
+{
+	int i;
+	int slot;
+	messages_delivery_dest_s *dest;
+	messages_delivery_dest_s *victim = NULL;
+
+	if (0 == key)
+	{
+		key = 1;
+	}
+
+	for (i=0; i < MESSAGES_DELIVERY_DEST_PROBE; i++)
+	{
+		slot = (int)((key + i) % MESSAGES_DELIVERY_DEST_COUNT);
+		dest = &tracker->dests[slot];
+
+		if (dest->key == key)
+		{
+			return dest;
+		}
+
+		if (0 == dest->key)
+		{
+			if (!create)
+			{
+				return NULL;
+			}
+			dest->key = key;
+			return dest;
+		}
+
+		if (NULL == victim || dest->last_used < victim->last_used)
+		{
+			victim = dest;
+		}
+	}
+
+	if (!create)
+	{
+		return NULL;
+	}
+
+	// Requests still pending on the victim see that its key changed and stop counting for it.
+	memset(victim, 0, sizeof(messages_delivery_dest_s));
+	victim->key = key;
+
+	return victim;
+}
+
+static messages_delivery_stats_s *_messages_delivery_dest_stats(messages_delivery_tracker_s *tracker, messages_delivery_pending_s *pending, int i)
+{
+	messages_delivery_dest_s *dest = &tracker->dests[pending->dest[i]];
+
+	if (dest->key != pending->dest_key[i])
+	{
+		return NULL;
+	}
+
+	return &dest->stats;
+}
+
+static void _messages_delivery_add_stats(messages_delivery_stats_s *stats, int sent, int delivered, int failed, int latency)
+{
+	stats->sent += sent;
+	stats->delivered += delivered;
+	stats->failed += failed;
+
+	if (delivered)
+	{
+		stats->latency_sum += latency;
+		stats->latency_max = MAX(stats->latency_max, latency);
+	}
+}
+
+int _messages_delivery_enable(messages_service_s *svc, bool enable)
+{
+	CHECK_NULL(svc);
+
+	if (enable && NULL == svc->delivery)
+	{
+		svc->delivery = (messages_delivery_tracker_s *)calloc(1, sizeof(messages_delivery_tracker_s));
+		if (NULL == svc->delivery)
+		{
+			LOGE("[%s] OUT_OF_MEMORY(0x%08x) fail to create 'svc->delivery'."
+				, __FUNCTION__, MESSAGES_ERROR_OUT_OF_MEMORY);
+			return MESSAGES_ERROR_OUT_OF_MEMORY;
+		}
+		g_mutex_init(&svc->delivery->lock);
+	}
+
+	svc->delivery_report = enable;
+
+	return MESSAGES_ERROR_NONE;
+}
+
+void _messages_delivery_destroy(messages_service_s *svc)
+{
+	if (NULL != svc->delivery)
+	{
+		g_mutex_clear(&svc->delivery->lock);
+		free(svc->delivery);
+		svc->delivery = NULL;
+	}
+}
+
+void _messages_delivery_submitted(messages_service_s *svc, int req_id, msg_struct_t msg_h, gint64 submit_time)
+{
+	int i;
+	char address[MAX_ADDRESS_VAL_LEN + 1];
+	msg_struct_list_s *addr_list = NULL;
+	messages_delivery_tracker_s *tracker = svc->delivery;
+	messages_delivery_pending_s *pending;
+	messages_delivery_dest_s *dest;
+
+	if (NULL == tracker)
+	{
+		return;
+	}
+
+	g_mutex_lock(&tracker->lock);
+
+	pending = &tracker->pending[(unsigned int)req_id % MESSAGES_DELIVERY_PENDING_COUNT];
+	if (DELIVERY_STATE_SENT == pending->state)
+	{
+		LOGW("[%s] no delivery report for request %d, it is not tracked anymore."
+			, __FUNCTION__, pending->req_id);
+	}
+
+	pending->req_id = req_id;
+	pending->state = DELIVERY_STATE_SUBMITTED;
+	pending->submit_time = submit_time;
+	pending->dest_count = 0;
+
+	if (MSG_SUCCESS == msg_get_list_handle(msg_h, MSG_MESSAGE_ADDR_LIST_STRUCT, (void **)&addr_list))
+	{
+		for (i=0; i < addr_list->nCount && pending->dest_count < MESSAGES_DELIVERY_MAX_DEST; i++)
+		{
+			memset(address, 0, sizeof(address));
+			msg_get_str_value(addr_list->msg_struct_info[i], MSG_ADDRESS_INFO_ADDRESS_VALUE_STR, address, MAX_ADDRESS_VAL_LEN);
+
+			dest = _messages_delivery_find_dest(tracker, _messages_hash_address(MESSAGES_HASH_INIT, address), true);
+			if (NULL != dest)
+			{
+				dest->last_used = submit_time;
+				pending->dest[pending->dest_count] = (short)(dest - tracker->dests);
+				pending->dest_key[pending->dest_count] = dest->key;
+				pending->dest_count++;
+			}
+		}
+	}
+
+	g_mutex_unlock(&tracker->lock);
+}
+
+static messages_delivery_pending_s *_messages_delivery_find_pending(messages_delivery_tracker_s *tracker, int req_id)
+{
+	messages_delivery_pending_s *pending;
+
+	pending = &tracker->pending[(unsigned int)req_id % MESSAGES_DELIVERY_PENDING_COUNT];
+	if (DELIVERY_STATE_NONE == pending->state || pending->req_id != req_id)
+	{
+		return NULL;
+	}
+
+	return pending;
+}
+
+void _messages_delivery_sent(messages_service_s *svc, int req_id, bool sent)
+{
+	int i;
+	messages_delivery_tracker_s *tracker = svc->delivery;
+	messages_delivery_pending_s *pending;
+	messages_delivery_stats_s *stats;
+
+	if (NULL == tracker)
+	{
+		return;
+	}
+
+	g_mutex_lock(&tracker->lock);
+
+	pending = _messages_delivery_find_pending(tracker, req_id);
+	if (NULL != pending && DELIVERY_STATE_SUBMITTED == pending->state)
+	{
+		if (sent)
+		{
+			pending->state = DELIVERY_STATE_SENT;
+			_messages_delivery_add_stats(&tracker->total, 1, 0, 0, 0);
+			for (i=0; i < pending->dest_count; i++)
+			{
+				stats = _messages_delivery_dest_stats(tracker, pending, i);
+				if (NULL != stats)
+				{
+					_messages_delivery_add_stats(stats, 1, 0, 0, 0);
+				}
+			}
+		}
+		else
+		{
+			pending->state = DELIVERY_STATE_NONE;
+		}
+	}
+
+	g_mutex_unlock(&tracker->lock);
+}
+
+void _messages_delivery_reported(messages_service_s *svc, int req_id, bool delivered)
+{
+	int i;
+	int latency;
+	messages_delivery_tracker_s *tracker = svc->delivery;
+	messages_delivery_pending_s *pending;
+	messages_delivery_stats_s *stats;
+
+	if (NULL == tracker)
+	{
+		return;
+	}
+
+	g_mutex_lock(&tracker->lock);
+
+	pending = _messages_delivery_find_pending(tracker, req_id);
+	if (NULL == pending || DELIVERY_STATE_NONE == pending->state)
+	{
+		g_mutex_unlock(&tracker->lock);
+		LOGW("[%s] delivery report for unknown request %d.", __FUNCTION__, req_id);
+		return;
+	}
+
+	// The report may overtake the sending status.
+	if (DELIVERY_STATE_SUBMITTED == pending->state)
+	{
+		_messages_delivery_add_stats(&tracker->total, 1, 0, 0, 0);
+		for (i=0; i < pending->dest_count; i++)
+		{
+			stats = _messages_delivery_dest_stats(tracker, pending, i);
+			if (NULL != stats)
+			{
+				_messages_delivery_add_stats(stats, 1, 0, 0, 0);
+			}
+		}
+	}
+
+	latency = (int)MIN((g_get_monotonic_time() - pending->submit_time) / 1000, (gint64)G_MAXINT);
+
+	_messages_delivery_add_stats(&tracker->total, 0, delivered, !delivered, latency);
+	for (i=0; i < pending->dest_count; i++)
+	{
+		stats = _messages_delivery_dest_stats(tracker, pending, i);
+		if (NULL != stats)
+		{
+			_messages_delivery_add_stats(stats, 0, delivered, !delivered, latency);
+		}
+	}
+
+	LOGI("[%s] request %d %s in %d ms."
+		, __FUNCTION__, req_id, delivered ? "delivered" : "not delivered", latency);
+
+	pending->state = DELIVERY_STATE_NONE;
+
+	g_mutex_unlock(&tracker->lock);
+}
+
+int messages_set_delivery_report_enabled(messages_service_h service, bool enable)
+{
+	messages_service_s *_svc = (messages_service_s*)service;
+
+	CHECK_NULL(_svc);
+
+	return _messages_delivery_enable(_svc, enable);
+}
+
+int messages_get_delivery_statistics(messages_service_h service, const char *address,
+							int *sent, int *delivered, int *failed, int *avg_latency, int *max_latency)
+{
+	messages_delivery_stats_s stats;
+	messages_delivery_dest_s *dest;
+
+	messages_service_s *_svc = (messages_service_s*)service;
+
+	CHECK_NULL(_svc);
+
+	memset(&stats, 0, sizeof(stats));
+
+	if (NULL != _svc->delivery)
+	{
+		g_mutex_lock(&_svc->delivery->lock);
+		if (NULL == address)
+		{
+			stats = _svc->delivery->total;
+		}
+		else
+		{
+			dest = _messages_delivery_find_dest(_svc->delivery, _messages_hash_address(MESSAGES_HASH_INIT, address), false);
+			if (NULL != dest)
+			{
+				stats = dest->stats;
+			}
+		}
+		g_mutex_unlock(&_svc->delivery->lock);
+	}
+
+	if (NULL != sent)
+	{
+		*sent = stats.sent;
+	}
+	if (NULL != delivered)
+	{
+		*delivered = stats.delivered;
+	}
+	if (NULL != failed)
+	{
+		*failed = stats.failed;
+	}
+	if (NULL != avg_latency)
+	{
+		*avg_latency = stats.delivered ? (int)(stats.latency_sum / stats.delivered) : 0;
+	}
+	if (NULL != max_latency)
+	{
+		*max_latency = stats.latency_max;
+	}
+
+	return MESSAGES_ERROR_NONE;
+}
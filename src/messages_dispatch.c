@@ -0,0 +1,414 @@
+/*
+ * Copyright (c) 2011 Samsung Electronics Co., Ltd All Rights Reserved
+ *
+ * Licensed under the Apache License, Version 2.0 (the License);
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an AS IS BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License. 
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <memory.h>
+
+#include <glib.h>
+
+#include <dlog.h>
+#include <msg.h>
+
+#include <messages.h>
+#include <messages_types.h>
+#include <messages_private.h>
+
+/*
+ * Off-thread delivery of incoming messages.
+ * The msg-service thread only copies the message and puts it in a bounded ring; worker threads
+ * load MMS bodies and call the application. The ring is lock-free, each slot carrying the position
+ * it is ready for, so producers and workers only claim positions with compare-and-swap.
+ * The lock and conditions are only used to sleep when the ring is empty or full.
+ */
+
+#define POS_DIFF(a, b)	((gint)((guint)(a) - (guint)(b)))
+
+static bool _messages_ring_push(messages_dispatcher_s *d, msg_struct_t msg_h, bool duplicate)
+{
+	int pos;
+	int seq;
+	messages_incoming_slot_s *slot;
+
+	pos = g_atomic_int_get(&d->head);
+	for (;;)
+	{
+		slot = &d->slots[pos & d->mask];
+		seq = g_atomic_int_get(&slot->seq);
+
+		if (0 == POS_DIFF(seq, pos))
+		{
+			if (g_atomic_int_compare_and_exchange(&d->head, pos, (gint)((guint)pos + 1)))
+			{
+				break;
+			}
+			pos = g_atomic_int_get(&d->head);
+		}
+		else if (POS_DIFF(seq, pos) < 0)
+		{
+			// The slot still holds the message from one lap ago.
+			return false;
+		}
+		else
+		{
+			pos = g_atomic_int_get(&d->head);
+		}
+	}
+
+	slot->msg_h = msg_h;
+	slot->duplicate = duplicate;
+	g_atomic_int_set(&slot->seq, (gint)((guint)pos + 1));
+
+	return true;
+}
+
+static msg_struct_t _messages_ring_pop(messages_dispatcher_s *d, bool *duplicate)
+{
+	int pos;
+	int seq;
+	msg_struct_t msg_h;
+	messages_incoming_slot_s *slot;
+
+	pos = g_atomic_int_get(&d->tail);
+	for (;;)
+	{
+		slot = &d->slots[pos & d->mask];
+		seq = g_atomic_int_get(&slot->seq);
+
+		if (0 == POS_DIFF(seq, (guint)pos + 1))
+		{
+			if (g_atomic_int_compare_and_exchange(&d->tail, pos, (gint)((guint)pos + 1)))
+			{
+				break;
+			}
+			pos = g_atomic_int_get(&d->tail);
+		}
+		else if (POS_DIFF(seq, (guint)pos + 1) < 0)
+		{
+			return NULL;
+		}
+		else
+		{
+			pos = g_atomic_int_get(&d->tail);
+		}
+	}
+
+	msg_h = slot->msg_h;
+	*duplicate = slot->duplicate;
+	slot->msg_h = NULL;
+	g_atomic_int_set(&slot->seq, (gint)((guint)pos + d->mask + 1));
+
+	return msg_h;
+}
+
+static int _messages_ring_depth(messages_dispatcher_s *d)
+{
+	int depth = POS_DIFF(g_atomic_int_get(&d->head), g_atomic_int_get(&d->tail));
+
+	return (depth < 0) ? 0 : depth;
+}
+
+static void _messages_dispatcher_wake(messages_dispatcher_s *d, int *waiters, GCond *cond)
+{
+	if (0 < g_atomic_int_get(waiters))
+	{
+		g_mutex_lock(&d->lock);
+		g_cond_signal(cond);
+		g_mutex_unlock(&d->lock);
+	}
+}
+
+static gpointer _messages_dispatcher_worker(gpointer data)
+{
+	bool duplicate;
+	msg_struct_t msg_h;
+	messages_dispatcher_s *d = (messages_dispatcher_s *)data;
+
+	for (;;)
+	{
+		msg_h = _messages_ring_pop(d, &duplicate);
+		if (NULL != msg_h)
+		{
+			_messages_dispatcher_wake(d, &d->blocked, &d->room);
+			_messages_incoming_deliver(d->svc, d->svc->service_h, msg_h, false, duplicate);
+			continue;
+		}
+
+		g_mutex_lock(&d->lock);
+		g_atomic_int_inc(&d->idle);
+
+		// Checked again after announcing the wait, so a message pushed meanwhile is not missed.
+		msg_h = _messages_ring_pop(d, &duplicate);
+		if (NULL == msg_h)
+		{
+			if (g_atomic_int_get(&d->stopping))
+			{
+				g_atomic_int_add(&d->idle, -1);
+				g_mutex_unlock(&d->lock);
+				break;
+			}
+			g_cond_wait(&d->work, &d->lock);
+		}
+
+		g_atomic_int_add(&d->idle, -1);
+		g_mutex_unlock(&d->lock);
+
+		if (NULL != msg_h)
+		{
+			_messages_dispatcher_wake(d, &d->blocked, &d->room);
+			_messages_incoming_deliver(d->svc, d->svc->service_h, msg_h, false, duplicate);
+		}
+	}
+
+	return NULL;
+}
+
+static void _messages_dispatcher_drop(messages_dispatcher_s *d, msg_struct_t msg_h)
+{
+	int dropped;
+
+	if (NULL != msg_h)
+	{
+		msg_release_struct(&msg_h);
+	}
+
+	// Drops come in bursts, so only some of them are logged.
+	dropped = g_atomic_int_add(&d->dropped, 1) + 1;
+	if (1 == dropped || 0 == dropped % 100)
+	{
+		LOGW("[%s] the incoming queue is full, %d messages dropped so far.", __FUNCTION__, dropped);
+	}
+}
+
+bool _messages_dispatch_incoming(messages_dispatcher_s *d, msg_struct_t msg, bool duplicate)
+{
+	int peak;
+	int depth;
+	msg_struct_t msg_h = NULL;
+
+	if (g_atomic_int_get(&d->stopping)
+		|| (MESSAGES_INCOMING_OVERFLOW_DROP == d->policy && _messages_ring_depth(d) > d->mask))
+	{
+		_messages_dispatcher_drop(d, NULL);
+		return false;
+	}
+
+	// msg-service releases msg when the callback returns.
+	if (MESSAGES_ERROR_NONE != _messages_copy_msg_struct(msg, &msg_h))
+	{
+		_messages_dispatcher_drop(d, NULL);
+		return false;
+	}
+
+	while (!_messages_ring_push(d, msg_h, duplicate))
+	{
+		if (MESSAGES_INCOMING_OVERFLOW_DROP == d->policy)
+		{
+			_messages_dispatcher_drop(d, msg_h);
+			return false;
+		}
+
+		g_mutex_lock(&d->lock);
+		g_atomic_int_inc(&d->blocked);
+		if (g_atomic_int_get(&d->stopping))
+		{
+			g_atomic_int_add(&d->blocked, -1);
+			g_mutex_unlock(&d->lock);
+			_messages_dispatcher_drop(d, msg_h);
+			return false;
+		}
+		if (_messages_ring_depth(d) > d->mask)
+		{
+			g_cond_wait(&d->room, &d->lock);
+		}
+		g_atomic_int_add(&d->blocked, -1);
+		g_mutex_unlock(&d->lock);
+	}
+
+	depth = _messages_ring_depth(d);
+	do {
+		peak = g_atomic_int_get(&d->peak);
+	} while (depth > peak && !g_atomic_int_compare_and_exchange(&d->peak, peak, depth));
+
+	_messages_dispatcher_wake(d, &d->idle, &d->work);
+
+	return true;
+}
+
+static messages_dispatcher_s *_messages_dispatcher_create(messages_service_s *svc, int workers, int capacity, int policy)
+{
+	int i;
+	int size;
+	messages_dispatcher_s *d;
+
+	d = (messages_dispatcher_s *)calloc(1, sizeof(messages_dispatcher_s));
+	if (NULL == d)
+	{
+		return NULL;
+	}
+
+	for (size = 2; size < capacity; size <<= 1);
+
+	d->slots = (messages_incoming_slot_s *)calloc(size, sizeof(messages_incoming_slot_s));
+	d->workers = (GThread **)calloc(workers, sizeof(GThread *));
+	if (NULL == d->slots || NULL == d->workers)
+	{
+		free(d->slots);
+		free(d->workers);
+		free(d);
+		return NULL;
+	}
+
+	for (i=0; i < size; i++)
+	{
+		d->slots[i].seq = i;
+	}
+	d->mask = size - 1;
+	d->policy = policy;
+	d->svc = svc;
+	g_mutex_init(&d->lock);
+	g_cond_init(&d->work);
+	g_cond_init(&d->room);
+
+	for (i=0; i < workers; i++)
+	{
+		d->workers[i] = g_thread_try_new("messages-incoming", _messages_dispatcher_worker, d, NULL);
+		if (NULL == d->workers[i])
+		{
+			break;
+		}
+		d->worker_count++;
+	}
+
+	if (0 == d->worker_count)
+	{
+		_messages_dispatcher_destroy(d);
+		return NULL;
+	}
+
+	return d;
+}
+
+// The workers deliver what is still queued, then exit.
+void _messages_dispatcher_stop(messages_dispatcher_s *d)
+{
+	int i;
+
+	if (NULL == d)
+	{
+		return;
+	}
+
+	g_mutex_lock(&d->lock);
+	g_atomic_int_set(&d->stopping, 1);
+	g_cond_broadcast(&d->work);
+	g_cond_broadcast(&d->room);
+	g_mutex_unlock(&d->lock);
+
+	for (i=0; i < d->worker_count; i++)
+	{
+		g_thread_join(d->workers[i]);
+	}
+	d->worker_count = 0;
+}
+
+void _messages_dispatcher_destroy(messages_dispatcher_s *d)
+{
+	bool duplicate;
+	msg_struct_t msg_h;
+
+	if (NULL == d)
+	{
+		return;
+	}
+
+	_messages_dispatcher_stop(d);
+
+	while (NULL != (msg_h = _messages_ring_pop(d, &duplicate)))
+	{
+		msg_release_struct(&msg_h);
+	}
+
+	g_mutex_clear(&d->lock);
+	g_cond_clear(&d->work);
+	g_cond_clear(&d->room);
+	free(d->workers);
+	free(d->slots);
+	free(d);
+}
+
+int messages_set_incoming_dispatch(messages_service_h service, int workers, int capacity, messages_incoming_overflow_e policy)
+{
+	messages_service_s *_svc = (messages_service_s*)service;
+
+	CHECK_NULL(_svc);
+
+	if (workers < 0 || MESSAGES_DISPATCH_MAX_WORKERS < workers
+		|| (0 < workers && (capacity < 1 || MESSAGES_DISPATCH_MAX_CAPACITY < capacity))
+		|| (MESSAGES_INCOMING_OVERFLOW_DROP != policy && MESSAGES_INCOMING_OVERFLOW_BLOCK != policy))
+	{
+		LOGE("[%s] INVALID_PARAMETER(0x%08x) : workers, capacity or policy is out of range."
+			, __FUNCTION__, MESSAGES_ERROR_INVALID_PARAMETER);
+		return MESSAGES_ERROR_INVALID_PARAMETER;
+	}
+
+	// The mediator reads the dispatcher without a lock, so it can only be chosen before it is registered.
+	if (_svc->incoming_registered || NULL != _svc->dispatcher)
+	{
+		LOGE("[%s] INVALID_PARAMETER(0x%08x) : the incoming dispatch is already in use."
+			, __FUNCTION__, MESSAGES_ERROR_INVALID_PARAMETER);
+		return MESSAGES_ERROR_INVALID_PARAMETER;
+	}
+
+	if (0 == workers)
+	{
+		return MESSAGES_ERROR_NONE;
+	}
+
+	_svc->dispatcher = _messages_dispatcher_create(_svc, workers, capacity, policy);
+	if (NULL == _svc->dispatcher)
+	{
+		LOGE("[%s] OUT_OF_MEMORY(0x%08x) fail to create the 'dispatcher'."
+			, __FUNCTION__, MESSAGES_ERROR_OUT_OF_MEMORY);
+		return MESSAGES_ERROR_OUT_OF_MEMORY;
+	}
+
+	return MESSAGES_ERROR_NONE;
+}
+
+int messages_get_incoming_queue_statistics(messages_service_h service, int *depth, int *peak, int *dropped)
+{
+	messages_service_s *_svc = (messages_service_s*)service;
+
+	CHECK_NULL(_svc);
+	CHECK_NULL(depth);
+	CHECK_NULL(peak);
+	CHECK_NULL(dropped);
+
+	if (NULL == _svc->dispatcher)
+	{
+		*depth = 0;
+		*peak = 0;
+		*dropped = 0;
+		return MESSAGES_ERROR_NONE;
+	}
+
+	*depth = _messages_ring_depth(_svc->dispatcher);
+	*peak = g_atomic_int_get(&_svc->dispatcher->peak);
+	*dropped = g_atomic_int_get(&_svc->dispatcher->dropped);
+
+	return MESSAGES_ERROR_NONE;
+}
@@ -0,0 +1,446 @@
+/*
+ * Copyright (c) 2011 Samsung Electronics Co., Ltd All Rights Reserved
+ *
+ * Licensed under the Apache License, Version 2.0 (the License);
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an AS IS BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License. 
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <glib.h>
+
+#include <dlog.h>
+#include <msg.h>
+
+#include <messages.h>
+#include <messages_types.h>
+#include <messages_private.h>
+
+/*
+ * Incoming message filter.
+ * The filter is kept in the form it is evaluated in: senders as sorted hashes of their normalized
+ * addresses, ports as a bitmap and keywords indexed by their first byte. It is checked on the
+ * msg-service struct, before a message handle is created or an MMS body is loaded.
+ */
+
+#define BIT_SET(map, i)		((map)[(i) >> 3] |= (guint8)(1 << ((i) & 7)))
+#define BIT_TEST(map, i)	((map)[(i) >> 3] & (1 << ((i) & 7)))
+
+void _messages_incoming_filter_destroy(messages_incoming_filter_s *filter)
+{
+	int i;
+
+	if (NULL == filter)
+	{
+		return;
+	}
+
+	for (i=0; i < filter->keyword_count; i++)
+	{
+		free(filter->keywords[i].word);
+	}
+	free(filter->keywords);
+	free(filter->allow);
+	free(filter->deny);
+	free(filter->ports);
+	free(filter);
+}
+
+static bool _messages_filter_find(const guint64 *hashes, int count, guint64 hash, int *index)
+{
+	int low = 0;
+	int high = count;
+	int mid;
+
+	while (low < high)
+	{
+		mid = (low + high) / 2;
+		if (hashes[mid] < hash)
+		{
+			low = mid + 1;
+		}
+		else
+		{
+			high = mid;
+		}
+	}
+
+	*index = low;
+
+	return low < count && hashes[low] == hash;
+}
+
+static int _messages_filter_insert(guint64 **hashes, int *count, guint64 hash)
+{
+	int index;
+	guint64 *grown;
+
+	if (_messages_filter_find(*hashes, *count, hash, &index))
+	{
+		return MESSAGES_ERROR_NONE;
+	}
+
+	grown = (guint64 *)realloc(*hashes, sizeof(guint64) * (*count + 1));
+	if (NULL == grown)
+	{
+		LOGE("[%s] OUT_OF_MEMORY(0x%08x) fail to grow the sender set."
+			, __FUNCTION__, MESSAGES_ERROR_OUT_OF_MEMORY);
+		return MESSAGES_ERROR_OUT_OF_MEMORY;
+	}
+
+	memmove(&grown[index + 1], &grown[index], sizeof(guint64) * (*count - index));
+	grown[index] = hash;
+	*hashes = grown;
+	(*count)++;
+
+	return MESSAGES_ERROR_NONE;
+}
+
+static bool _messages_filter_match_at(const char *text, const messages_filter_keyword_s *keyword)
+{
+	int i;
+
+	for (i=0; i < keyword->len; i++)
+	{
+		if ('\0' == text[i] || g_ascii_tolower(text[i]) != keyword->word[i])
+		{
+			return false;
+		}
+	}
+
+	return true;
+}
+
+static bool _messages_filter_match_text(const messages_incoming_filter_s *filter, const char *text)
+{
+	int i;
+	const char *p;
+	unsigned char c;
+
+	for (p = text; '\0' != *p; p++)
+	{
+		c = (unsigned char)g_ascii_tolower(*p);
+		if (!BIT_TEST(filter->first_bytes, c))
+		{
+			continue;
+		}
+
+		for (i=0; i < filter->keyword_count; i++)
+		{
+			if ((filter->keywords[i].prefix && p != text) || filter->keywords[i].word[0] != (char)c)
+			{
+				continue;
+			}
+			if (_messages_filter_match_at(p, &filter->keywords[i]))
+			{
+				return true;
+			}
+		}
+	}
+
+	return false;
+}
+
+bool _messages_incoming_filter_match(messages_service_s *svc, msg_struct_t msg)
+{
+	int port = 0;
+	int index;
+	bool match = true;
+	bool sender_known = false;
+	guint64 sender = 0;
+	char address[MAX_ADDRESS_VAL_LEN + 1];
+	char text[MAX_MSG_TEXT_LEN + 1];
+	messages_message_type_e type;
+	messages_message_s peek;
+	messages_incoming_filter_s *filter;
+	msg_struct_list_s *addr_list = NULL;
+
+	if (NULL == g_atomic_pointer_get(&svc->incoming_filter))
+	{
+		return true;
+	}
+
+	g_mutex_lock(&svc->incoming_filter_lock);
+
+	filter = svc->incoming_filter;
+	if (NULL == filter)
+	{
+		g_mutex_unlock(&svc->incoming_filter_lock);
+		return true;
+	}
+
+	// A handle on the stack is enough to read the type.
+	memset(&peek, 0, sizeof(peek));
+	peek.msg_h = msg;
+	peek.msg_h_borrowed = true;
+
+	if (MESSAGES_TYPE_UNKNOWN != filter->type)
+	{
+		if (MESSAGES_ERROR_NONE != messages_get_message_type((messages_message_h)&peek, &type) || type != filter->type)
+		{
+			match = false;
+		}
+	}
+
+	if (match && NULL != filter->ports)
+	{
+		msg_get_int_value(msg, MSG_MESSAGE_DEST_PORT_INT, &port);
+		if (port < 0 || MESSAGES_PORT_COUNT <= port || !BIT_TEST(filter->ports, port))
+		{
+			match = false;
+		}
+	}
+
+	if (match && (0 < filter->allow_count || 0 < filter->deny_count))
+	{
+		if (MSG_SUCCESS == msg_get_list_handle(msg, MSG_MESSAGE_ADDR_LIST_STRUCT, (void **)&addr_list)
+			&& NULL != addr_list && 0 < addr_list->nCount)
+		{
+			memset(address, 0, sizeof(address));
+			msg_get_str_value(addr_list->msg_struct_info[0], MSG_ADDRESS_INFO_ADDRESS_VALUE_STR, address, MAX_ADDRESS_VAL_LEN);
+			sender = _messages_hash_address(MESSAGES_HASH_INIT, address);
+			sender_known = true;
+		}
+
+		if (sender_known && _messages_filter_find(filter->deny, filter->deny_count, sender, &index))
+		{
+			match = false;
+		}
+		else if (0 < filter->allow_count
+			&& (!sender_known || !_messages_filter_find(filter->allow, filter->allow_count, sender, &index)))
+		{
+			match = false;
+		}
+	}
+
+	if (match && 0 < filter->keyword_count)
+	{
+		// The SMS text, or the MMS subject since the body is not loaded yet.
+		memset(text, 0, sizeof(text));
+		if (MESSAGES_ERROR_NONE == messages_get_message_type((messages_message_h)&peek, &type) && MESSAGES_TYPE_MMS == type)
+		{
+			msg_get_str_value(msg, MSG_MESSAGE_SUBJECT_STR, text, MAX_SUBJECT_LEN);
+		}
+		else
+		{
+			msg_get_str_value(msg, MSG_MESSAGE_SMS_DATA_STR, text, MAX_MSG_TEXT_LEN);
+		}
+		match = _messages_filter_match_text(filter, text);
+	}
+
+	g_mutex_unlock(&svc->incoming_filter_lock);
+
+	return match;
+}
+
+// Returns the filter of svc, created on first use. The filter lock must be held.
+static messages_incoming_filter_s *_messages_filter_get(messages_service_s *svc)
+{
+	messages_incoming_filter_s *filter = svc->incoming_filter;
+
+	if (NULL == filter)
+	{
+		filter = (messages_incoming_filter_s *)calloc(1, sizeof(messages_incoming_filter_s));
+		if (NULL == filter)
+		{
+			LOGE("[%s] OUT_OF_MEMORY(0x%08x) fail to create a 'filter'."
+				, __FUNCTION__, MESSAGES_ERROR_OUT_OF_MEMORY);
+			return NULL;
+		}
+		filter->type = MESSAGES_TYPE_UNKNOWN;
+		g_atomic_pointer_set(&svc->incoming_filter, filter);
+	}
+
+	return filter;
+}
+
+int messages_incoming_filter_add_sender(messages_service_h service, const char *address, bool allow)
+{
+	int ret;
+	guint64 hash;
+	messages_incoming_filter_s *filter;
+
+	messages_service_s *_svc = (messages_service_s*)service;
+
+	CHECK_NULL(_svc);
+	CHECK_NULL(address);
+
+	hash = _messages_hash_address(MESSAGES_HASH_INIT, address);
+
+	g_mutex_lock(&_svc->incoming_filter_lock);
+
+	filter = _messages_filter_get(_svc);
+	if (NULL == filter)
+	{
+		g_mutex_unlock(&_svc->incoming_filter_lock);
+		return MESSAGES_ERROR_OUT_OF_MEMORY;
+	}
+
+	if (allow)
+	{
+		ret = _messages_filter_insert(&filter->allow, &filter->allow_count, hash);
+	}
+	else
+	{
+		ret = _messages_filter_insert(&filter->deny, &filter->deny_count, hash);
+	}
+
+	g_mutex_unlock(&_svc->incoming_filter_lock);
+
+	return ret;
+}
+
+int messages_incoming_filter_add_port(messages_service_h service, int port)
+{
+	messages_incoming_filter_s *filter;
+
+	messages_service_s *_svc = (messages_service_s*)service;
+
+	CHECK_NULL(_svc);
+
+	if (port < 0 || MESSAGES_PORT_COUNT <= port)
+	{
+		LOGE("[%s] INVALID_PARAMETER(0x%08x) : port is out of range."
+			, __FUNCTION__, MESSAGES_ERROR_INVALID_PARAMETER);
+		return MESSAGES_ERROR_INVALID_PARAMETER;
+	}
+
+	g_mutex_lock(&_svc->incoming_filter_lock);
+
+	filter = _messages_filter_get(_svc);
+	if (NULL != filter && NULL == filter->ports)
+	{
+		filter->ports = (guint8 *)calloc(MESSAGES_PORT_COUNT / 8, 1);
+	}
+	if (NULL == filter || NULL == filter->ports)
+	{
+		g_mutex_unlock(&_svc->incoming_filter_lock);
+		LOGE("[%s] OUT_OF_MEMORY(0x%08x) fail to create the port set."
+			, __FUNCTION__, MESSAGES_ERROR_OUT_OF_MEMORY);
+		return MESSAGES_ERROR_OUT_OF_MEMORY;
+	}
+
+	BIT_SET(filter->ports, port);
+
+	g_mutex_unlock(&_svc->incoming_filter_lock);
+
+	return MESSAGES_ERROR_NONE;
+}
+
+int messages_incoming_filter_add_keyword(messages_service_h service, const char *keyword, bool prefix)
+{
+	int i;
+	int len;
+	char *word;
+	messages_filter_keyword_s *keywords;
+	messages_incoming_filter_s *filter;
+
+	messages_service_s *_svc = (messages_service_s*)service;
+
+	CHECK_NULL(_svc);
+	CHECK_NULL(keyword);
+
+	len = strlen(keyword);
+	if (0 == len || MESSAGES_FILTER_KEYWORD_MAX < len)
+	{
+		LOGE("[%s] INVALID_PARAMETER(0x%08x) : keyword should have 1 to %d bytes."
+			, __FUNCTION__, MESSAGES_ERROR_INVALID_PARAMETER, MESSAGES_FILTER_KEYWORD_MAX);
+		return MESSAGES_ERROR_INVALID_PARAMETER;
+	}
+
+	word = (char *)malloc(len + 1);
+	if (NULL == word)
+	{
+		LOGE("[%s] OUT_OF_MEMORY(0x%08x) fail to create a 'word'."
+			, __FUNCTION__, MESSAGES_ERROR_OUT_OF_MEMORY);
+		return MESSAGES_ERROR_OUT_OF_MEMORY;
+	}
+	for (i=0; i <= len; i++)
+	{
+		word[i] = g_ascii_tolower(keyword[i]);
+	}
+
+	g_mutex_lock(&_svc->incoming_filter_lock);
+
+	filter = _messages_filter_get(_svc);
+	keywords = (NULL == filter) ? NULL
+		: (messages_filter_keyword_s *)realloc(filter->keywords, sizeof(messages_filter_keyword_s) * (filter->keyword_count + 1));
+	if (NULL == keywords)
+	{
+		g_mutex_unlock(&_svc->incoming_filter_lock);
+		free(word);
+		LOGE("[%s] OUT_OF_MEMORY(0x%08x) fail to grow the keyword set."
+			, __FUNCTION__, MESSAGES_ERROR_OUT_OF_MEMORY);
+		return MESSAGES_ERROR_OUT_OF_MEMORY;
+	}
+
+	keywords[filter->keyword_count].word = word;
+	keywords[filter->keyword_count].len = len;
+	keywords[filter->keyword_count].prefix = prefix;
+	filter->keywords = keywords;
+	filter->keyword_count++;
+	BIT_SET(filter->first_bytes, (unsigned char)word[0]);
+
+	g_mutex_unlock(&_svc->incoming_filter_lock);
+
+	return MESSAGES_ERROR_NONE;
+}
+
+int messages_incoming_filter_set_type(messages_service_h service, messages_message_type_e type)
+{
+	messages_incoming_filter_s *filter;
+
+	messages_service_s *_svc = (messages_service_s*)service;
+
+	CHECK_NULL(_svc);
+
+	if (MESSAGES_TYPE_UNKNOWN != type && MESSAGES_TYPE_SMS != type && MESSAGES_TYPE_MMS != type)
+	{
+		LOGE("[%s] INVALID_PARAMETER(0x%08x) : Invalid Message Type."
+			, __FUNCTION__, MESSAGES_ERROR_INVALID_PARAMETER);
+		return MESSAGES_ERROR_INVALID_PARAMETER;
+	}
+
+	g_mutex_lock(&_svc->incoming_filter_lock);
+
+	filter = _messages_filter_get(_svc);
+	if (NULL == filter)
+	{
+		g_mutex_unlock(&_svc->incoming_filter_lock);
+		return MESSAGES_ERROR_OUT_OF_MEMORY;
+	}
+	filter->type = type;
+
+	g_mutex_unlock(&_svc->incoming_filter_lock);
+
+	return MESSAGES_ERROR_NONE;
+}
+
+int messages_incoming_filter_clear(messages_service_h service)
+{
+	messages_incoming_filter_s *filter;
+
+	messages_service_s *_svc = (messages_service_s*)service;
+
+	CHECK_NULL(_svc);
+
+	g_mutex_lock(&_svc->incoming_filter_lock);
+	filter = _svc->incoming_filter;
+	g_atomic_pointer_set(&_svc->incoming_filter, NULL);
+	g_mutex_unlock(&_svc->incoming_filter_lock);
+
+	_messages_incoming_filter_destroy(filter);
+
+	return MESSAGES_ERROR_NONE;
+}
@@ -0,0 +1,69 @@
+/*
+ * Copyright (c) 2011 Samsung Electronics Co., Ltd All Rights Reserved
+ *
+ * Licensed under the Apache License, Version 2.0 (the License);
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an AS IS BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License. 
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <memory.h>
+
+#include <glib.h>
+
+#include <dlog.h>
+#include <msg.h>
+
+#include <messages.h>
+#include <messages_types.h>
+#include <messages_private.h>
+
+#define FNV_PRIME_64	0x100000001b3ULL
+
+guint64 _messages_hash_bytes(guint64 hash, const void *data, size_t len)
+{
+	const unsigned char *p = (const unsigned char *)data;
+	size_t i;
+
+	for (i=0; i < len; i++)
+	{
+		hash ^= p[i];
+		hash *= FNV_PRIME_64;
+	}
+
+	return hash;
+}
+
+/* Hashes a phone number or e-mail address, ignoring the separators people type into numbers */
+guint64 _messages_hash_address(guint64 hash, const char *address)
+{
+	const unsigned char *p;
+
+	if (NULL == address)
+	{
+		return hash;
+	}
+
+	for (p = (const unsigned char *)address; *p; p++)
+	{
+		switch (*p)
+		{
+			case ' ': case '-': case '(': case ')': case '.':
+				continue;
+			default:
+				hash ^= *p;
+				hash *= FNV_PRIME_64;
+		}
+	}
+
+	return hash;
+}
@@ -0,0 +1,132 @@
+/*
+ * Copyright (c) 2011 Samsung Electronics Co., Ltd All Rights Reserved
+ *
+ * Licensed under the Apache License, Version 2.0 (the License);
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an AS IS BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License. 
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <memory.h>
+#include <stddef.h>
+
+#include <glib.h>
+
+#include <dlog.h>
+#include <msg.h>
+
+#include <messages.h>
+#include <messages_types.h>
+#include <messages_private.h>
+
+/*
+ * Interned attachment paths.
+ * Every distinct path is stored once for the whole process with an owner count,
+ * so handles holding the same files share the strings and copying an attachment array only bumps counts.
+ */
+
+typedef struct _messages_intern_s {
+	int          ref;
+	int          media_type;	/* -1 until detected */
+	char         str[1];
+} messages_intern_s;
+
+#define INTERN_OF(s)	((messages_intern_s *)((char *)(s) - offsetof(messages_intern_s, str)))
+
+static GMutex _messages_intern_lock;
+static GHashTable *_messages_intern_table = NULL;	/* str -> messages_intern_s */
+
+const char *_messages_intern_path(const char *path)
+{
+	size_t len;
+	messages_intern_s *intern;
+
+	g_mutex_lock(&_messages_intern_lock);
+
+	if (NULL == _messages_intern_table)
+	{
+		_messages_intern_table = g_hash_table_new(g_str_hash, g_str_equal);
+	}
+
+	intern = (messages_intern_s *)g_hash_table_lookup(_messages_intern_table, path);
+	if (NULL != intern)
+	{
+		g_atomic_int_inc(&intern->ref);
+		g_mutex_unlock(&_messages_intern_lock);
+		return intern->str;
+	}
+
+	len = strlen(path);
+	intern = (messages_intern_s *)malloc(offsetof(messages_intern_s, str) + len + 1);
+	if (NULL == intern)
+	{
+		g_mutex_unlock(&_messages_intern_lock);
+		LOGE("[%s] OUT_OF_MEMORY(0x%08x) fail to create an 'intern'."
+			, __FUNCTION__, MESSAGES_ERROR_OUT_OF_MEMORY);
+		return NULL;
+	}
+
+	intern->ref = 1;
+	intern->media_type = -1;
+	memcpy(intern->str, path, len + 1);
+	g_hash_table_insert(_messages_intern_table, intern->str, intern);
+
+	g_mutex_unlock(&_messages_intern_lock);
+
+	return intern->str;
+}
+
+// The caller must already own path, so the count can not drop to zero meanwhile.
+const char *_messages_intern_ref(const char *path)
+{
+	g_atomic_int_inc(&INTERN_OF(path)->ref);
+
+	return path;
+}
+
+// The detected type is kept on the entry, so it is computed once while any handle holds the path.
+int _messages_intern_media_type(const char *path)
+{
+	int type;
+	messages_intern_s *intern = INTERN_OF(path);
+
+	type = g_atomic_int_get(&intern->media_type);
+	if (type < 0)
+	{
+		type = _messages_get_media_type_from_filepath(path);
+		g_atomic_int_set(&intern->media_type, type);
+	}
+
+	return type;
+}
+
+void _messages_intern_unref(const char *path)
+{
+	messages_intern_s *intern;
+
+	if (NULL == path)
+	{
+		return;
+	}
+
+	intern = INTERN_OF(path);
+
+	g_mutex_lock(&_messages_intern_lock);
+
+	if (g_atomic_int_dec_and_test(&intern->ref))
+	{
+		g_hash_table_remove(_messages_intern_table, intern->str);
+		free(intern);
+	}
+
+	g_mutex_unlock(&_messages_intern_lock);
+}
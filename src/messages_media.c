@@ -0,0 +1,215 @@
+/*
+ * Copyright (c) 2011 Samsung Electronics Co., Ltd All Rights Reserved
+ *
+ * Licensed under the Apache License, Version 2.0 (the License);
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an AS IS BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License. 
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+#include <glib.h>
+
+#include <dlog.h>
+#include <msg.h>
+
+#include <messages.h>
+#include <messages_types.h>
+#include <messages_private.h>
+
+/*
+ * Media type detection.
+ * The first bytes of the file are matched against known signatures;
+ * when the file can not be read or is not recognised, the extension is looked up instead.
+ */
+
+#define MESSAGES_MEDIA_SNIFF_LEN	16
+
+typedef struct {
+	int                   offset;
+	int                   len;
+	const unsigned char*  magic;
+	const unsigned char*  mask;	/* NULL to compare every bit */
+	int                   media_type;
+} messages_media_magic_s;
+
+// More specific signatures come first.
+static const messages_media_magic_s _messages_media_magics[] = {
+	{ 0, 3, (const unsigned char *)"\xff\xd8\xff",                     NULL, MESSAGES_MEDIA_IMAGE },	/* JPEG */
+	{ 0, 8, (const unsigned char *)"\x89PNG\r\n\x1a\n",                NULL, MESSAGES_MEDIA_IMAGE },	/* PNG */
+	{ 0, 4, (const unsigned char *)"GIF8",                             NULL, MESSAGES_MEDIA_IMAGE },	/* GIF */
+	{ 8, 4, (const unsigned char *)"WEBP",                             NULL, MESSAGES_MEDIA_IMAGE },	/* RIFF WebP */
+	{ 8, 4, (const unsigned char *)"WAVE",                             NULL, MESSAGES_MEDIA_AUDIO },	/* RIFF WAVE */
+	{ 8, 4, (const unsigned char *)"AVI ",                             NULL, MESSAGES_MEDIA_VIDEO },	/* RIFF AVI */
+	{ 8, 4, (const unsigned char *)"M4A ",                             NULL, MESSAGES_MEDIA_AUDIO },	/* MPEG-4 audio */
+	{ 4, 4, (const unsigned char *)"ftyp",                             NULL, MESSAGES_MEDIA_VIDEO },	/* MP4, 3GP, 3G2 */
+	{ 0, 5, (const unsigned char *)"#!AMR",                            NULL, MESSAGES_MEDIA_AUDIO },	/* AMR, AMR-WB */
+	{ 0, 4, (const unsigned char *)"MThd",                             NULL, MESSAGES_MEDIA_AUDIO },	/* MIDI */
+	{ 0, 4, (const unsigned char *)"MMMD",                             NULL, MESSAGES_MEDIA_AUDIO },	/* SMAF */
+	{ 0, 4, (const unsigned char *)"OggS",                             NULL, MESSAGES_MEDIA_AUDIO },	/* Ogg */
+	{ 0, 4, (const unsigned char *)"ADIF",                             NULL, MESSAGES_MEDIA_AUDIO },	/* AAC ADIF */
+	{ 0, 3, (const unsigned char *)"ID3",                              NULL, MESSAGES_MEDIA_AUDIO },	/* MP3 with a tag */
+	{ 0, 13, (const unsigned char *)"BEGIN:IMELODY",                   NULL, MESSAGES_MEDIA_AUDIO },	/* iMelody */
+	{ 0, 2, (const unsigned char *)"\xff\xf0", (const unsigned char *)"\xff\xf6", MESSAGES_MEDIA_AUDIO },	/* AAC ADTS */
+	{ 0, 2, (const unsigned char *)"\xff\xe0", (const unsigned char *)"\xff\xe0", MESSAGES_MEDIA_AUDIO },	/* MPEG audio frame */
+	{ 0, 2, (const unsigned char *)"BM",                               NULL, MESSAGES_MEDIA_IMAGE },	/* BMP */
+};
+
+typedef struct {
+	const char*  ext;
+	int          media_type;
+} messages_media_ext_s;
+
+/*
+ * Perfect hash of the known extensions: h = h * 108 + c over the lower-cased extension,
+ * then (h ^ (h >> 1)) & 63. The slots below were computed from that function; the stored
+ * key is compared once, so unknown extensions landing on a used slot are still rejected.
+ */
+#define MESSAGES_MEDIA_EXT_MULT		108
+#define MESSAGES_MEDIA_EXT_SLOTS	64
+#define MESSAGES_MEDIA_EXT_MAX		4
+
+static const messages_media_ext_s _messages_media_exts[MESSAGES_MEDIA_EXT_SLOTS] = {
+	[0]  = { "mid",  MESSAGES_MEDIA_AUDIO },
+	[1]  = { "amr",  MESSAGES_MEDIA_AUDIO },
+	[2]  = { "jpeg", MESSAGES_MEDIA_IMAGE },
+	[7]  = { "imy",  MESSAGES_MEDIA_AUDIO },
+	[10] = { "bmp",  MESSAGES_MEDIA_IMAGE },
+	[19] = { "xmf",  MESSAGES_MEDIA_AUDIO },
+	[29] = { "midi", MESSAGES_MEDIA_AUDIO },
+	[30] = { "3gp",  MESSAGES_MEDIA_VIDEO },
+	[33] = { "avi",  MESSAGES_MEDIA_VIDEO },
+	[34] = { "mp3",  MESSAGES_MEDIA_AUDIO },
+	[36] = { "jpg",  MESSAGES_MEDIA_IMAGE },
+	[38] = { "mp4",  MESSAGES_MEDIA_VIDEO },
+	[39] = { "jpe",  MESSAGES_MEDIA_IMAGE },
+	[40] = { "png",  MESSAGES_MEDIA_IMAGE },
+	[42] = { "wbmp", MESSAGES_MEDIA_IMAGE },
+	[43] = { "mmf",  MESSAGES_MEDIA_AUDIO },
+	[45] = { "m4v",  MESSAGES_MEDIA_VIDEO },
+	[46] = { "ogg",  MESSAGES_MEDIA_AUDIO },
+	[48] = { "aac",  MESSAGES_MEDIA_AUDIO },
+	[49] = { "m4a",  MESSAGES_MEDIA_AUDIO },
+	[51] = { "gif",  MESSAGES_MEDIA_IMAGE },
+	[52] = { "webp", MESSAGES_MEDIA_IMAGE },
+	[53] = { "awb",  MESSAGES_MEDIA_AUDIO },
+	[59] = { "wav",  MESSAGES_MEDIA_AUDIO },
+	[61] = { "3g2",  MESSAGES_MEDIA_VIDEO },
+};
+
+static int _messages_media_type_from_content(const char *filepath)
+{
+	int i;
+	int j;
+	int fd;
+	ssize_t len;
+	unsigned char head[MESSAGES_MEDIA_SNIFF_LEN];
+	const messages_media_magic_s *magic;
+
+	fd = open(filepath, O_RDONLY);
+	if (fd < 0)
+	{
+		return MESSAGES_MEDIA_UNKNOWN;
+	}
+
+	do {
+		len = read(fd, head, sizeof(head));
+	} while (len < 0 && EINTR == errno);
+	close(fd);
+
+	for (i=0; i < sizeof(_messages_media_magics) / sizeof(_messages_media_magics[0]); i++)
+	{
+		magic = &_messages_media_magics[i];
+		if (len < magic->offset + magic->len)
+		{
+			continue;
+		}
+
+		for (j=0; j < magic->len; j++)
+		{
+			unsigned char c = head[magic->offset + j];
+			if (NULL != magic->mask)
+			{
+				c &= magic->mask[j];
+			}
+			if (c != magic->magic[j])
+			{
+				break;
+			}
+		}
+
+		if (j == magic->len)
+		{
+			return magic->media_type;
+		}
+	}
+
+	return MESSAGES_MEDIA_UNKNOWN;
+}
+
+static int _messages_media_type_from_extension(const char *filepath)
+{
+	int len;
+	unsigned int h;
+	const char *ext;
+	char lower[MESSAGES_MEDIA_EXT_MAX + 1];
+	const messages_media_ext_s *entry;
+
+	ext = strrchr(filepath, '.');
+	if (NULL == ext || NULL != strchr(ext, '/'))
+	{
+		return MESSAGES_MEDIA_UNKNOWN;
+	}
+	ext++;
+
+	h = 0;
+	for (len=0; '\0' != ext[len]; len++)
+	{
+		if (MESSAGES_MEDIA_EXT_MAX == len)
+		{
+			return MESSAGES_MEDIA_UNKNOWN;
+		}
+		lower[len] = g_ascii_tolower(ext[len]);
+		h = h * MESSAGES_MEDIA_EXT_MULT + (unsigned char)lower[len];
+	}
+	lower[len] = '\0';
+
+	entry = &_messages_media_exts[(h ^ (h >> 1)) & (MESSAGES_MEDIA_EXT_SLOTS - 1)];
+	if (NULL == entry->ext || 0 != strcmp(entry->ext, lower))
+	{
+		return MESSAGES_MEDIA_UNKNOWN;
+	}
+
+	return entry->media_type;
+}
+
+int _messages_get_media_type_from_filepath(const char *filepath)
+{
+	int ret;
+
+	if (NULL == filepath)
+	{
+		return MESSAGES_MEDIA_UNKNOWN;
+	}
+
+	ret = _messages_media_type_from_content(filepath);
+	if (MESSAGES_MEDIA_UNKNOWN == ret)
+	{
+		ret = _messages_media_type_from_extension(filepath);
+	}
+
+	return ret;
+}
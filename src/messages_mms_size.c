@@ -0,0 +1,209 @@
+/*
+ * Copyright (c) 2011 Samsung Electronics Co., Ltd All Rights Reserved
+ *
+ * Licensed under the Apache License, Version 2.0 (the License);
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an AS IS BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License. 
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <memory.h>
+#include <sys/stat.h>
+
+#include <glib.h>
+
+#include <dlog.h>
+#include <msg.h>
+
+#include <messages.h>
+#include <messages_types.h>
+#include <messages_private.h>
+
+/*
+ * MMS size estimation.
+ * The encoded size is approximated from the sizes of the parts and fixed allowances for the
+ * M-Send.req headers, the SMIL part and the multipart headers, without building the body.
+ * Parts are laid out in the order they are encoded: headers, SMIL, text, then the attachments.
+ */
+
+#define MESSAGES_MMS_HEADER_SIZE		160	/* fixed M-Send.req headers */
+#define MESSAGES_MMS_ADDRESS_SIZE		16	/* field code and "/TYPE=PLMN" of a recipient */
+#define MESSAGES_MMS_SMIL_SIZE			512
+#define MESSAGES_MMS_PART_HEADER_SIZE	48	/* content type and headers of a part, without the name */
+#define MESSAGES_MMS_TEXT_NAME_LEN		32
+
+static int _messages_mms_part_size(const char *filepath, off_t content_size)
+{
+	const char *name = strrchr(filepath, '/');
+
+	name = (NULL == name) ? filepath : name + 1;
+
+	// The name is carried in both Content-Location and the name parameter.
+	return MESSAGES_MMS_PART_HEADER_SIZE + 2 * strlen(name) + (int)content_size;
+}
+
+int _messages_mms_estimate_size(messages_message_s *msg, int limit, int *size, int *first_oversized)
+{
+	int i;
+	gint64 total;
+	struct stat st;
+	char subject[MAX_SUBJECT_LEN + 1];
+	char address[MAX_ADDRESS_VAL_LEN + 1];
+	msg_struct_list_s *addr_list = NULL;
+
+	CHECK_NULL(msg);
+	CHECK_NULL(msg->msg_h);
+
+	total = MESSAGES_MMS_HEADER_SIZE;
+
+	if (MSG_SUCCESS == msg_get_list_handle(msg->msg_h, MSG_MESSAGE_ADDR_LIST_STRUCT, (void **)&addr_list))
+	{
+		for (i=0; i < addr_list->nCount; i++)
+		{
+			memset(address, 0, sizeof(address));
+			msg_get_str_value(addr_list->msg_struct_info[i], MSG_ADDRESS_INFO_ADDRESS_VALUE_STR, address, MAX_ADDRESS_VAL_LEN);
+			total += MESSAGES_MMS_ADDRESS_SIZE + strlen(address);
+		}
+	}
+
+	memset(subject, 0, sizeof(subject));
+	msg_get_str_value(msg->msg_h, MSG_MESSAGE_SUBJECT_STR, subject, MAX_SUBJECT_LEN);
+	total += strlen(subject);
+
+	total += MESSAGES_MMS_PART_HEADER_SIZE + MESSAGES_MMS_SMIL_SIZE;
+
+	if (NULL != msg->text)
+	{
+		total += MESSAGES_MMS_PART_HEADER_SIZE + 2 * MESSAGES_MMS_TEXT_NAME_LEN + strlen(msg->text);
+	}
+
+	// When the text and headers alone are too large, no attachment is to blame.
+	if (NULL != first_oversized)
+	{
+		*first_oversized = (0 < limit && total > limit) ? msg->attachment_count : -1;
+	}
+
+	for (i=0; i < msg->attachment_count; i++)
+	{
+		if (0 != stat(msg->attachments[i].filepath, &st))
+		{
+			LOGW("[%s] fail to stat '%s', it is counted as empty.", __FUNCTION__, msg->attachments[i].filepath);
+			st.st_size = 0;
+		}
+
+		total += _messages_mms_part_size(msg->attachments[i].filepath, st.st_size);
+
+		if (NULL != first_oversized && -1 == *first_oversized && 0 < limit && total > limit)
+		{
+			*first_oversized = i;
+		}
+	}
+
+	*size = (total > G_MAXINT) ? G_MAXINT : (int)total;
+
+	return MESSAGES_ERROR_NONE;
+}
+
+// Checked before anything is built or queued, so an oversized message costs no sending slot or retry.
+bool _messages_mms_fits(messages_service_s *svc, messages_message_s *msg)
+{
+	int size;
+	int limit = svc->mms_size_limit;
+
+	if (0 == limit || MESSAGES_ERROR_NONE != _messages_mms_estimate_size(msg, limit, &size, NULL))
+	{
+		return true;
+	}
+
+	if (size > limit)
+	{
+		LOGE("[%s] MESSAGE_TOO_LARGE(0x%08x) : about %d bytes, the limit is %d bytes."
+			, __FUNCTION__, MESSAGES_ERROR_MESSAGE_TOO_LARGE, size, limit);
+		return false;
+	}
+
+	return true;
+}
+
+int messages_mms_set_size_limit(messages_service_h service, int limit)
+{
+	messages_service_s *_svc = (messages_service_s*)service;
+
+	CHECK_NULL(_svc);
+
+	if (limit < 0)
+	{
+		LOGE("[%s] INVALID_PARAMETER(0x%08x) : limit should not be negative."
+			, __FUNCTION__, MESSAGES_ERROR_INVALID_PARAMETER);
+		return MESSAGES_ERROR_INVALID_PARAMETER;
+	}
+
+	_svc->mms_size_limit = limit;
+
+	return MESSAGES_ERROR_NONE;
+}
+
+int messages_mms_estimate_size(messages_service_h service, messages_message_h msg, int *size,
+							int **oversized, int *oversized_count)
+{
+	int i;
+	int ret;
+	int first;
+	messages_message_type_e type;
+
+	messages_service_s *_svc = (messages_service_s*)service;
+	messages_message_s *_msg = (messages_message_s*)msg;
+
+	CHECK_NULL(_svc);
+	CHECK_NULL(_msg);
+	CHECK_NULL(_msg->msg_h);
+	CHECK_NULL(size);
+	CHECK_NULL(oversized);
+	CHECK_NULL(oversized_count);
+
+	messages_get_message_type(msg, &type);
+	if (MESSAGES_TYPE_MMS != type)
+	{
+		LOGE("[%s] INVALID_PARAMETER(0x%08x) : the message type should be MESSAGES_TYPE_MMS"
+			, __FUNCTION__, MESSAGES_ERROR_INVALID_PARAMETER);
+		return MESSAGES_ERROR_INVALID_PARAMETER;
+	}
+
+	ret = _messages_mms_estimate_size(_msg, _svc->mms_size_limit, size, &first);
+	if (MESSAGES_ERROR_NONE != ret)
+	{
+		return ret;
+	}
+
+	*oversized = NULL;
+	*oversized_count = 0;
+
+	if (-1 == first || first >= _msg->attachment_count)
+	{
+		return MESSAGES_ERROR_NONE;
+	}
+
+	*oversized = (int *)malloc(sizeof(int) * (_msg->attachment_count - first));
+	if (NULL == *oversized)
+	{
+		LOGE("[%s] OUT_OF_MEMORY(0x%08x) fail to create 'oversized'."
+			, __FUNCTION__, MESSAGES_ERROR_OUT_OF_MEMORY);
+		return MESSAGES_ERROR_OUT_OF_MEMORY;
+	}
+
+	for (i=first; i < _msg->attachment_count; i++)
+	{
+		(*oversized)[(*oversized_count)++] = i;
+	}
+
+	return MESSAGES_ERROR_NONE;
+}
@@ -0,0 +1,181 @@
+/*
+ * Copyright (c) 2011 Samsung Electronics Co., Ltd All Rights Reserved
+ *
+ * Licensed under the Apache License, Version 2.0 (the License);
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an AS IS BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License. 
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <memory.h>
+
+#include <glib.h>
+
+#include <dlog.h>
+#include <msg.h>
+#include <msg_transport.h>
+
+#include <messages.h>
+#include <messages_types.h>
+#include <messages_private.h>
+
+/*
+ * Per-port routing of incoming SMS.
+ * The table is indexed directly by the destination port, split in pages allocated on first use.
+ * A route is written once and its callback is published last, so delivery reads it without a lock.
+ * The route also records whether the mediator is registered for the port, so that
+ * messages_add_sms_listening_port() and messages_add_sms_listening_port_cb() register it once.
+ * Pages are only freed when the service is closed.
+ */
+
+bool _messages_incoming_route(messages_service_s *svc, messages_message_h msg)
+{
+	int port;
+	messages_port_route_s *page;
+	messages_incoming_cb cb;
+
+	messages_message_s *_msg = (messages_message_s*)msg;
+
+	if (0 == g_atomic_int_get(&svc->port_route_count))
+	{
+		return false;
+	}
+
+	if (MSG_SUCCESS != msg_get_int_value(_msg->msg_h, MSG_MESSAGE_DEST_PORT_INT, &port)
+		|| port <= 0 || MESSAGES_PORT_COUNT <= port)
+	{
+		return false;
+	}
+
+	page = (messages_port_route_s *)g_atomic_pointer_get(&svc->port_routes[port / MESSAGES_PORT_ROUTE_PAGE]);
+	if (NULL == page)
+	{
+		return false;
+	}
+
+	cb = (messages_incoming_cb)g_atomic_pointer_get(&page[port % MESSAGES_PORT_ROUTE_PAGE].cb);
+	if (NULL == cb)
+	{
+		return false;
+	}
+
+	cb(msg, page[port % MESSAGES_PORT_ROUTE_PAGE].user_data);
+
+	return true;
+}
+
+void _messages_port_routes_destroy(messages_service_s *svc)
+{
+	int i;
+
+	for (i=0; i < MESSAGES_PORT_COUNT / MESSAGES_PORT_ROUTE_PAGE; i++)
+	{
+		free(svc->port_routes[i]);
+		svc->port_routes[i] = NULL;
+	}
+	svc->port_route_count = 0;
+}
+
+// Registers the mediator for port unless it already is. Called with port_route_lock held.
+static int _messages_port_register_locked(messages_service_s *svc, int port, messages_port_route_s **route)
+{
+	int ret;
+	messages_port_route_s *page;
+
+	page = svc->port_routes[port / MESSAGES_PORT_ROUTE_PAGE];
+	if (NULL == page)
+	{
+		page = (messages_port_route_s *)calloc(MESSAGES_PORT_ROUTE_PAGE, sizeof(messages_port_route_s));
+		if (NULL == page)
+		{
+			LOGE("[%s] OUT_OF_MEMORY(0x%08x) fail to create a port route page."
+				, __FUNCTION__, MESSAGES_ERROR_OUT_OF_MEMORY);
+			return MESSAGES_ERROR_OUT_OF_MEMORY;
+		}
+		g_atomic_pointer_set(&svc->port_routes[port / MESSAGES_PORT_ROUTE_PAGE], page);
+	}
+
+	*route = &page[port % MESSAGES_PORT_ROUTE_PAGE];
+	if ((*route)->registered)
+	{
+		return MESSAGES_ERROR_NONE;
+	}
+
+	ret = ERROR_CONVERT(
+			msg_reg_sms_message_callback(svc->service_h, &_messages_incoming_mediator_cb, port, (void*)svc)
+		);
+	if (MESSAGES_ERROR_NONE != ret)
+	{
+		return ret;
+	}
+	(*route)->registered = true;
+	svc->incoming_registered = true;
+
+	return MESSAGES_ERROR_NONE;
+}
+
+int _messages_port_register(messages_service_s *svc, int port)
+{
+	int ret;
+	messages_port_route_s *route;
+
+	g_mutex_lock(&svc->port_route_lock);
+	ret = _messages_port_register_locked(svc, port, &route);
+	g_mutex_unlock(&svc->port_route_lock);
+
+	return ret;
+}
+
+int messages_add_sms_listening_port_cb(messages_service_h service, int port, messages_incoming_cb callback, void *user_data)
+{
+	int ret;
+	messages_port_route_s *page;
+	messages_port_route_s *route;
+
+	messages_service_s *_svc = (messages_service_s*)service;
+
+	CHECK_NULL(_svc);
+	CHECK_NULL(callback);
+
+	if (port <= 0 || MESSAGES_PORT_COUNT <= port)
+	{
+		LOGE("[%s] INVALID_PARAMETER(0x%08x) : port %d is out of range."
+			, __FUNCTION__, MESSAGES_ERROR_INVALID_PARAMETER, port);
+		return MESSAGES_ERROR_INVALID_PARAMETER;
+	}
+
+	g_mutex_lock(&_svc->port_route_lock);
+
+	page = _svc->port_routes[port / MESSAGES_PORT_ROUTE_PAGE];
+	if (NULL != page && NULL != page[port % MESSAGES_PORT_ROUTE_PAGE].cb)
+	{
+		g_mutex_unlock(&_svc->port_route_lock);
+		LOGE("[%s] INVALID_PARAMETER(0x%08x) : port %d already has a callback."
+			, __FUNCTION__, MESSAGES_ERROR_INVALID_PARAMETER, port);
+		return MESSAGES_ERROR_INVALID_PARAMETER;
+	}
+
+	ret = _messages_port_register_locked(_svc, port, &route);
+	if (MESSAGES_ERROR_NONE != ret)
+	{
+		g_mutex_unlock(&_svc->port_route_lock);
+		return ret;
+	}
+
+	route->user_data = user_data;
+	g_atomic_pointer_set(&route->cb, (void*)callback);
+	g_atomic_int_inc(&_svc->port_route_count);
+
+	g_mutex_unlock(&_svc->port_route_lock);
+
+	return MESSAGES_ERROR_NONE;
+}
@@ -0,0 +1,258 @@
+/*
+ * Copyright (c) 2011 Samsung Electronics Co., Ltd All Rights Reserved
+ *
+ * Licensed under the Apache License, Version 2.0 (the License);
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an AS IS BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License. 
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#include <glib.h>
+
+#include <dlog.h>
+#include <msg.h>
+
+#include <messages.h>
+#include <messages_types.h>
+#include <messages_private.h>
+
+/*
+ * Attachment readers.
+ * The content is handed out one chunk at a time as a view of the file mapped for that chunk only,
+ * so reading a large attachment needs no more memory than one chunk. Files which can not be mapped
+ * are read into a single buffer of the chunk size instead.
+ * Touching a mapped page past the end of a truncated file raises SIGBUS, so the size is checked
+ * before each mapping, and a file found shorter than when it was opened is read from then on.
+ */
+
+static void _messages_reader_unmap(messages_attachment_reader_s *reader)
+{
+	if (NULL != reader->map)
+	{
+		munmap(reader->map, reader->map_len);
+		reader->map = NULL;
+		reader->map_len = 0;
+	}
+}
+
+int messages_mms_open_attachment(messages_message_h msg, int index, int chunk_size, bool checksum,
+								messages_attachment_reader_h *reader)
+{
+	long page;
+	struct stat st;
+	messages_attachment_reader_s *_reader;
+
+	messages_message_s *_msg = (messages_message_s*)msg;
+
+	CHECK_NULL(_msg);
+	CHECK_NULL(reader);
+
+	if (index < 0 || index >= _msg->attachment_count
+		|| chunk_size < 0 || MESSAGES_READER_MAX_CHUNK < chunk_size)
+	{
+		LOGE("[%s] INVALID_PARAMETER(0x%08x) : index or chunk_size is out of range."
+			, __FUNCTION__, MESSAGES_ERROR_INVALID_PARAMETER);
+		return MESSAGES_ERROR_INVALID_PARAMETER;
+	}
+
+	_reader = (messages_attachment_reader_s *)calloc(1, sizeof(messages_attachment_reader_s));
+	if (NULL == _reader)
+	{
+		LOGE("[%s] OUT_OF_MEMORY(0x%08x) fail to create a 'reader'."
+			, __FUNCTION__, MESSAGES_ERROR_OUT_OF_MEMORY);
+		return MESSAGES_ERROR_OUT_OF_MEMORY;
+	}
+
+	_reader->fd = open(_msg->attachments[index].filepath, O_RDONLY);
+	if (_reader->fd < 0 || 0 != fstat(_reader->fd, &st))
+	{
+		LOGE("[%s] OPERATION_FAILED(0x%08x) : fail to open '%s' (%d)."
+			, __FUNCTION__, MESSAGES_ERROR_OPERATION_FAILED, _msg->attachments[index].filepath, errno);
+		if (0 <= _reader->fd)
+		{
+			close(_reader->fd);
+		}
+		free(_reader);
+		return MESSAGES_ERROR_OPERATION_FAILED;
+	}
+
+	// Views start on page boundaries, so the chunk is rounded up to whole pages.
+	page = sysconf(_SC_PAGESIZE);
+	if (page <= 0)
+	{
+		page = 4096;
+	}
+	if (0 == chunk_size)
+	{
+		chunk_size = MESSAGES_READER_DEFAULT_CHUNK;
+	}
+	_reader->chunk = ((size_t)chunk_size + page - 1) / page * page;
+
+	_reader->size = st.st_size;
+	_reader->checksum_enabled = checksum;
+	_reader->checksum = MESSAGES_HASH_INIT;
+
+	*reader = (messages_attachment_reader_h)_reader;
+
+	return MESSAGES_ERROR_NONE;
+}
+
+int messages_attachment_reader_get_size(messages_attachment_reader_h reader, long long *size)
+{
+	messages_attachment_reader_s *_reader = (messages_attachment_reader_s*)reader;
+
+	CHECK_NULL(_reader);
+	CHECK_NULL(size);
+
+	*size = (long long)_reader->size;
+
+	return MESSAGES_ERROR_NONE;
+}
+
+int messages_attachment_reader_read(messages_attachment_reader_h reader, const void **data, int *length)
+{
+	ssize_t len;
+	size_t want;
+	size_t done;
+	struct stat st;
+
+	messages_attachment_reader_s *_reader = (messages_attachment_reader_s*)reader;
+
+	CHECK_NULL(_reader);
+	CHECK_NULL(data);
+	CHECK_NULL(length);
+
+	_messages_reader_unmap(_reader);
+
+	*data = NULL;
+	*length = 0;
+
+	if (_reader->offset >= _reader->size)
+	{
+		return MESSAGES_ERROR_NONE;
+	}
+
+	want = _reader->chunk;
+	if ((off_t)want > _reader->size - _reader->offset)
+	{
+		want = (size_t)(_reader->size - _reader->offset);
+	}
+
+	if (NULL == _reader->buffer && 0 == fstat(_reader->fd, &st) && st.st_size >= _reader->size)
+	{
+		_reader->map = mmap(NULL, want, PROT_READ, MAP_PRIVATE, _reader->fd, _reader->offset);
+		if (MAP_FAILED != _reader->map)
+		{
+			_reader->map_len = want;
+			madvise(_reader->map, want, MADV_SEQUENTIAL);
+			*data = _reader->map;
+		}
+		else
+		{
+			_reader->map = NULL;
+		}
+	}
+
+	if (NULL == *data)
+	{
+		if (NULL == _reader->buffer)
+		{
+			_reader->buffer = (char *)malloc(_reader->chunk);
+			if (NULL == _reader->buffer)
+			{
+				LOGE("[%s] OUT_OF_MEMORY(0x%08x) fail to create a 'buffer'."
+					, __FUNCTION__, MESSAGES_ERROR_OUT_OF_MEMORY);
+				return MESSAGES_ERROR_OUT_OF_MEMORY;
+			}
+		}
+
+		for (done=0; done < want; done += len)
+		{
+			len = pread(_reader->fd, _reader->buffer + done, want - done, _reader->offset + done);
+			if (len < 0 && EINTR == errno)
+			{
+				len = 0;
+				continue;
+			}
+			if (len <= 0)
+			{
+				break;
+			}
+		}
+
+		if (0 == done && want > 0)
+		{
+			LOGE("[%s] OPERATION_FAILED(0x%08x) : fail to read the attachment (%d)."
+				, __FUNCTION__, MESSAGES_ERROR_OPERATION_FAILED, errno);
+			return MESSAGES_ERROR_OPERATION_FAILED;
+		}
+
+		// The file got shorter while it was read.
+		if (done < want)
+		{
+			_reader->size = _reader->offset + done;
+			want = done;
+		}
+
+		*data = _reader->buffer;
+	}
+
+	if (_reader->checksum_enabled)
+	{
+		_reader->checksum = _messages_hash_bytes(_reader->checksum, *data, want);
+	}
+
+	_reader->offset += want;
+	*length = (int)want;
+
+	return MESSAGES_ERROR_NONE;
+}
+
+int messages_attachment_reader_get_checksum(messages_attachment_reader_h reader, unsigned long long *checksum)
+{
+	messages_attachment_reader_s *_reader = (messages_attachment_reader_s*)reader;
+
+	CHECK_NULL(_reader);
+	CHECK_NULL(checksum);
+
+	if (!_reader->checksum_enabled)
+	{
+		LOGE("[%s] INVALID_PARAMETER(0x%08x) : the reader was opened without a checksum."
+			, __FUNCTION__, MESSAGES_ERROR_INVALID_PARAMETER);
+		return MESSAGES_ERROR_INVALID_PARAMETER;
+	}
+
+	*checksum = _reader->checksum;
+
+	return MESSAGES_ERROR_NONE;
+}
+
+int messages_attachment_reader_close(messages_attachment_reader_h reader)
+{
+	messages_attachment_reader_s *_reader = (messages_attachment_reader_s*)reader;
+
+	CHECK_NULL(_reader);
+
+	_messages_reader_unmap(_reader);
+	close(_reader->fd);
+	free(_reader->buffer);
+	free(_reader);
+
+	return MESSAGES_ERROR_NONE;
+}
@@ -0,0 +1,964 @@
+/*
+ * Copyright (c) 2011 Samsung Electronics Co., Ltd All Rights Reserved
+ *
+ * Licensed under the Apache License, Version 2.0 (the License);
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an AS IS BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License. 
+ */
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <memory.h>
+
+#include <glib.h>
+
+#include <dlog.h>
+#include <msg.h>
+
+#include <messages.h>
+#include <messages_types.h>
+#include <messages_private.h>
+
+/*
+ * Sending retries and the outbox journal.
+ * A message sent while retries or the journal are enabled is cloned into a retry entry, which lives
+ * until the message is sent or given up. Failed sendings are retried from the service timer wheel
+ * with an exponential backoff. A scheduled sending is an entry whose first attempt waits on the wheel as well.
+ *
+ * The journal is an append-only file of records:
+ *   guint32 length, guint32 check, then length bytes of body: guint32 op, guint32 id, [message]
+ * A scheduled sending keeps its time in the record, so it is not sent early after a restart.
+ * An ADD record holds the message and a DONE record closes it. Records are buffered and written
+ * with a single fdatasync() per MESSAGES_JOURNAL_COMMIT_MSEC, so a crash loses at most the records
+ * of that interval. On replay, reading stops at the first torn record.
+ * The ADD records of the unfinished sendings are also kept in memory. Once the file passes
+ * MESSAGES_JOURNAL_COMPACT_SIZE and is mostly closed records, it is replaced by a file holding
+ * only those, so it stays bounded in a long-running process.
+ */
+
+enum {
+	JOURNAL_OP_ADD = 1,
+	JOURNAL_OP_DONE = 2,
+};
+
+#define JOURNAL_HEADER_LEN	(2 * sizeof(guint32))
+
+static int _messages_journal_reserve(messages_journal_s *journal, int len)
+{
+	int size;
+	char *buffer;
+
+	if (journal->length + len <= journal->size)
+	{
+		return MESSAGES_ERROR_NONE;
+	}
+
+	size = MAX(journal->size * 2, journal->length + len);
+	size = MAX(size, 4096);
+
+	buffer = (char *)realloc(journal->buffer, size);
+	if (NULL == buffer)
+	{
+		LOGE("[%s] OUT_OF_MEMORY(0x%08x) fail to grow the journal buffer."
+			, __FUNCTION__, MESSAGES_ERROR_OUT_OF_MEMORY);
+		return MESSAGES_ERROR_OUT_OF_MEMORY;
+	}
+
+	journal->buffer = buffer;
+	journal->size = size;
+
+	return MESSAGES_ERROR_NONE;
+}
+
+static int _messages_journal_put(messages_journal_s *journal, const void *data, int len)
+{
+	int ret;
+
+	ret = _messages_journal_reserve(journal, len);
+	if (MESSAGES_ERROR_NONE != ret)
+	{
+		return ret;
+	}
+
+	memcpy(journal->buffer + journal->length, data, len);
+	journal->length += len;
+
+	return MESSAGES_ERROR_NONE;
+}
+
+static int _messages_journal_put_int(messages_journal_s *journal, int value)
+{
+	guint32 _value = (guint32)value;
+
+	return _messages_journal_put(journal, &_value, sizeof(_value));
+}
+
+static int _messages_journal_put_str(messages_journal_s *journal, const char *str)
+{
+	int ret;
+	int len = (NULL != str) ? strlen(str) : 0;
+
+	ret = _messages_journal_put_int(journal, len);
+	if (MESSAGES_ERROR_NONE == ret)
+	{
+		ret = _messages_journal_put(journal, str, len);
+	}
+
+	return ret;
+}
+
+static int _messages_journal_put_message(messages_journal_s *journal, messages_retry_s *retry)
+{
+	int i;
+	int ret;
+	int count = 0;
+	int media_type;
+	char *str = NULL;
+	gint64 when = retry->when;
+	messages_message_h msg = retry->msg;
+	messages_message_type_e type;
+	messages_recipient_type_e recipient_type;
+
+	ret = messages_get_message_type(msg, &type);
+	ret |= _messages_journal_put_int(journal, type);
+	ret |= _messages_journal_put_int(journal, retry->save_to_sentbox);
+	ret |= _messages_journal_put(journal, &when, sizeof(when));
+
+	messages_get_address_count(msg, &count);
+	ret |= _messages_journal_put_int(journal, count);
+	for (i=0; i < count; i++)
+	{
+		str = NULL;
+		recipient_type = MESSAGES_RECIPIENT_TO;
+		messages_get_address(msg, i, &str, &recipient_type);
+		ret |= _messages_journal_put_int(journal, recipient_type);
+		ret |= _messages_journal_put_str(journal, str);
+		free(str);
+	}
+
+	str = NULL;
+	messages_get_text(msg, &str);
+	ret |= _messages_journal_put_str(journal, str);
+	free(str);
+
+	str = NULL;
+	if (MESSAGES_TYPE_MMS == type)
+	{
+		messages_mms_get_subject(msg, &str);
+	}
+	ret |= _messages_journal_put_str(journal, str);
+	free(str);
+
+	count = 0;
+	if (MESSAGES_TYPE_MMS == type)
+	{
+		messages_mms_get_attachment_count(msg, &count);
+	}
+	ret |= _messages_journal_put_int(journal, count);
+	for (i=0; i < count; i++)
+	{
+		str = NULL;
+		media_type = MESSAGES_MEDIA_UNKNOWN;
+		messages_mms_get_attachment(msg, i, (messages_media_type_e *)&media_type, &str);
+		ret |= _messages_journal_put_int(journal, media_type);
+		ret |= _messages_journal_put_str(journal, str);
+		free(str);
+	}
+
+	return (MESSAGES_ERROR_NONE == ret) ? MESSAGES_ERROR_NONE : MESSAGES_ERROR_OPERATION_FAILED;
+}
+
+static int _messages_journal_write(int fd, const char *data, int len)
+{
+	ssize_t written;
+
+	while (len > 0)
+	{
+		written = write(fd, data, len);
+		if (written < 0)
+		{
+			if (EINTR == errno)
+			{
+				continue;
+			}
+			return MESSAGES_ERROR_OPERATION_FAILED;
+		}
+		data += written;
+		len -= written;
+	}
+
+	return MESSAGES_ERROR_NONE;
+}
+
+static int _messages_journal_record_len(const char *record)
+{
+	guint32 len;
+
+	memcpy(&len, record, sizeof(len));
+
+	return JOURNAL_HEADER_LEN + len;
+}
+
+static gint _messages_journal_compare_id(gconstpointer a, gconstpointer b)
+{
+	return GPOINTER_TO_INT(a) - GPOINTER_TO_INT(b);
+}
+
+// Replaces the file by one holding the live records only, in the order they were added.
+// Must be called with journal->lock held and nothing left to commit.
+static void _messages_journal_compact(messages_journal_s *journal)
+{
+	int fd;
+	int ret = MESSAGES_ERROR_NONE;
+	char *tmp_path;
+	const char *record;
+	GList *ids;
+	GList *iter;
+
+	if (0 == g_hash_table_size(journal->live))
+	{
+		if (0 != ftruncate(journal->fd, 0) || 0 != fsync(journal->fd))
+		{
+			LOGW("[%s] fail to truncate the journal, errno = %d.", __FUNCTION__, errno);
+			return;
+		}
+		journal->file_size = 0;
+		return;
+	}
+
+	tmp_path = g_strdup_printf("%s.tmp", journal->path);
+
+	fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+	if (fd < 0)
+	{
+		ret = MESSAGES_ERROR_OPERATION_FAILED;
+	}
+
+	ids = g_list_sort(g_hash_table_get_keys(journal->live), _messages_journal_compare_id);
+	for (iter = ids; iter && MESSAGES_ERROR_NONE == ret; iter = g_list_next(iter))
+	{
+		record = (const char *)g_hash_table_lookup(journal->live, iter->data);
+		ret = _messages_journal_write(fd, record, _messages_journal_record_len(record));
+	}
+	g_list_free(ids);
+
+	if (fd >= 0)
+	{
+		if (MESSAGES_ERROR_NONE == ret && 0 != fsync(fd))
+		{
+			ret = MESSAGES_ERROR_OPERATION_FAILED;
+		}
+		close(fd);
+	}
+
+	if (MESSAGES_ERROR_NONE == ret && 0 != rename(tmp_path, journal->path))
+	{
+		ret = MESSAGES_ERROR_OPERATION_FAILED;
+	}
+
+	if (MESSAGES_ERROR_NONE == ret)
+	{
+		fd = open(journal->path, O_WRONLY | O_APPEND);
+		if (fd >= 0)
+		{
+			close(journal->fd);
+			journal->fd = fd;
+			journal->file_size = journal->live_size;
+		}
+		else
+		{
+			ret = MESSAGES_ERROR_OPERATION_FAILED;
+		}
+	}
+
+	if (MESSAGES_ERROR_NONE != ret)
+	{
+		// The current file is still complete, it is compacted again on the next commit.
+		LOGW("[%s] fail to compact the journal '%s', errno = %d.", __FUNCTION__, journal->path, errno);
+		unlink(tmp_path);
+	}
+
+	g_free(tmp_path);
+}
+
+// Must be called with journal->lock held.
+static void _messages_journal_commit(messages_journal_s *journal)
+{
+	if (0 == journal->length)
+	{
+		return;
+	}
+
+	if (MESSAGES_ERROR_NONE != _messages_journal_write(journal->fd, journal->buffer, journal->length)
+		|| 0 != fdatasync(journal->fd))
+	{
+		LOGE("[%s] OPERATION_FAILED(0x%08x) : fail to write the journal, errno = %d."
+			, __FUNCTION__, MESSAGES_ERROR_OPERATION_FAILED, errno);
+	}
+
+	journal->file_size += journal->length;
+	journal->length = 0;
+
+	if (journal->file_size >= MESSAGES_JOURNAL_COMPACT_SIZE && journal->file_size >= 2 * journal->live_size)
+	{
+		_messages_journal_compact(journal);
+	}
+}
+
+static gboolean _messages_journal_commit_cb(gpointer user_data)
+{
+	messages_journal_s *journal = (messages_journal_s *)user_data;
+
+	g_mutex_lock(&journal->lock);
+	if (journal->commit_id == g_source_get_id(g_main_current_source()))
+	{
+		journal->commit_id = 0;
+	}
+	_messages_journal_commit(journal);
+	g_mutex_unlock(&journal->lock);
+
+	return FALSE;
+}
+
+static void _messages_journal_append(messages_journal_s *journal, int op, int id, messages_retry_s *retry)
+{
+	int ret;
+	int start;
+	char *record;
+	guint32 header[2];
+
+	g_mutex_lock(&journal->lock);
+
+	if (journal->closed)
+	{
+		g_mutex_unlock(&journal->lock);
+		return;
+	}
+
+	start = journal->length;
+	ret = _messages_journal_reserve(journal, JOURNAL_HEADER_LEN);
+	if (MESSAGES_ERROR_NONE == ret)
+	{
+		journal->length += JOURNAL_HEADER_LEN;
+		ret = _messages_journal_put_int(journal, op);
+		ret |= _messages_journal_put_int(journal, id);
+		if (NULL != retry)
+		{
+			ret |= _messages_journal_put_message(journal, retry);
+		}
+	}
+
+	if (MESSAGES_ERROR_NONE != ret)
+	{
+		LOGE("[%s] OPERATION_FAILED(0x%08x) : fail to journal request %d."
+			, __FUNCTION__, MESSAGES_ERROR_OPERATION_FAILED, id);
+		journal->length = start;
+		g_mutex_unlock(&journal->lock);
+		return;
+	}
+
+	header[0] = journal->length - start - JOURNAL_HEADER_LEN;
+	header[1] = (guint32)_messages_hash_bytes(MESSAGES_HASH_INIT, journal->buffer + start + JOURNAL_HEADER_LEN, header[0]);
+	memcpy(journal->buffer + start, header, JOURNAL_HEADER_LEN);
+
+	if (JOURNAL_OP_ADD == op)
+	{
+		record = g_memdup(journal->buffer + start, journal->length - start);
+		g_hash_table_replace(journal->live, GINT_TO_POINTER(id), record);
+		journal->live_size += journal->length - start;
+	}
+	else
+	{
+		record = g_hash_table_lookup(journal->live, GINT_TO_POINTER(id));
+		if (NULL != record)
+		{
+			journal->live_size -= _messages_journal_record_len(record);
+			g_hash_table_remove(journal->live, GINT_TO_POINTER(id));
+		}
+	}
+
+	if (journal->length >= MESSAGES_JOURNAL_COMMIT_SIZE)
+	{
+		_messages_journal_commit(journal);
+	}
+	else if (0 == journal->commit_id)
+	{
+		journal->commit_id = g_timeout_add_full(G_PRIORITY_DEFAULT, MESSAGES_JOURNAL_COMMIT_MSEC,
+				_messages_journal_commit_cb, _messages_journal_ref(journal), _messages_journal_unref);
+	}
+
+	g_mutex_unlock(&journal->lock);
+}
+
+messages_journal_s *_messages_journal_ref(messages_journal_s *journal)
+{
+	if (NULL != journal)
+	{
+		g_atomic_int_inc(&journal->ref);
+	}
+
+	return journal;
+}
+
+void _messages_journal_unref(gpointer data)
+{
+	messages_journal_s *journal = (messages_journal_s *)data;
+
+	if (NULL == journal || !g_atomic_int_dec_and_test(&journal->ref))
+	{
+		return;
+	}
+
+	close(journal->fd);
+	g_mutex_clear(&journal->lock);
+	g_hash_table_destroy(journal->live);
+	g_free(journal->path);
+	free(journal->buffer);
+	free(journal);
+}
+
+// Commits the pending records and drops the reference of the service.
+// A commit timer which is already running holds its own reference, so it never sees a freed journal.
+void _messages_journal_close(messages_journal_s *journal)
+{
+	if (NULL == journal)
+	{
+		return;
+	}
+
+	g_mutex_lock(&journal->lock);
+	journal->closed = true;
+	if (0 != journal->commit_id)
+	{
+		g_source_remove(journal->commit_id);
+		journal->commit_id = 0;
+	}
+	_messages_journal_commit(journal);
+	g_mutex_unlock(&journal->lock);
+
+	_messages_journal_unref(journal);
+}
+
+static bool _messages_journal_get_int(const char **p, const char *end, int *value)
+{
+	guint32 _value;
+
+	if (end - *p < (int)sizeof(_value))
+	{
+		return false;
+	}
+
+	memcpy(&_value, *p, sizeof(_value));
+	*p += sizeof(_value);
+	*value = (int)_value;
+
+	return true;
+}
+
+static bool _messages_journal_get_str(const char **p, const char *end, char **str)
+{
+	int len;
+
+	if (!_messages_journal_get_int(p, end, &len) || len < 0 || end - *p < len)
+	{
+		return false;
+	}
+
+	*str = (char *)calloc(1, len + 1);
+	if (NULL == *str)
+	{
+		return false;
+	}
+
+	memcpy(*str, *p, len);
+	*p += len;
+
+	return true;
+}
+
+static messages_message_h _messages_journal_get_message(const char *p, const char *end, bool *save_to_sentbox, gint64 *when)
+{
+	int i;
+	int type;
+	int save;
+	int count;
+	int value;
+	bool ok;
+	char *str = NULL;
+	messages_message_h msg = NULL;
+
+	if (!_messages_journal_get_int(&p, end, &type) || !_messages_journal_get_int(&p, end, &save)
+		|| end - p < (int)sizeof(*when) || MESSAGES_ERROR_NONE != messages_create_message(type, &msg))
+	{
+		return NULL;
+	}
+	*save_to_sentbox = save;
+	memcpy(when, p, sizeof(*when));
+	p += sizeof(*when);
+
+	ok = _messages_journal_get_int(&p, end, &count);
+	for (i=0; ok && i < count; i++)
+	{
+		ok = _messages_journal_get_int(&p, end, &value) && _messages_journal_get_str(&p, end, &str);
+		if (ok)
+		{
+			ok = (MESSAGES_ERROR_NONE == messages_add_address(msg, str, value));
+			free(str);
+		}
+	}
+
+	if (ok && (ok = _messages_journal_get_str(&p, end, &str)))
+	{
+		if ('\0' != str[0])
+		{
+			ok = (MESSAGES_ERROR_NONE == messages_set_text(msg, str));
+		}
+		free(str);
+	}
+
+	if (ok && (ok = _messages_journal_get_str(&p, end, &str)))
+	{
+		if ('\0' != str[0])
+		{
+			ok = (MESSAGES_ERROR_NONE == messages_mms_set_subject(msg, str));
+		}
+		free(str);
+	}
+
+	ok = ok && _messages_journal_get_int(&p, end, &count);
+	for (i=0; ok && i < count; i++)
+	{
+		ok = _messages_journal_get_int(&p, end, &value) && _messages_journal_get_str(&p, end, &str);
+		if (ok)
+		{
+			ok = (MESSAGES_ERROR_NONE == messages_mms_add_attachment(msg, value, str));
+			free(str);
+		}
+	}
+
+	if (!ok)
+	{
+		messages_destroy_message(msg);
+		return NULL;
+	}
+
+	return msg;
+}
+
+static int _messages_journal_read(const char *path, char **data, int *len)
+{
+	int fd;
+	struct stat st;
+
+	*data = NULL;
+	*len = 0;
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0)
+	{
+		return (ENOENT == errno) ? MESSAGES_ERROR_NONE : MESSAGES_ERROR_OPERATION_FAILED;
+	}
+
+	if (0 != fstat(fd, &st))
+	{
+		close(fd);
+		return MESSAGES_ERROR_OPERATION_FAILED;
+	}
+
+	*data = (char *)malloc(st.st_size + 1);
+	if (NULL == *data)
+	{
+		close(fd);
+		return MESSAGES_ERROR_OUT_OF_MEMORY;
+	}
+
+	*len = read(fd, *data, st.st_size);
+	close(fd);
+
+	if (*len < 0)
+	{
+		free(*data);
+		*data = NULL;
+		*len = 0;
+		return MESSAGES_ERROR_OPERATION_FAILED;
+	}
+
+	return MESSAGES_ERROR_NONE;
+}
+
+// Calls func for each intact record of data, in order. Returns the length of the intact part.
+static int _messages_journal_foreach(const char *data, int len,
+						void (*func)(const char *record, int record_len, int op, int id, void *user_data), void *user_data)
+{
+	int op;
+	int id;
+	guint32 header[2];
+	const char *p = data;
+	const char *body;
+	const char *end = data + len;
+
+	while (end - p >= (int)JOURNAL_HEADER_LEN)
+	{
+		memcpy(header, p, JOURNAL_HEADER_LEN);
+		body = p + JOURNAL_HEADER_LEN;
+
+		if (header[0] > (guint32)(end - body)
+			|| header[1] != (guint32)_messages_hash_bytes(MESSAGES_HASH_INIT, body, header[0])
+			|| !_messages_journal_get_int(&body, body + header[0], &op)
+			|| !_messages_journal_get_int(&body, p + JOURNAL_HEADER_LEN + header[0], &id))
+		{
+			LOGW("[%s] the journal is torn at %d of %d bytes.", __FUNCTION__, (int)(p - data), len);
+			break;
+		}
+
+		func(p, JOURNAL_HEADER_LEN + header[0], op, id, user_data);
+		p += JOURNAL_HEADER_LEN + header[0];
+	}
+
+	return p - data;
+}
+
+typedef struct {
+	GHashTable *live;	/* id -> ADD record */
+	int max_id;
+} messages_journal_scan_s;
+
+static void _messages_journal_scan_cb(const char *record, int record_len, int op, int id, void *user_data)
+{
+	messages_journal_scan_s *scan = (messages_journal_scan_s *)user_data;
+
+	if (JOURNAL_OP_ADD == op)
+	{
+		g_hash_table_insert(scan->live, GINT_TO_POINTER(id), (gpointer)record);
+	}
+	else if (JOURNAL_OP_DONE == op)
+	{
+		g_hash_table_remove(scan->live, GINT_TO_POINTER(id));
+	}
+
+	scan->max_id = MAX(scan->max_id, id);
+}
+
+typedef struct {
+	GHashTable *live;
+	GHashTable *records;	/* id -> copy of each rewritten record, kept by the journal */
+	gint64 size;
+	int fd;
+	int ret;
+	GSList *retries;	/* restored requests, sent once the journal is rewritten */
+	messages_service_s *svc;
+} messages_journal_replay_s;
+
+static void _messages_journal_replay_cb(const char *record, int record_len, int op, int id, void *user_data)
+{
+	bool save_to_sentbox = false;
+	gint64 when = 0;
+	messages_message_h msg;
+	messages_retry_s *retry;
+	messages_journal_replay_s *replay = (messages_journal_replay_s *)user_data;
+
+	if (JOURNAL_OP_ADD != op || record != g_hash_table_lookup(replay->live, GINT_TO_POINTER(id)))
+	{
+		return;
+	}
+
+	if (MESSAGES_ERROR_NONE == replay->ret)
+	{
+		replay->ret = _messages_journal_write(replay->fd, record, record_len);
+	}
+	g_hash_table_replace(replay->records, GINT_TO_POINTER(id), g_memdup(record, record_len));
+	replay->size += record_len;
+
+	msg = _messages_journal_get_message(record + JOURNAL_HEADER_LEN + 2 * sizeof(guint32), record + record_len, &save_to_sentbox, &when);
+	if (NULL == msg)
+	{
+		LOGW("[%s] journaled request %d can not be restored.", __FUNCTION__, id);
+		return;
+	}
+
+	retry = (messages_retry_s *)calloc(1, sizeof(messages_retry_s));
+	if (NULL == retry)
+	{
+		messages_destroy_message(msg);
+		return;
+	}
+
+	retry->timer.kind = MESSAGES_TIMER_RETRY;
+	retry->request_id = _messages_new_request_id(replay->svc);
+	retry->id = id;
+	retry->msg = msg;
+	retry->save_to_sentbox = save_to_sentbox;
+	retry->when = (time_t)when;
+
+	replay->retries = g_slist_prepend(replay->retries, retry);
+}
+
+static void _messages_journal_release_retry(gpointer data)
+{
+	_messages_retry_release((messages_retry_s *)data);
+}
+
+// Loads the unfinished sendings of the journal at path and rewrites the journal with them only.
+// The restored sendings are returned in retries, and only if the journal is ready to record them.
+static int _messages_journal_open(messages_service_s *svc, const char *path, messages_journal_s **journal, GSList **retries)
+{
+	int ret;
+	int len;
+	char *data;
+	char *tmp_path;
+	messages_journal_scan_s scan;
+	messages_journal_replay_s replay;
+
+	ret = _messages_journal_read(path, &data, &len);
+	if (MESSAGES_ERROR_NONE != ret)
+	{
+		LOGE("[%s] OPERATION_FAILED(0x%08x) : fail to read the journal '%s'."
+			, __FUNCTION__, ret, path);
+		return ret;
+	}
+
+	tmp_path = g_strdup_printf("%s.tmp", path);
+
+	memset(&scan, 0, sizeof(scan));
+	scan.live = g_hash_table_new(g_direct_hash, g_direct_equal);
+	len = _messages_journal_foreach(data, len, _messages_journal_scan_cb, &scan);
+
+	memset(&replay, 0, sizeof(replay));
+	replay.live = scan.live;
+	replay.records = g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL, g_free);
+	replay.svc = svc;
+	replay.fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+	replay.ret = (replay.fd < 0) ? MESSAGES_ERROR_OPERATION_FAILED : MESSAGES_ERROR_NONE;
+
+	_messages_journal_foreach(data, len, _messages_journal_replay_cb, &replay);
+
+	if (replay.fd >= 0)
+	{
+		if (MESSAGES_ERROR_NONE == replay.ret && 0 != fsync(replay.fd))
+		{
+			replay.ret = MESSAGES_ERROR_OPERATION_FAILED;
+		}
+		close(replay.fd);
+	}
+
+	if (MESSAGES_ERROR_NONE == replay.ret && 0 != rename(tmp_path, path))
+	{
+		replay.ret = MESSAGES_ERROR_OPERATION_FAILED;
+	}
+
+	g_hash_table_destroy(scan.live);
+	g_free(tmp_path);
+	free(data);
+
+	// The restored sendings stay in the old journal for the next attempt.
+	if (MESSAGES_ERROR_NONE != replay.ret)
+	{
+		LOGE("[%s] OPERATION_FAILED(0x%08x) : fail to rewrite the journal '%s', errno = %d."
+			, __FUNCTION__, MESSAGES_ERROR_OPERATION_FAILED, path, errno);
+		g_slist_free_full(replay.retries, _messages_journal_release_retry);
+		g_hash_table_destroy(replay.records);
+		return MESSAGES_ERROR_OPERATION_FAILED;
+	}
+
+	*journal = (messages_journal_s *)calloc(1, sizeof(messages_journal_s));
+	if (NULL == *journal)
+	{
+		LOGE("[%s] OUT_OF_MEMORY(0x%08x) fail to create a journal."
+			, __FUNCTION__, MESSAGES_ERROR_OUT_OF_MEMORY);
+		g_slist_free_full(replay.retries, _messages_journal_release_retry);
+		g_hash_table_destroy(replay.records);
+		return MESSAGES_ERROR_OUT_OF_MEMORY;
+	}
+
+	(*journal)->fd = open(path, O_WRONLY | O_APPEND | O_CREAT, 0600);
+	if ((*journal)->fd < 0)
+	{
+		LOGE("[%s] OPERATION_FAILED(0x%08x) : fail to open the journal '%s', errno = %d."
+			, __FUNCTION__, MESSAGES_ERROR_OPERATION_FAILED, path, errno);
+		free(*journal);
+		*journal = NULL;
+		g_slist_free_full(replay.retries, _messages_journal_release_retry);
+		g_hash_table_destroy(replay.records);
+		return MESSAGES_ERROR_OPERATION_FAILED;
+	}
+
+	(*journal)->ref = 1;
+	(*journal)->path = g_strdup(path);
+	(*journal)->live = replay.records;
+	(*journal)->live_size = replay.size;
+	(*journal)->file_size = replay.size;
+	(*journal)->next_id = scan.max_id + 1;
+	g_mutex_init(&(*journal)->lock);
+
+	*retries = g_slist_reverse(replay.retries);
+
+	return MESSAGES_ERROR_NONE;
+}
+
+messages_retry_s *_messages_retry_create(messages_service_s *svc, messages_message_h msg, bool save_to_sentbox,
+							messages_sent_cb callback, void *user_data, int request_id, time_t when)
+{
+	messages_retry_s *retry;
+
+	retry = (messages_retry_s *)calloc(1, sizeof(messages_retry_s));
+	if (NULL == retry)
+	{
+		LOGE("[%s] OUT_OF_MEMORY(0x%08x) fail to create a retry."
+			, __FUNCTION__, MESSAGES_ERROR_OUT_OF_MEMORY);
+		return NULL;
+	}
+
+	if (MESSAGES_ERROR_NONE != messages_clone_message(msg, &retry->msg))
+	{
+		free(retry);
+		return NULL;
+	}
+
+	retry->timer.kind = MESSAGES_TIMER_RETRY;
+	retry->request_id = request_id;
+	retry->when = when;
+	retry->save_to_sentbox = save_to_sentbox;
+	retry->callback = (void *)callback;
+	retry->user_data = user_data;
+
+	// The retry keeps the journal it is recorded in, so its DONE record goes there even if the journal is replaced.
+	g_mutex_lock(&svc->journal_lock);
+	retry->journal = _messages_journal_ref(svc->journal);
+	g_mutex_unlock(&svc->journal_lock);
+
+	if (NULL != retry->journal)
+	{
+		g_mutex_lock(&retry->journal->lock);
+		retry->id = retry->journal->next_id++;
+		g_mutex_unlock(&retry->journal->lock);
+
+		_messages_journal_append(retry->journal, JOURNAL_OP_ADD, retry->id, retry);
+	}
+
+	return retry;
+}
+
+bool _messages_retry_schedule(messages_service_s *svc, messages_retry_s *retry)
+{
+	int delay;
+
+	if (retry->attempts >= svc->retry_limit)
+	{
+		return false;
+	}
+
+	// Exponential backoff with half of the delay randomized, so failed senders do not retry in step.
+	delay = (int)MIN((gint64)svc->retry_delay << MIN(retry->attempts, 16), (gint64)MESSAGES_RETRY_MAX_DELAY);
+	delay = delay / 2 + g_random_int_range(0, delay - delay / 2 + 1);
+	retry->attempts++;
+
+	LOGI("[%s] retry %d of %d in %d seconds.", __FUNCTION__, retry->attempts, svc->retry_limit, delay);
+
+	_messages_add_timer(svc, &retry->timer, delay);
+
+	return true;
+}
+
+int _messages_retry_delay_until(time_t when)
+{
+	time_t now = time(NULL);
+
+	if (0 == when || when <= now)
+	{
+		return 0;
+	}
+
+	return (int)MIN(when - now, (time_t)G_MAXINT);
+}
+
+void _messages_retry_release(messages_retry_s *retry)
+{
+	_messages_journal_unref(retry->journal);
+	messages_destroy_message(retry->msg);
+	free(retry);
+}
+
+void _messages_retry_finish(messages_service_s *svc, messages_retry_s *retry)
+{
+	if (NULL != retry->journal && 0 != retry->id)
+	{
+		_messages_journal_append(retry->journal, JOURNAL_OP_DONE, retry->id, NULL);
+	}
+
+	_messages_retry_release(retry);
+}
+
+int messages_set_sending_retry(messages_service_h service, int max_retries, int delay)
+{
+	messages_service_s *_svc = (messages_service_s*)service;
+
+	CHECK_NULL(_svc);
+
+	if (max_retries < 0 || delay <= 0 || MESSAGES_RETRY_MAX_DELAY < delay)
+	{
+		LOGE("[%s] INVALID_PARAMETER(0x%08x) : max_retries should not be negative and delay should be from 1 to %d."
+			, __FUNCTION__, MESSAGES_ERROR_INVALID_PARAMETER, MESSAGES_RETRY_MAX_DELAY);
+		return MESSAGES_ERROR_INVALID_PARAMETER;
+	}
+
+	_svc->retry_limit = max_retries;
+	_svc->retry_delay = delay;
+
+	return MESSAGES_ERROR_NONE;
+}
+
+int messages_set_outbox_journal(messages_service_h service, const char *path)
+{
+	int ret = MESSAGES_ERROR_NONE;
+	GSList *iter;
+	GSList *retries = NULL;
+	messages_retry_s *retry;
+	messages_journal_s *journal = NULL;
+
+	messages_service_s *_svc = (messages_service_s*)service;
+
+	CHECK_NULL(_svc);
+
+	// Held while the journal is replaced, so senders see either the old one or the new one.
+	g_mutex_lock(&_svc->journal_lock);
+
+	_messages_journal_close(_svc->journal);
+	g_atomic_pointer_set(&_svc->journal, NULL);
+
+	if (NULL != path)
+	{
+		ret = _messages_journal_open(_svc, path, &journal, &retries);
+		if (MESSAGES_ERROR_NONE == ret)
+		{
+			g_atomic_pointer_set(&_svc->journal, journal);
+		}
+	}
+
+	g_mutex_unlock(&_svc->journal_lock);
+
+	// Sent only now, so that their completion is recorded in the journal.
+	for (iter = retries; iter; iter = g_slist_next(iter))
+	{
+		retry = (messages_retry_s *)iter->data;
+		retry->journal = _messages_journal_ref(journal);
+		LOGI("[%s] resending journaled request %d.", __FUNCTION__, retry->id);
+		_messages_add_timer(_svc, &retry->timer, _messages_retry_delay_until(retry->when));
+	}
+	g_slist_free(retries);
+
+	return ret;
+}
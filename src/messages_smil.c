@@ -0,0 +1,179 @@
+/*
+ * Copyright (c) 2011 Samsung Electronics Co., Ltd All Rights Reserved
+ *
+ * Licensed under the Apache License, Version 2.0 (the License);
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an AS IS BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License. 
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <memory.h>
+
+#include <glib.h>
+
+#include <dlog.h>
+#include <msg.h>
+
+#include <messages.h>
+#include <messages_types.h>
+#include <messages_private.h>
+
+/*
+ * SMIL layout of MMS bodies.
+ * The media are spread over pages, each page showing one image or video, playing one audio
+ * and the text on the first page. The regions only depend on whether there is something to
+ * show and whether there is text, so they come from a fixed set of templates shared by all messages.
+ */
+
+#define MESSAGES_SMIL_PAGE_DURATION	5440	/* in milliseconds */
+#define MESSAGES_SMIL_BGCOLOR		0xffffff
+
+typedef struct {
+	const char*  id;
+	int          left;
+	int          top;
+	int          width;
+	int          height;
+} messages_smil_region_s;
+
+typedef struct {
+	int                     count;
+	messages_smil_region_s  regions[2];
+} messages_smil_template_s;
+
+typedef enum {
+	MESSAGES_SMIL_TEXT = 0,
+	MESSAGES_SMIL_IMAGE,
+	MESSAGES_SMIL_IMAGE_TEXT,
+} messages_smil_shape_e;
+
+static const messages_smil_template_s _messages_smil_templates[] = {
+	[MESSAGES_SMIL_TEXT]       = { 1, { { "Text", 0, 0, 100, 100 } } },
+	[MESSAGES_SMIL_IMAGE]      = { 1, { { "Image", 0, 0, 100, 100 } } },
+	[MESSAGES_SMIL_IMAGE_TEXT] = { 2, { { "Image", 0, 0, 100, 50 }, { "Text", 0, 50, 100, 50 } } },
+};
+
+static int _messages_smil_next(messages_message_s *msg, int from, bool visual)
+{
+	int type;
+
+	for (; from < msg->attachment_count; from++)
+	{
+		type = msg->attachments[from].media_type;
+		if (visual ? (MESSAGES_MEDIA_IMAGE == type || MESSAGES_MEDIA_VIDEO == type) : (MESSAGES_MEDIA_AUDIO == type))
+		{
+			return from;
+		}
+	}
+
+	return from;
+}
+
+static void _messages_smil_add_media(msg_struct_t page, int smil_type, const char *region_id, const char *filepath)
+{
+	msg_struct_t media;
+
+	msg_mms_add_item(page, MSG_STRUCT_MMS_MEDIA, &media);
+	msg_set_int_value(media, MSG_MMS_MEDIA_TYPE_INT, smil_type);
+	msg_set_str_value(media, MSG_MMS_MEDIA_REGION_ID_STR, (char *)region_id, strlen(region_id));
+	msg_set_str_value(media, MSG_MMS_MEDIA_FILEPATH_STR, (char *)filepath, strlen(filepath));
+}
+
+bool _messages_smil_has_page(int media_type)
+{
+	return MESSAGES_MEDIA_IMAGE == media_type || MESSAGES_MEDIA_VIDEO == media_type || MESSAGES_MEDIA_AUDIO == media_type;
+}
+
+// paths[i] is the file given to msg-service for the attachment i.
+void _messages_smil_layout(messages_message_s *msg, msg_struct_t mms_data, const char *text_path, const char **paths)
+{
+	int i;
+	int visual;
+	int audio;
+	const messages_smil_template_s *tmpl;
+	const messages_smil_region_s *spec;
+
+	msg_struct_t region;
+	msg_struct_t page;
+	msg_struct_t media;
+	msg_struct_t smil_text;
+
+	visual = _messages_smil_next(msg, 0, true);
+	audio = _messages_smil_next(msg, 0, false);
+
+	if (visual == msg->attachment_count)
+	{
+		tmpl = &_messages_smil_templates[MESSAGES_SMIL_TEXT];
+	}
+	else if (NULL == text_path)
+	{
+		tmpl = &_messages_smil_templates[MESSAGES_SMIL_IMAGE];
+	}
+	else
+	{
+		tmpl = &_messages_smil_templates[MESSAGES_SMIL_IMAGE_TEXT];
+	}
+
+	// Layout Setting
+	msg_set_int_value(mms_data, MSG_MMS_ROOTLAYOUT_WIDTH_INT, 100);
+	msg_set_int_value(mms_data, MSG_MMS_ROOTLAYOUT_HEIGHT_INT, 100);
+	msg_set_int_value(mms_data, MSG_MMS_ROOTLAYOUT_BGCOLOR_INT, MESSAGES_SMIL_BGCOLOR);
+	msg_set_bool_value(mms_data, MSG_MMS_ROOTLAYOUT_WIDTH_PERCENT_BOOL, true);
+	msg_set_bool_value(mms_data, MSG_MMS_ROOTLAYOUT_HEIGHT_PERCENT_BOOL, true);
+
+	for (i=0; i < tmpl->count; i++)
+	{
+		spec = &tmpl->regions[i];
+		msg_mms_add_item(mms_data, MSG_STRUCT_MMS_REGION, &region);
+		msg_set_str_value(region, MSG_MMS_REGION_ID_STR, (char *)spec->id, strlen(spec->id));
+		msg_set_int_value(region, MSG_MMS_REGION_LENGTH_LEFT_INT, spec->left);
+		msg_set_int_value(region, MSG_MMS_REGION_LENGTH_TOP_INT, spec->top);
+		msg_set_int_value(region, MSG_MMS_REGION_LENGTH_WIDTH_INT, spec->width);
+		msg_set_int_value(region, MSG_MMS_REGION_LENGTH_HEIGHT_INT, spec->height);
+		msg_set_int_value(region, MSG_MMS_REGION_BGCOLOR_INT, MESSAGES_SMIL_BGCOLOR);
+	}
+
+	// One page per image or video, audio pairing up with them in order. The text is on the first page.
+	do {
+		msg_mms_add_item(mms_data, MSG_STRUCT_MMS_PAGE, &page);
+		msg_set_int_value(page, MSG_MMS_PAGE_PAGE_DURATION_INT, MESSAGES_SMIL_PAGE_DURATION);
+
+		if (visual < msg->attachment_count)
+		{
+			_messages_smil_add_media(page,
+				(MESSAGES_MEDIA_VIDEO == msg->attachments[visual].media_type) ? MMS_SMIL_MEDIA_VIDEO : MMS_SMIL_MEDIA_IMG,
+				"Image", paths[visual]);
+			visual = _messages_smil_next(msg, visual + 1, true);
+		}
+
+		if (audio < msg->attachment_count)
+		{
+			_messages_smil_add_media(page, MMS_SMIL_MEDIA_AUDIO, "Audio", paths[audio]);
+			audio = _messages_smil_next(msg, audio + 1, false);
+		}
+
+		if (NULL != text_path)
+		{
+			msg_mms_add_item(page, MSG_STRUCT_MMS_MEDIA, &media);
+			msg_set_int_value(media, MSG_MMS_MEDIA_TYPE_INT, MMS_SMIL_MEDIA_TEXT);
+			msg_set_str_value(media, MSG_MMS_MEDIA_REGION_ID_STR, (char *)"Text", 4);
+			msg_set_str_value(media, MSG_MMS_MEDIA_FILEPATH_STR, (char *)text_path, MAX_IMAGE_PATH_LEN);
+
+			msg_get_struct_handle(media, MSG_MMS_MEDIA_SMIL_TEXT_HND, &smil_text);
+			msg_set_int_value(smil_text, MSG_MMS_SMIL_TEXT_COLOR_INT, 0x000000);
+			msg_set_int_value(smil_text, MSG_MMS_SMIL_TEXT_SIZE_INT, MMS_SMIL_FONT_SIZE_NORMAL);
+			msg_set_bool_value(smil_text, MSG_MMS_SMIL_TEXT_BOLD_BOOL, false);
+
+			text_path = NULL;
+		}
+	} while (visual < msg->attachment_count || audio < msg->attachment_count);
+}
@@ -0,0 +1,369 @@
+/*
+ * Copyright (c) 2011 Samsung Electronics Co., Ltd All Rights Reserved
+ *
+ * Licensed under the Apache License, Version 2.0 (the License);
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an AS IS BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License. 
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <memory.h>
+
+#include <glib.h>
+
+#include <dlog.h>
+#include <msg.h>
+
+#include <messages.h>
+#include <messages_types.h>
+#include <messages_private.h>
+
+#define GSM7_NONE	0x80
+#define X	GSM7_NONE
+
+#define WORD_HIGH_BITS	0x8080808080808080ULL
+
+/* Septets used by each code point below 0x100 in the GSM 7-bit default alphabet.
+ * 1 : basic table, 2 : extension table (escape + character), X : not representable */
+static const unsigned char _gsm7_latin1_cost[256] = {
+	X, X, X, X, X, X, X, X, X, X, 1, X, 2, 1, X, X,	/* 0x00 */
+	X, X, X, X, X, X, X, X, X, X, X, X, X, X, X, X,	/* 0x10 */
+	1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,	/* 0x20 */
+	1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,	/* 0x30 */
+	1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,	/* 0x40 */
+	1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 2, 2, 2, 2, 1,	/* 0x50 */
+	X, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,	/* 0x60 */
+	1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 2, 2, 2, 2, X,	/* 0x70 */
+	X, X, X, X, X, X, X, X, X, X, X, X, X, X, X, X,	/* 0x80 */
+	X, X, X, X, X, X, X, X, X, X, X, X, X, X, X, X,	/* 0x90 */
+	X, 1, X, 1, 1, 1, X, 1, X, X, X, X, X, X, X, X,	/* 0xA0 */
+	X, X, X, X, X, X, X, X, X, X, X, X, X, X, X, 1,	/* 0xB0 */
+	X, X, X, X, 1, 1, 1, 1, X, 1, X, X, X, X, X, X,	/* 0xC0 */
+	X, 1, X, X, X, X, 1, X, 1, X, X, X, 1, X, X, 1,	/* 0xD0 */
+	1, X, X, X, 1, 1, 1, X, 1, 1, X, X, 1, X, X, X,	/* 0xE0 */
+	X, 1, 1, X, X, X, 1, X, 1, 1, X, X, 1, X, X, X,	/* 0xF0 */
+};
+
+#undef X
+
+static inline int _messages_gsm7_cost(unsigned int cp)
+{
+	if (cp < 0x100)
+	{
+		return _gsm7_latin1_cost[cp];
+	}
+
+	switch (cp)
+	{
+		case 0x0393: case 0x0394: case 0x0398: case 0x039B: case 0x039E:	/* Γ Δ Θ Λ Ξ */
+		case 0x03A0: case 0x03A3: case 0x03A6: case 0x03A8: case 0x03A9:	/* Π Σ Φ Ψ Ω */
+			return 1;
+		case 0x20AC:	/* € */
+			return 2;
+		default:
+			return GSM7_NONE;
+	}
+}
+
+/* Decodes one UTF-8 sequence. Malformed input is consumed a byte at a time as U+FFFD. */
+static inline unsigned int _messages_utf8_next(const unsigned char **pp, const unsigned char *end)
+{
+	const unsigned char *p = *pp;
+	unsigned int cp;
+	int n, i;
+
+	if (p[0] < 0x80)
+	{
+		*pp = p + 1;
+		return p[0];
+	}
+	else if ((p[0] & 0xE0) == 0xC0)
+	{
+		cp = p[0] & 0x1F;
+		n = 1;
+	}
+	else if ((p[0] & 0xF0) == 0xE0)
+	{
+		cp = p[0] & 0x0F;
+		n = 2;
+	}
+	else if ((p[0] & 0xF8) == 0xF0)
+	{
+		cp = p[0] & 0x07;
+		n = 3;
+	}
+	else
+	{
+		*pp = p + 1;
+		return 0xFFFD;
+	}
+
+	if (end - p <= n)
+	{
+		*pp = p + 1;
+		return 0xFFFD;
+	}
+
+	for (i=1; i <= n; i++)
+	{
+		if ((p[i] & 0xC0) != 0x80)
+		{
+			*pp = p + 1;
+			return 0xFFFD;
+		}
+		cp = (cp << 6) | (p[i] & 0x3F);
+	}
+
+	*pp = p + n + 1;
+	return cp;
+}
+
+static inline void _messages_segment_add(int *full, int *fill, int units, int capacity)
+{
+	if (*fill + units > capacity)
+	{
+		(*full)++;
+		*fill = 0;
+	}
+	*fill += units;
+}
+
+int _messages_sms_analyze_text(const char *text, int len, messages_sms_text_info_s *info)
+{
+	const unsigned char *p = (const unsigned char *)text;
+	const unsigned char *end;
+	const unsigned char *c;
+	uint64_t w, cont, lead4;
+	unsigned int cp;
+	unsigned int cost, bad;
+	int i;
+	int count = 0;	/* septets, then UCS-2 code units */
+	int chars = 0;
+	int full = 0;
+	int fill = 0;
+
+	CHECK_NULL(text);
+	CHECK_NULL(info);
+
+	end = p + len;
+
+	// GSM 7-bit pass, eight ASCII bytes at a time while the text stays in the basic table
+	while (p < end)
+	{
+		if (end - p >= 8)
+		{
+			memcpy(&w, p, sizeof(w));
+			if (0 == (w & WORD_HIGH_BITS))
+			{
+				bad = 0;
+				for (i=0; i < 8; i++)
+				{
+					bad |= _gsm7_latin1_cost[p[i]];
+				}
+				if (1 == bad)
+				{
+					count += 8;
+					chars += 8;
+					fill += 8;
+					if (fill > MESSAGES_GSM7_MULTI_SEGMENT_LEN)
+					{
+						full++;
+						fill -= MESSAGES_GSM7_MULTI_SEGMENT_LEN;
+					}
+					p += 8;
+					continue;
+				}
+			}
+		}
+
+		c = p;
+		cp = _messages_utf8_next(&c, end);
+		cost = _messages_gsm7_cost(cp);
+		if (GSM7_NONE == cost)
+		{
+			break;
+		}
+
+		_messages_segment_add(&full, &fill, cost, MESSAGES_GSM7_MULTI_SEGMENT_LEN);
+		count += cost;
+		chars++;
+		p = c;
+	}
+
+	if (p >= end)
+	{
+		info->encoding = MESSAGES_SMS_ENCODING_GSM7BIT;
+		info->length = count;
+		info->segments = (count <= MESSAGES_GSM7_SINGLE_SEGMENT_LEN) ? 1 : full + (fill > 0);
+		return MESSAGES_ERROR_NONE;
+	}
+
+	// UCS-2 pass. Every character seen so far is a single BMP code unit.
+	count = chars;
+	full = chars / MESSAGES_UCS2_MULTI_SEGMENT_LEN;
+	fill = chars % MESSAGES_UCS2_MULTI_SEGMENT_LEN;
+
+	while (p < end)
+	{
+		if (end - p >= 8)
+		{
+			memcpy(&w, p, sizeof(w));
+			lead4 = w & (w << 1) & (w << 2) & (w << 3) & WORD_HIGH_BITS;
+			if (0 == lead4)
+			{
+				// Without 4-byte sequences each non-continuation byte starts one code unit.
+				cont = w & ~(w << 1) & WORD_HIGH_BITS;
+				i = 8 - __builtin_popcountll(cont);
+				count += i;
+				fill += i;
+				if (fill > MESSAGES_UCS2_MULTI_SEGMENT_LEN)
+				{
+					full++;
+					fill -= MESSAGES_UCS2_MULTI_SEGMENT_LEN;
+				}
+				p += 8;
+				continue;
+			}
+		}
+
+		if ((p[0] & 0xC0) == 0x80)
+		{
+			// Tail of a sequence whose lead byte was counted in the word above
+			p++;
+			continue;
+		}
+
+		cp = _messages_utf8_next(&p, end);
+		cost = (cp > 0xFFFF) ? 2 : 1;	/* surrogate pairs are never split */
+		_messages_segment_add(&full, &fill, cost, MESSAGES_UCS2_MULTI_SEGMENT_LEN);
+		count += cost;
+	}
+
+	info->encoding = MESSAGES_SMS_ENCODING_UCS2;
+	info->length = count;
+	info->segments = (count <= MESSAGES_UCS2_SINGLE_SEGMENT_LEN) ? 1 : full + (fill > 0);
+
+	return MESSAGES_ERROR_NONE;
+}
+
+int messages_sms_analyze_text(const char *text, messages_sms_encoding_e *encoding, int *length, int *segment_count)
+{
+	int ret;
+	messages_sms_text_info_s info;
+
+	CHECK_NULL(text);
+
+	ret = _messages_sms_analyze_text(text, strlen(text), &info);
+	if (MESSAGES_ERROR_NONE != ret)
+	{
+		return ret;
+	}
+
+	if (NULL != encoding)
+	{
+		*encoding = info.encoding;
+	}
+
+	if (NULL != length)
+	{
+		*length = info.length;
+	}
+
+	if (NULL != segment_count)
+	{
+		*segment_count = info.segments;
+	}
+
+	return MESSAGES_ERROR_NONE;
+}
+
+int _messages_sms_split_text(const char *text, int len, int **offsets, int *count)
+{
+	const unsigned char *start = (const unsigned char *)text;
+	const unsigned char *end;
+	const unsigned char *p;
+	const unsigned char *c;
+	int seg_start = 0;
+	int part_start = 0;
+	int part_segments = 1;
+	int fill = 0;
+	int capacity;
+	int cost;
+	int n = 0;
+	int *_offsets;
+	messages_sms_text_info_s info;
+
+	CHECK_NULL(text);
+	CHECK_NULL(offsets);
+	CHECK_NULL(count);
+
+	_messages_sms_analyze_text(text, len, &info);
+	capacity = (MESSAGES_SMS_ENCODING_GSM7BIT == info.encoding) ?
+			MESSAGES_GSM7_MULTI_SEGMENT_LEN : MESSAGES_UCS2_MULTI_SEGMENT_LEN;
+
+	// Offsets of every part start plus the end of the text. Each part holds at least one segment.
+	_offsets = (int*)malloc(sizeof(int) * (info.segments + 2));
+	if (NULL == _offsets)
+	{
+		LOGE("[%s] OUT_OF_MEMORY(0x%08x) fail to create '_offsets'."
+			, __FUNCTION__, MESSAGES_ERROR_OUT_OF_MEMORY);
+		return MESSAGES_ERROR_OUT_OF_MEMORY;
+	}
+	_offsets[n++] = 0;
+
+	end = start + len;
+	p = start;
+	while (p < end)
+	{
+		c = p;
+		if (MESSAGES_SMS_ENCODING_GSM7BIT == info.encoding)
+		{
+			cost = _messages_gsm7_cost(_messages_utf8_next(&c, end));
+		}
+		else
+		{
+			cost = (_messages_utf8_next(&c, end) > 0xFFFF) ? 2 : 1;
+		}
+
+		if (fill + cost > capacity)
+		{
+			// Segment boundary
+			seg_start = p - start;
+			fill = 0;
+			if (++part_segments > MAX_MESSAGES_SEGMENT_COUNT)
+			{
+				_offsets[n++] = seg_start;
+				part_start = seg_start;
+				part_segments = 1;
+			}
+		}
+
+		if ((c - start) - part_start > MAX_MESSAGES_TEXT_LEN)
+		{
+			// Too many bytes for msg-service, move the current segment to the next part
+			_offsets[n++] = seg_start;
+			part_start = seg_start;
+			part_segments = 1;
+		}
+
+		fill += cost;
+		p = c;
+	}
+
+	_offsets[n] = len;
+
+	*offsets = _offsets;
+	*count = n;
+
+	return MESSAGES_ERROR_NONE;
+}
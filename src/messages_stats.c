@@ -0,0 +1,181 @@
+/*
+ * Copyright (c) 2011 Samsung Electronics Co., Ltd All Rights Reserved
+ *
+ * Licensed under the Apache License, Version 2.0 (the License);
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an AS IS BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License. 
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <memory.h>
+
+#include <glib.h>
+
+#include <dlog.h>
+#include <msg.h>
+
+#include <messages.h>
+#include <messages_types.h>
+#include <messages_private.h>
+
+static messages_latency_histogram_s *_messages_latency_get_histogram(messages_service_s *svc, int msg_type, int result)
+{
+	int type_idx;
+
+	switch (msg_type)
+	{
+		case MESSAGES_TYPE_SMS: type_idx = 0; break;
+		case MESSAGES_TYPE_MMS: type_idx = 1; break;
+		default: return NULL;
+	}
+
+	return &svc->latency[type_idx][(MESSAGES_SENDING_SUCCEEDED == result) ? 0 : 1];
+}
+
+static int _messages_latency_bucket_index(guint64 usec)
+{
+	int exponent;
+	int index;
+
+	if (usec < MESSAGES_LATENCY_SUB_BUCKET_COUNT)
+	{
+		return (int)usec;
+	}
+
+	exponent = 63 - __builtin_clzll(usec);
+	index = (exponent - MESSAGES_LATENCY_SUB_BUCKET_BITS + 1) * MESSAGES_LATENCY_SUB_BUCKET_COUNT
+			+ (int)((usec >> (exponent - MESSAGES_LATENCY_SUB_BUCKET_BITS)) & (MESSAGES_LATENCY_SUB_BUCKET_COUNT - 1));
+
+	return MIN(index, MESSAGES_LATENCY_BUCKET_COUNT - 1);
+}
+
+/* Highest latency, in microseconds, that falls into the bucket */
+static guint64 _messages_latency_bucket_value(int index)
+{
+	int exponent;
+	int sub;
+
+	if (index < MESSAGES_LATENCY_SUB_BUCKET_COUNT)
+	{
+		return index;
+	}
+
+	exponent = index / MESSAGES_LATENCY_SUB_BUCKET_COUNT + MESSAGES_LATENCY_SUB_BUCKET_BITS - 1;
+	sub = index % MESSAGES_LATENCY_SUB_BUCKET_COUNT;
+
+	return (((guint64)(MESSAGES_LATENCY_SUB_BUCKET_COUNT + sub + 1)) << (exponent - MESSAGES_LATENCY_SUB_BUCKET_BITS)) - 1;
+}
+
+void _messages_latency_record(messages_service_s *svc, int msg_type, int result, gint64 usec)
+{
+	messages_latency_histogram_s *histogram;
+
+	if (NULL == svc)
+	{
+		return;
+	}
+
+	histogram = _messages_latency_get_histogram(svc, msg_type, result);
+	if (NULL == histogram)
+	{
+		return;
+	}
+
+	g_atomic_int_inc(&histogram->buckets[_messages_latency_bucket_index(usec > 0 ? usec : 0)]);
+}
+
+int messages_get_sending_latency(messages_service_h service, messages_message_type_e type, messages_sending_result_e result,
+							int *count, int *p50, int *p99, int *p999)
+{
+	int i, q;
+	int total = 0;
+	int seen = 0;
+	int snapshot[MESSAGES_LATENCY_BUCKET_COUNT];
+	int *outputs[3] = { p50, p99, p999 };
+	const int permille[3] = { 500, 990, 999 };
+	int rank;
+
+	messages_service_s *_svc = (messages_service_s*)service;
+	messages_latency_histogram_s *histogram;
+
+	CHECK_NULL(_svc);
+
+	histogram = _messages_latency_get_histogram(_svc, type, result);
+	if (NULL == histogram)
+	{
+		LOGE("[%s] INVALID_PARAMETER(0x%08x) : the message type should be MESSAGES_TYPE_SMS or MESSAGES_TYPE_MMS"
+			, __FUNCTION__, MESSAGES_ERROR_INVALID_PARAMETER);
+		return MESSAGES_ERROR_INVALID_PARAMETER;
+	}
+
+	// Writers are never blocked, so the buckets are read one by one into a snapshot.
+	for (i=0; i < MESSAGES_LATENCY_BUCKET_COUNT; i++)
+	{
+		snapshot[i] = g_atomic_int_get(&histogram->buckets[i]);
+		total += snapshot[i];
+	}
+
+	if (NULL != count)
+	{
+		*count = total;
+	}
+
+	for (q=0; q < 3; q++)
+	{
+		if (NULL == outputs[q])
+		{
+			continue;
+		}
+
+		*outputs[q] = 0;
+		if (0 == total)
+		{
+			continue;
+		}
+
+		rank = (int)(((gint64)total * permille[q] + 999) / 1000);
+		seen = 0;
+		for (i=0; i < MESSAGES_LATENCY_BUCKET_COUNT; i++)
+		{
+			seen += snapshot[i];
+			if (seen >= rank)
+			{
+				*outputs[q] = (int)MIN(_messages_latency_bucket_value(i) / 1000, (guint64)G_MAXINT);
+				break;
+			}
+		}
+	}
+
+	return MESSAGES_ERROR_NONE;
+}
+
+int messages_reset_sending_latency(messages_service_h service)
+{
+	int i, j, k;
+
+	messages_service_s *_svc = (messages_service_s*)service;
+
+	CHECK_NULL(_svc);
+
+	for (i=0; i < 2; i++)
+	{
+		for (j=0; j < 2; j++)
+		{
+			for (k=0; k < MESSAGES_LATENCY_BUCKET_COUNT; k++)
+			{
+				g_atomic_int_set(&_svc->latency[i][j].buckets[k], 0);
+			}
+		}
+	}
+
+	return MESSAGES_ERROR_NONE;
+}
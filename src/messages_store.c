@@ -0,0 +1,444 @@
+/*
+ * Copyright (c) 2011 Samsung Electronics Co., Ltd All Rights Reserved
+ *
+ * Licensed under the Apache License, Version 2.0 (the License);
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an AS IS BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License. 
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#include <glib.h>
+
+#include <dlog.h>
+#include <msg.h>
+
+#include <messages.h>
+#include <messages_types.h>
+#include <messages_private.h>
+
+/*
+ * Content-addressed attachment store.
+ * Each attachment file is hashed once per (device, inode, mtime, size) and staged in the store
+ * directory under its content hash, keeping its name, so every message attaching the same content
+ * hands msg-service the same file. Staging is a copy, never a hard link: a link would share the inode
+ * of its source, and rewriting that source in place would change what every message using the staged
+ * file sends, including the MMS bodies already built from it. A staged file is still checked against
+ * the inode, time and size it was staged with before it is reused, and staged again if it changed.
+ * The store is reference counted by the service and by each request sending staged files, so the
+ * staged files are removed once the store is disabled and no pending request refers to them.
+ */
+
+typedef struct {
+	dev_t        dev;
+	ino_t        ino;
+	gint64       mtime;		/* in nanoseconds */
+	off_t        size;
+} messages_store_key_s;
+
+typedef struct {
+	const char*  path;		/* interned */
+	ino_t        ino;		/* of the staged file when it was staged */
+	gint64       mtime;
+	off_t        size;
+} messages_store_entry_s;
+
+struct _messages_store_s {
+	int          ref;
+	bool         keep;		/* leave the staged files in place for requests abandoned at close */
+	int          id;
+	char*        dir;
+	GMutex       lock;
+	GHashTable*  hashes;	/* messages_store_key_s -> guint64 content hash */
+	GHashTable*  staged;	/* "hash-size/name" -> messages_store_entry_s */
+};
+
+static int _messages_store_seq = 0;
+
+static guint _messages_store_key_hash(gconstpointer key)
+{
+	const messages_store_key_s *k = (const messages_store_key_s *)key;
+
+	return (guint)_messages_hash_bytes(MESSAGES_HASH_INIT, k, sizeof(*k));
+}
+
+static gboolean _messages_store_key_equal(gconstpointer a, gconstpointer b)
+{
+	return 0 == memcmp(a, b, sizeof(messages_store_key_s));
+}
+
+static void _messages_store_free_entry(gpointer value)
+{
+	messages_store_entry_s *entry = (messages_store_entry_s *)value;
+
+	_messages_intern_unref(entry->path);
+	g_free(entry);
+}
+
+static gint64 _messages_store_mtime(const struct stat *st)
+{
+	return (gint64)st->st_mtim.tv_sec * 1000000000 + st->st_mtim.tv_nsec;
+}
+
+// The staged file still has the content it was hashed with, as far as its inode, time and size tell.
+static bool _messages_store_entry_valid(const messages_store_entry_s *entry)
+{
+	struct stat st;
+
+	return 0 == stat(entry->path, &st) && st.st_ino == entry->ino
+		&& _messages_store_mtime(&st) == entry->mtime && st.st_size == entry->size;
+}
+
+messages_store_s *_messages_store_create(const char *spool_dir)
+{
+	messages_store_s *store;
+
+	store = (messages_store_s *)calloc(1, sizeof(messages_store_s));
+	if (NULL == store)
+	{
+		LOGE("[%s] OUT_OF_MEMORY(0x%08x) fail to create a 'store'."
+			, __FUNCTION__, MESSAGES_ERROR_OUT_OF_MEMORY);
+		return NULL;
+	}
+
+	store->ref = 1;
+	store->id = g_atomic_int_add(&_messages_store_seq, 1) + 1;
+	store->dir = g_strdup_printf("%s/.capi_messages_store_XXXXXX",
+		(NULL != spool_dir) ? spool_dir : MESSAGES_DEFAULT_SPOOL_DIR);
+	store->hashes = g_hash_table_new_full(_messages_store_key_hash, _messages_store_key_equal, g_free, g_free);
+	store->staged = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, _messages_store_free_entry);
+	g_mutex_init(&store->lock);
+
+	// A fresh directory of our own, so no other user can plant or replace staged files in a shared spool
+	// directory such as /tmp. It is opened for reading to msg-service, which runs as another user.
+	if (NULL == mkdtemp(store->dir) || 0 != chmod(store->dir, 0755))
+	{
+		LOGE("[%s] OPERATION_FAILED(0x%08x) : fail to create '%s', errno = %d."
+			, __FUNCTION__, MESSAGES_ERROR_OPERATION_FAILED, store->dir, errno);
+		_messages_store_unref(store);
+		return NULL;
+	}
+
+	return store;
+}
+
+static void _messages_store_remove_staged(gpointer key, gpointer value, gpointer user_data)
+{
+	char *dir;
+	messages_store_entry_s *entry = (messages_store_entry_s *)value;
+
+	unlink(entry->path);
+
+	// Names under the same hash share a directory, which goes away with the last of them.
+	dir = g_path_get_dirname(entry->path);
+	rmdir(dir);
+	g_free(dir);
+}
+
+messages_store_s *_messages_store_ref(messages_store_s *store)
+{
+	if (NULL != store)
+	{
+		g_atomic_int_inc(&store->ref);
+	}
+
+	return store;
+}
+
+void _messages_store_keep(messages_store_s *store)
+{
+	if (NULL != store)
+	{
+		store->keep = true;
+	}
+}
+
+void _messages_store_unref(messages_store_s *store)
+{
+	if (NULL == store || !g_atomic_int_dec_and_test(&store->ref))
+	{
+		return;
+	}
+
+	if (!store->keep)
+	{
+		g_hash_table_foreach(store->staged, _messages_store_remove_staged, NULL);
+		rmdir(store->dir);
+	}
+
+	g_hash_table_destroy(store->staged);
+	g_hash_table_destroy(store->hashes);
+	g_mutex_clear(&store->lock);
+	g_free(store->dir);
+	free(store);
+}
+
+int _messages_store_id(messages_store_s *store)
+{
+	return (NULL != store) ? store->id : 0;
+}
+
+static int _messages_store_hash_file(const char *path, off_t size, guint64 *hash)
+{
+	int fd;
+	void *addr;
+
+	*hash = MESSAGES_HASH_INIT;
+	if (0 == size)
+	{
+		return MESSAGES_ERROR_NONE;
+	}
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0)
+	{
+		return MESSAGES_ERROR_OPERATION_FAILED;
+	}
+
+	addr = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (MAP_FAILED == addr)
+	{
+		return MESSAGES_ERROR_OPERATION_FAILED;
+	}
+
+	*hash = _messages_hash_bytes(*hash, addr, size);
+	munmap(addr, size);
+
+	return MESSAGES_ERROR_NONE;
+}
+
+static int _messages_store_copy_file(const char *src, const char *dst)
+{
+	int in;
+	int out;
+	ssize_t len;
+	ssize_t done;
+	ssize_t written;
+	char buf[8192];
+	int ret = MESSAGES_ERROR_NONE;
+
+	in = open(src, O_RDONLY);
+	if (in < 0)
+	{
+		return MESSAGES_ERROR_OPERATION_FAILED;
+	}
+
+	out = open(dst, O_WRONLY | O_CREAT | O_EXCL, 0644);
+	if (out < 0)
+	{
+		close(in);
+		return MESSAGES_ERROR_OPERATION_FAILED;
+	}
+
+	while (0 != (len = read(in, buf, sizeof(buf))))
+	{
+		if (len < 0)
+		{
+			if (EINTR == errno)
+			{
+				continue;
+			}
+			ret = MESSAGES_ERROR_OPERATION_FAILED;
+			break;
+		}
+
+		for (done=0; done < len; done += written)
+		{
+			written = write(out, buf + done, len - done);
+			if (written < 0)
+			{
+				if (EINTR != errno)
+				{
+					break;
+				}
+				written = 0;
+			}
+		}
+		if (done < len)
+		{
+			ret = MESSAGES_ERROR_OPERATION_FAILED;
+			break;
+		}
+	}
+
+	close(in);
+	close(out);
+
+	if (MESSAGES_ERROR_NONE != ret)
+	{
+		unlink(dst);
+	}
+
+	return ret;
+}
+
+// Returns a referenced interned path to give msg-service instead of path, or NULL to use path itself.
+const char *_messages_store_stage(messages_store_s *store, const char *path)
+{
+	char *name;
+	char *dir;
+	char *staged_path;
+	char *tmp_path;
+	const char *staged;
+	const char *base;
+	guint64 hash;
+	guint64 *cached;
+	struct stat st;
+	messages_store_key_s key;
+	messages_store_key_s *new_key;
+	messages_store_entry_s *entry;
+
+	if (NULL == store || 0 != stat(path, &st) || !S_ISREG(st.st_mode))
+	{
+		return NULL;
+	}
+
+	memset(&key, 0, sizeof(key));
+	key.dev = st.st_dev;
+	key.ino = st.st_ino;
+	key.mtime = _messages_store_mtime(&st);
+	key.size = st.st_size;
+
+	g_mutex_lock(&store->lock);
+
+	cached = (guint64 *)g_hash_table_lookup(store->hashes, &key);
+	if (NULL != cached)
+	{
+		hash = *cached;
+	}
+	else
+	{
+		// A changed file gets a new key, so the content is only read again when it was modified.
+		if (MESSAGES_ERROR_NONE != _messages_store_hash_file(path, st.st_size, &hash))
+		{
+			g_mutex_unlock(&store->lock);
+			return NULL;
+		}
+		new_key = g_new(messages_store_key_s, 1);
+		*new_key = key;
+		cached = g_new(guint64, 1);
+		*cached = hash;
+		g_hash_table_insert(store->hashes, new_key, cached);
+	}
+
+	base = strrchr(path, '/');
+	base = (NULL == base) ? path : base + 1;
+	name = g_strdup_printf("%016" G_GINT64_MODIFIER "x-%" G_GINT64_FORMAT "/%s", hash, (gint64)st.st_size, base);
+
+	entry = (messages_store_entry_s *)g_hash_table_lookup(store->staged, name);
+	if (NULL != entry)
+	{
+		if (_messages_store_entry_valid(entry))
+		{
+			g_free(name);
+			staged = _messages_intern_ref(entry->path);
+			g_mutex_unlock(&store->lock);
+			return staged;
+		}
+
+		// Removed or modified by someone else, so it may no longer hold this content.
+		LOGW("[%s] '%s' changed since it was staged, it is staged again.", __FUNCTION__, entry->path);
+		g_hash_table_remove(store->staged, name);
+	}
+
+	staged_path = g_strdup_printf("%s/%s", store->dir, name);
+	tmp_path = g_strdup_printf("%s.tmp", staged_path);
+	dir = g_path_get_dirname(staged_path);
+
+	// Staged under a temporary name and renamed, so a stale file is replaced for the next readers only.
+	unlink(tmp_path);
+	if ((0 != mkdir(dir, 0755) && EEXIST != errno)
+		|| MESSAGES_ERROR_NONE != _messages_store_copy_file(path, tmp_path)
+		|| 0 != rename(tmp_path, staged_path)
+		|| 0 != stat(staged_path, &st))
+	{
+		LOGW("[%s] fail to stage '%s', it is sent from its own path.", __FUNCTION__, path);
+		unlink(tmp_path);
+		rmdir(dir);
+		g_free(dir);
+		g_free(tmp_path);
+		g_free(staged_path);
+		g_free(name);
+		g_mutex_unlock(&store->lock);
+		return NULL;
+	}
+	g_free(dir);
+	g_free(tmp_path);
+
+	staged = _messages_intern_path(staged_path);
+	g_free(staged_path);
+	if (NULL == staged)
+	{
+		g_free(name);
+		g_mutex_unlock(&store->lock);
+		return NULL;
+	}
+
+	entry = g_new(messages_store_entry_s, 1);
+	entry->path = staged;
+	entry->ino = st.st_ino;
+	entry->mtime = _messages_store_mtime(&st);
+	entry->size = st.st_size;
+
+	// The table keeps one reference, the caller gets another.
+	g_hash_table_insert(store->staged, name, entry);
+	staged = _messages_intern_ref(staged);
+
+	g_mutex_unlock(&store->lock);
+
+	return staged;
+}
+
+int messages_mms_set_attachment_store_enabled(messages_service_h service, bool enable)
+{
+	messages_store_s *old;
+	messages_store_s *store = NULL;
+
+	messages_service_s *_svc = (messages_service_s*)service;
+
+	CHECK_NULL(_svc);
+
+	g_mutex_lock(&_svc->spool_lock);
+
+	if (enable == (NULL != _svc->store))
+	{
+		g_mutex_unlock(&_svc->spool_lock);
+		return MESSAGES_ERROR_NONE;
+	}
+
+	if (enable)
+	{
+		store = _messages_store_create(_svc->spool_dir);
+		if (NULL == store)
+		{
+			g_mutex_unlock(&_svc->spool_lock);
+			return MESSAGES_ERROR_OPERATION_FAILED;
+		}
+	}
+
+	old = _svc->store;
+	_svc->store = store;
+
+	g_mutex_unlock(&_svc->spool_lock);
+
+	// The pending requests sending staged files keep the old store until their sending status.
+	_messages_store_unref(old);
+
+	return MESSAGES_ERROR_NONE;
+}
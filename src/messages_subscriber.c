@@ -0,0 +1,198 @@
+/*
+ * Copyright (c) 2011 Samsung Electronics Co., Ltd All Rights Reserved
+ *
+ * Licensed under the Apache License, Version 2.0 (the License);
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an AS IS BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License. 
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <memory.h>
+
+#include <glib.h>
+
+#include <dlog.h>
+#include <msg.h>
+
+#include <messages.h>
+#include <messages_types.h>
+#include <messages_private.h>
+
+/*
+ * Incoming message subscribers.
+ * The subscribers are an immutable array replaced as a whole on every change (read-copy-update).
+ * Delivery only counts itself in, reads the current array and counts itself out, without a lock.
+ * A replaced array is kept until a writer sees no reader inside: any later reader can only see a newer array.
+ */
+
+// Frees the replaced lists when no reader is inside, the subscriber lock must be held.
+static void _messages_subscribers_reclaim(messages_service_s *svc)
+{
+	messages_subscriber_list_s *list;
+
+	if (0 != g_atomic_int_get(&svc->subscriber_readers))
+	{
+		return;
+	}
+
+	while (NULL != (list = svc->subscribers_retired))
+	{
+		svc->subscribers_retired = list->retired_next;
+		free(list);
+	}
+}
+
+// Publishes list in place of the current one, the subscriber lock must be held.
+static void _messages_subscribers_replace(messages_service_s *svc, messages_subscriber_list_s *list)
+{
+	messages_subscriber_list_s *old = svc->subscribers;
+
+	g_atomic_pointer_set(&svc->subscribers, list);
+
+	if (NULL != old)
+	{
+		old->retired_next = svc->subscribers_retired;
+		svc->subscribers_retired = old;
+	}
+
+	_messages_subscribers_reclaim(svc);
+}
+
+void _messages_incoming_subscribers_notify(messages_service_s *svc, messages_message_h msg)
+{
+	int i;
+	messages_subscriber_list_s *list;
+
+	if (NULL == g_atomic_pointer_get(&svc->subscribers))
+	{
+		return;
+	}
+
+	g_atomic_int_inc(&svc->subscriber_readers);
+
+	list = (messages_subscriber_list_s *)g_atomic_pointer_get(&svc->subscribers);
+	for (i=0; NULL != list && i < list->count; i++)
+	{
+		((messages_incoming_cb)list->subs[i].cb)(msg, list->subs[i].user_data);
+	}
+
+	g_atomic_int_add(&svc->subscriber_readers, -1);
+}
+
+void _messages_incoming_subscribers_destroy(messages_service_s *svc)
+{
+	g_mutex_lock(&svc->subscriber_lock);
+	_messages_subscribers_replace(svc, NULL);
+	g_mutex_unlock(&svc->subscriber_lock);
+}
+
+int messages_add_message_incoming_cb(messages_service_h service, messages_incoming_cb callback, void *user_data, int *subscription_id)
+{
+	int ret;
+	int count;
+	messages_subscriber_list_s *old;
+	messages_subscriber_list_s *list;
+
+	messages_service_s *_svc = (messages_service_s*)service;
+
+	CHECK_NULL(_svc);
+	CHECK_NULL(callback);
+	CHECK_NULL(subscription_id);
+
+	ret = _messages_register_incoming_mediator(_svc);
+	if (MESSAGES_ERROR_NONE != ret)
+	{
+		return ret;
+	}
+
+	g_mutex_lock(&_svc->subscriber_lock);
+
+	old = _svc->subscribers;
+	count = (NULL == old) ? 0 : old->count;
+
+	list = (messages_subscriber_list_s *)malloc(sizeof(messages_subscriber_list_s) + sizeof(messages_subscriber_s) * count);
+	if (NULL == list)
+	{
+		g_mutex_unlock(&_svc->subscriber_lock);
+		LOGE("[%s] OUT_OF_MEMORY(0x%08x) fail to create a subscriber list."
+			, __FUNCTION__, MESSAGES_ERROR_OUT_OF_MEMORY);
+		return MESSAGES_ERROR_OUT_OF_MEMORY;
+	}
+
+	if (0 < count)
+	{
+		memcpy(list->subs, old->subs, sizeof(messages_subscriber_s) * count);
+	}
+	list->subs[count].id = ++_svc->next_subscriber_id;
+	list->subs[count].cb = (void*)callback;
+	list->subs[count].user_data = user_data;
+	list->count = count + 1;
+	list->retired_next = NULL;
+
+	*subscription_id = list->subs[count].id;
+
+	_messages_subscribers_replace(_svc, list);
+
+	g_mutex_unlock(&_svc->subscriber_lock);
+
+	return MESSAGES_ERROR_NONE;
+}
+
+int messages_remove_message_incoming_cb(messages_service_h service, int subscription_id)
+{
+	int i;
+	int j;
+	messages_subscriber_list_s *old;
+	messages_subscriber_list_s *list = NULL;
+
+	messages_service_s *_svc = (messages_service_s*)service;
+
+	CHECK_NULL(_svc);
+
+	g_mutex_lock(&_svc->subscriber_lock);
+
+	old = _svc->subscribers;
+	for (i=0; NULL != old && i < old->count && old->subs[i].id != subscription_id; i++);
+
+	if (NULL == old || i == old->count)
+	{
+		g_mutex_unlock(&_svc->subscriber_lock);
+		LOGE("[%s] INVALID_PARAMETER(0x%08x) : no subscription %d."
+			, __FUNCTION__, MESSAGES_ERROR_INVALID_PARAMETER, subscription_id);
+		return MESSAGES_ERROR_INVALID_PARAMETER;
+	}
+
+	if (1 < old->count)
+	{
+		list = (messages_subscriber_list_s *)malloc(sizeof(messages_subscriber_list_s) + sizeof(messages_subscriber_s) * (old->count - 2));
+		if (NULL == list)
+		{
+			g_mutex_unlock(&_svc->subscriber_lock);
+			LOGE("[%s] OUT_OF_MEMORY(0x%08x) fail to create a subscriber list."
+				, __FUNCTION__, MESSAGES_ERROR_OUT_OF_MEMORY);
+			return MESSAGES_ERROR_OUT_OF_MEMORY;
+		}
+
+		for (j=0; j < old->count - 1; j++)
+		{
+			list->subs[j] = old->subs[(j < i) ? j : j + 1];
+		}
+		list->count = old->count - 1;
+		list->retired_next = NULL;
+	}
+
+	_messages_subscribers_replace(_svc, list);
+
+	g_mutex_unlock(&_svc->subscriber_lock);
+
+	return MESSAGES_ERROR_NONE;
+}
@@ -0,0 +1,237 @@
+/*
+ * Copyright (c) 2011 Samsung Electronics Co., Ltd All Rights Reserved
+ *
+ * Licensed under the Apache License, Version 2.0 (the License);
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an AS IS BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License. 
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <memory.h>
+
+#include <glib.h>
+
+#include <dlog.h>
+#include <msg.h>
+
+#include <messages.h>
+#include <messages_types.h>
+#include <messages_private.h>
+
+/*
+ * Hierarchical timer wheel.
+ * Level n has MESSAGES_TIMER_WHEEL_SLOTS slots of MESSAGES_TIMER_WHEEL_SLOTS^n ticks each.
+ * A timer sits in the level its remaining time fits in and moves down a level
+ * when the wheel below it wraps around, so adding, removing and expiring are O(1).
+ */
+
+#define WHEEL_MASK	(MESSAGES_TIMER_WHEEL_SLOTS - 1)
+#define WHEEL_SPAN(level)	((guint64)1 << (MESSAGES_TIMER_WHEEL_BITS * (level)))
+#define WHEEL_MAX_DELTA	(WHEEL_SPAN(MESSAGES_TIMER_WHEEL_LEVELS) - 1)
+
+void _messages_timer_wheel_init(messages_timer_wheel_s *wheel, guint64 now)
+{
+	memset(wheel, 0, sizeof(messages_timer_wheel_s));
+	wheel->now = now;
+}
+
+static void _messages_timer_wheel_link(messages_timer_wheel_s *wheel, messages_timer_s *timer)
+{
+	int level;
+	int slot;
+	guint64 delta;
+	guint64 at;
+
+	delta = (timer->expires > wheel->now) ? timer->expires - wheel->now : 0;
+	at = wheel->now + MIN(delta, WHEEL_MAX_DELTA);
+
+	for (level=0; level < MESSAGES_TIMER_WHEEL_LEVELS - 1; level++)
+	{
+		if (delta < WHEEL_SPAN(level + 1))
+		{
+			break;
+		}
+	}
+
+	slot = (at >> (MESSAGES_TIMER_WHEEL_BITS * level)) & WHEEL_MASK;
+
+	timer->level = level;
+	timer->slot = slot;
+	timer->prev = NULL;
+	timer->next = wheel->slots[level][slot];
+	if (NULL != timer->next)
+	{
+		timer->next->prev = timer;
+	}
+	wheel->slots[level][slot] = timer;
+}
+
+static void _messages_timer_wheel_unlink(messages_timer_wheel_s *wheel, messages_timer_s *timer)
+{
+	if (NULL != timer->prev)
+	{
+		timer->prev->next = timer->next;
+	}
+	else
+	{
+		wheel->slots[timer->level][timer->slot] = timer->next;
+	}
+
+	if (NULL != timer->next)
+	{
+		timer->next->prev = timer->prev;
+	}
+
+	timer->prev = NULL;
+	timer->next = NULL;
+}
+
+void _messages_timer_wheel_add(messages_timer_wheel_s *wheel, messages_timer_s *timer, guint64 expires)
+{
+	// The current slot was already processed, so the earliest a new timer can fire is the next tick.
+	timer->expires = MAX(expires, wheel->now + 1);
+	timer->pending = true;
+	_messages_timer_wheel_link(wheel, timer);
+	wheel->count++;
+}
+
+void _messages_timer_wheel_remove(messages_timer_wheel_s *wheel, messages_timer_s *timer)
+{
+	if (!timer->pending)
+	{
+		return;
+	}
+
+	_messages_timer_wheel_unlink(wheel, timer);
+	timer->pending = false;
+	wheel->count--;
+}
+
+static void _messages_timer_wheel_cascade(messages_timer_wheel_s *wheel, int level)
+{
+	int slot;
+	messages_timer_s *timer;
+	messages_timer_s *next;
+
+	slot = (wheel->now >> (MESSAGES_TIMER_WHEEL_BITS * level)) & WHEEL_MASK;
+	timer = wheel->slots[level][slot];
+	wheel->slots[level][slot] = NULL;
+
+	while (NULL != timer)
+	{
+		next = timer->next;
+		_messages_timer_wheel_link(wheel, timer);
+		timer = next;
+	}
+
+	if (0 == slot && level + 1 < MESSAGES_TIMER_WHEEL_LEVELS)
+	{
+		_messages_timer_wheel_cascade(wheel, level + 1);
+	}
+}
+
+messages_timer_s *_messages_timer_wheel_advance(messages_timer_wheel_s *wheel, guint64 now)
+{
+	int slot;
+	messages_timer_s *expired = NULL;
+	messages_timer_s *timer;
+	messages_timer_s *next;
+
+	if (0 == wheel->count)
+	{
+		wheel->now = MAX(wheel->now, now);
+		return NULL;
+	}
+
+	while (wheel->now < now)
+	{
+		wheel->now++;
+
+		slot = wheel->now & WHEEL_MASK;
+		if (0 == slot)
+		{
+			_messages_timer_wheel_cascade(wheel, 1);
+		}
+
+		timer = wheel->slots[0][slot];
+		while (NULL != timer)
+		{
+			next = timer->next;
+			if (timer->expires <= wheel->now)
+			{
+				_messages_timer_wheel_unlink(wheel, timer);
+				timer->pending = false;
+				wheel->count--;
+				timer->next = expired;
+				expired = timer;
+			}
+			timer = next;
+		}
+
+		if (0 == wheel->count)
+		{
+			wheel->now = now;
+			break;
+		}
+	}
+
+	return expired;
+}
+
+messages_timer_s *_messages_timer_wheel_drain(messages_timer_wheel_s *wheel)
+{
+	int level;
+	int slot;
+	messages_timer_s *drained = NULL;
+	messages_timer_s *timer;
+	messages_timer_s *next;
+
+	for (level=0; level < MESSAGES_TIMER_WHEEL_LEVELS; level++)
+	{
+		for (slot=0; slot < MESSAGES_TIMER_WHEEL_SLOTS; slot++)
+		{
+			for (timer = wheel->slots[level][slot]; NULL != timer; timer = next)
+			{
+				next = timer->next;
+				timer->prev = NULL;
+				timer->pending = false;
+				timer->next = drained;
+				drained = timer;
+			}
+			wheel->slots[level][slot] = NULL;
+		}
+	}
+	wheel->count = 0;
+
+	return drained;
+}
+
+// func may remove the timer it is called with, but no other timer.
+void _messages_timer_wheel_foreach(messages_timer_wheel_s *wheel, void (*func)(messages_timer_s *timer, void *user_data), void *user_data)
+{
+	int level;
+	int slot;
+	messages_timer_s *timer;
+	messages_timer_s *next;
+
+	for (level=0; level < MESSAGES_TIMER_WHEEL_LEVELS; level++)
+	{
+		for (slot=0; slot < MESSAGES_TIMER_WHEEL_SLOTS; slot++)
+		{
+			for (timer = wheel->slots[level][slot]; NULL != timer; timer = next)
+			{
+				next = timer->next;
+				func(timer, user_data);
+			}
+		}
+	}
+}
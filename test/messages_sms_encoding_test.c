@@ -0,0 +1,51 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <messages.h>
+
+static int check(const char *text, messages_sms_encoding_e encoding, int length, int segments)
+{
+	int ret;
+	messages_sms_encoding_e _encoding;
+	int _length, _segments;
+
+	ret = messages_sms_analyze_text(text, &_encoding, &_length, &_segments);
+	if (MESSAGES_ERROR_NONE != ret) {
+		printf("error: messages_sms_analyze_text() = %d\n", ret);
+		return 1;
+	}
+
+	if (_encoding != encoding || _length != length || _segments != segments) {
+		printf("FAIL '%s': encoding=%d length=%d segments=%d (expected %d %d %d)\n",
+				text, _encoding, _length, _segments, encoding, length, segments);
+		return 1;
+	}
+
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	int failed = 0;
+	char long_text[400];
+	int i;
+
+	failed += check("This is simple message!", MESSAGES_SMS_ENCODING_GSM7BIT, 23, 1);
+	failed += check("Price: 10\xe2\x82\xac {approx}", MESSAGES_SMS_ENCODING_GSM7BIT, 22, 1);
+	failed += check("caf\xc3\xa9 \xce\x94", MESSAGES_SMS_ENCODING_GSM7BIT, 6, 1);
+	failed += check("back`tick", MESSAGES_SMS_ENCODING_UCS2, 9, 1);
+	failed += check("\xed\x95\x9c\xea\xb8\x80", MESSAGES_SMS_ENCODING_UCS2, 2, 1);
+	failed += check("\xf0\x9f\x98\x80!", MESSAGES_SMS_ENCODING_UCS2, 3, 1);
+
+	// 304 basic characters and an escaped one that cannot straddle the first segment boundary
+	for (i=0; i < 305; i++) {
+		long_text[i] = 'a';
+	}
+	long_text[152] = '{';
+	long_text[305] = '\0';
+	failed += check(long_text, MESSAGES_SMS_ENCODING_GSM7BIT, 306, 3);
+
+	printf("%s\n", failed ? "FAILED" : "PASSED");
+
+	return failed ? 1 : 0;
+}
@@ -0,0 +1,199 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <glib.h>
+#include <msg.h>
+
+#include <messages.h>
+#include <messages_private.h>
+
+// Every part starts on a character, fits msg-service and fits a concatenated SMS.
+static int check_split(const char *name, const char *text, int count, const int *offsets)
+{
+	int ret;
+	int i;
+	int len = strlen(text);
+	int *_offsets = NULL;
+	int _count = 0;
+	int segments;
+	char part[MAX_MESSAGES_TEXT_LEN + 1];
+
+	ret = _messages_sms_split_text(text, len, &_offsets, &_count);
+	if (MESSAGES_ERROR_NONE != ret) {
+		printf("error: _messages_sms_split_text(%s) = %d\n", name, ret);
+		return 1;
+	}
+
+	if (0 != _offsets[0] || len != _offsets[_count]) {
+		printf("FAIL %s: the parts cover %d to %d of %d bytes\n", name, _offsets[0], _offsets[_count], len);
+		free(_offsets);
+		return 1;
+	}
+
+	for (i=0; i < _count; i++) {
+		if (_offsets[i+1] <= _offsets[i] || MAX_MESSAGES_TEXT_LEN < _offsets[i+1] - _offsets[i]) {
+			printf("FAIL %s: part %d is %d bytes\n", name, i, _offsets[i+1] - _offsets[i]);
+			free(_offsets);
+			return 1;
+		}
+		if (0x80 == ((unsigned char)text[_offsets[i]] & 0xc0)) {
+			printf("FAIL %s: part %d starts inside a character\n", name, i);
+			free(_offsets);
+			return 1;
+		}
+
+		memcpy(part, text + _offsets[i], _offsets[i+1] - _offsets[i]);
+		part[_offsets[i+1] - _offsets[i]] = '\0';
+		messages_sms_analyze_text(part, NULL, NULL, &segments);
+		if (MAX_MESSAGES_SEGMENT_COUNT < segments) {
+			printf("FAIL %s: part %d takes %d segments\n", name, i, segments);
+			free(_offsets);
+			return 1;
+		}
+	}
+
+	if (NULL != offsets && (_count != count || 0 != memcmp(_offsets, offsets, sizeof(int) * (count + 1)))) {
+		printf("FAIL %s: %d parts (expected %d) at the offsets\n", name, _count, count);
+		for (i=0; i <= _count; i++) {
+			printf("  offset %d = %d\n", i, _offsets[i]);
+		}
+		free(_offsets);
+		return 1;
+	}
+
+	free(_offsets);
+
+	return 0;
+}
+
+static int check_media(const char *name, const void *content, int len, int media_type)
+{
+	int type;
+	FILE *file;
+	char path[64];
+
+	snprintf(path, sizeof(path), "/tmp/messages_media_test_%d.%s", getpid(), name);
+
+	file = fopen(path, "w");
+	if (NULL == file) {
+		printf("error: can not create '%s'\n", path);
+		return 1;
+	}
+	fwrite(content, 1, len, file);
+	fclose(file);
+
+	type = _messages_get_media_type_from_filepath(path);
+	unlink(path);
+
+	if (type != media_type) {
+		printf("FAIL '%s' (%d bytes): media type %d (expected %d)\n", name, len, type, media_type);
+		return 1;
+	}
+
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	int failed = 0;
+	int i;
+	char *text;
+	static const char *plain = "not a known signature";
+
+	// Split offsets
+	{
+		static const int offsets[] = { 0, 5 };
+		failed += check_split("short", "hello", 1, offsets);
+	}
+
+	text = (char *)malloc(4000);
+
+	// 10 segments of 153 characters fill the first part exactly
+	memset(text, 'a', 1531);
+	text[1531] = '\0';
+	{
+		static const int offsets[] = { 0, 1530, 1531 };
+		failed += check_split("gsm7 10 segments", text, 2, offsets);
+	}
+
+	// An escaped character does not straddle a segment, and the parts stay within 10 segments
+	memset(text, 'a', 3000);
+	for (i=152; i < 3000; i += 153) {
+		text[i] = '{';
+	}
+	text[3000] = '\0';
+	failed += check_split("gsm7 escapes", text, 0, NULL);
+
+	// 3-byte characters reach the byte limit of msg-service before 10 UCS-2 segments
+	for (i=0; i < 1200; i++) {
+		memcpy(text + 3 * i, "\xed\x95\x9c", 3);
+	}
+	text[3600] = '\0';
+	failed += check_split("ucs2 bytes", text, 0, NULL);
+
+	// Surrogate pairs take two UCS-2 units
+	for (i=0; i < 900; i++) {
+		memcpy(text + 4 * i, "\xf0\x9f\x98\x80", 4);
+	}
+	text[3600] = '\0';
+	failed += check_split("ucs2 surrogates", text, 0, NULL);
+
+	free(text);
+
+	// Media type from the content
+	failed += check_media("bin", "\xff\xd8\xff\xe0", 4, MESSAGES_MEDIA_IMAGE);
+	failed += check_media("bin", "\x89PNG\r\n\x1a\n", 8, MESSAGES_MEDIA_IMAGE);
+	failed += check_media("bin", "GIF89a", 6, MESSAGES_MEDIA_IMAGE);
+	failed += check_media("bin", "RIFF\0\0\0\0WEBPVP8 ", 16, MESSAGES_MEDIA_IMAGE);
+	failed += check_media("bin", "RIFF\0\0\0\0WAVEfmt ", 16, MESSAGES_MEDIA_AUDIO);
+	failed += check_media("bin", "RIFF\0\0\0\0AVI LIST", 16, MESSAGES_MEDIA_VIDEO);
+	failed += check_media("bin", "\0\0\0\x18" "ftyp3gp4", 12, MESSAGES_MEDIA_VIDEO);
+	failed += check_media("bin", "\0\0\0\x20" "ftypM4A ", 12, MESSAGES_MEDIA_AUDIO);
+	failed += check_media("bin", "#!AMR\n", 6, MESSAGES_MEDIA_AUDIO);
+	failed += check_media("bin", "ID3\x03", 4, MESSAGES_MEDIA_AUDIO);
+	failed += check_media("bin", "\xff\xf1\x50\x80", 4, MESSAGES_MEDIA_AUDIO);
+	failed += check_media("bin", "\xff\xfb\x90\x64", 4, MESSAGES_MEDIA_AUDIO);
+	failed += check_media("bin", "BEGIN:IMELODY\r\n", 15, MESSAGES_MEDIA_AUDIO);
+	// the content wins over the extension
+	failed += check_media("jpg", "OggS\0\x02", 6, MESSAGES_MEDIA_AUDIO);
+	// too short for the RIFF signatures
+	failed += check_media("bin", "RIFF\0\0\0\0WAV", 11, MESSAGES_MEDIA_UNKNOWN);
+
+	// Media type from the extension, for every slot of the perfect hash
+	failed += check_media("mid", plain, strlen(plain), MESSAGES_MEDIA_AUDIO);
+	failed += check_media("midi", plain, strlen(plain), MESSAGES_MEDIA_AUDIO);
+	failed += check_media("amr", plain, strlen(plain), MESSAGES_MEDIA_AUDIO);
+	failed += check_media("awb", plain, strlen(plain), MESSAGES_MEDIA_AUDIO);
+	failed += check_media("imy", plain, strlen(plain), MESSAGES_MEDIA_AUDIO);
+	failed += check_media("xmf", plain, strlen(plain), MESSAGES_MEDIA_AUDIO);
+	failed += check_media("mmf", plain, strlen(plain), MESSAGES_MEDIA_AUDIO);
+	failed += check_media("mp3", plain, strlen(plain), MESSAGES_MEDIA_AUDIO);
+	failed += check_media("ogg", plain, strlen(plain), MESSAGES_MEDIA_AUDIO);
+	failed += check_media("aac", plain, strlen(plain), MESSAGES_MEDIA_AUDIO);
+	failed += check_media("m4a", plain, strlen(plain), MESSAGES_MEDIA_AUDIO);
+	failed += check_media("wav", plain, strlen(plain), MESSAGES_MEDIA_AUDIO);
+	failed += check_media("jpeg", plain, strlen(plain), MESSAGES_MEDIA_IMAGE);
+	failed += check_media("jpg", plain, strlen(plain), MESSAGES_MEDIA_IMAGE);
+	failed += check_media("jpe", plain, strlen(plain), MESSAGES_MEDIA_IMAGE);
+	failed += check_media("bmp", plain, strlen(plain), MESSAGES_MEDIA_IMAGE);
+	failed += check_media("wbmp", plain, strlen(plain), MESSAGES_MEDIA_IMAGE);
+	failed += check_media("png", plain, strlen(plain), MESSAGES_MEDIA_IMAGE);
+	failed += check_media("gif", plain, strlen(plain), MESSAGES_MEDIA_IMAGE);
+	failed += check_media("webp", plain, strlen(plain), MESSAGES_MEDIA_IMAGE);
+	failed += check_media("3gp", plain, strlen(plain), MESSAGES_MEDIA_VIDEO);
+	failed += check_media("3g2", plain, strlen(plain), MESSAGES_MEDIA_VIDEO);
+	failed += check_media("avi", plain, strlen(plain), MESSAGES_MEDIA_VIDEO);
+	failed += check_media("mp4", plain, strlen(plain), MESSAGES_MEDIA_VIDEO);
+	failed += check_media("m4v", plain, strlen(plain), MESSAGES_MEDIA_VIDEO);
+	failed += check_media("JPG", plain, strlen(plain), MESSAGES_MEDIA_IMAGE);
+	// unknown, or longer than any known extension
+	failed += check_media("xyz", plain, strlen(plain), MESSAGES_MEDIA_UNKNOWN);
+	failed += check_media("jpegx", plain, strlen(plain), MESSAGES_MEDIA_UNKNOWN);
+	failed += check_media("txt", plain, strlen(plain), MESSAGES_MEDIA_UNKNOWN);
+
+	printf("%s\n", failed ? "FAILED" : "PASSED");
+
+	return failed ? 1 : 0;
+}